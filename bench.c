@@ -0,0 +1,203 @@
+//
+// sudoku - A SuDoKu solver
+//
+// Copyright (c) 2018  Linde Labs, LLC
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "sudoku.h"
+
+
+// === Benchmark ===
+//
+// Each corpus is read into memory, solved once untimed to warm up caches and the board pool,
+// then solved run_count more times with every puzzle timed on its own. The report is one JSON
+// object per corpus on stdout, so the numbers of two builds can be compared by a script.
+
+
+// Defines
+
+#define BENCH_WARMUP_RUN_COUNT 1
+
+
+// Functions
+
+static
+int compare_latencies(const void *a, const void *b)
+{
+  unsigned long la = *(const unsigned long*)a, lb = *(const unsigned long*)b;
+
+  return ((la > lb) - (la < lb));
+}
+
+
+static inline
+unsigned long elapsed_ns(const struct timespec *start, const struct timespec *end)
+{
+  return (end->tv_sec - start->tv_sec) * 1000000000UL + end->tv_nsec - start->tv_nsec;
+}
+
+
+// Reads the puzzles of a corpus file as grids, returns how many or -1
+static
+long read_bench_corpus(const char *file_name, unsigned char **grids)
+{
+  struct sudoku_input *input;
+  struct sudoku_board *board;
+  const char *line;
+  size_t length;
+  long count, capacity;
+  unsigned char *more;
+
+  input = open_input(file_name);
+  if (!input)
+    return -1;
+
+  *grids = NULL;
+  count = 0;
+  capacity = 0;
+  while ((length = next_input_line(input, &line))) {
+    if ((length < (8*8)+1) || (line[0] == '#') || (line[0] == ';') || (line[0] == '!'))
+      continue;
+    if (count == capacity) {
+      capacity = (capacity ? 2 * capacity : 1024);
+      more = (unsigned char*) realloc(*grids, capacity * 81);
+      if (!more) {
+        count = -1;
+        break;
+      }
+      *grids = more;
+    }
+    board = create_board();
+    read_board_length(board, line, length);
+    board_to_grid(board, *grids + count * 81);
+    destroy_board(&board);
+    count++;
+  }
+  close_input(&input);
+
+  if (count < 0) {
+    free(*grids);
+    *grids = NULL;
+  }
+  return count;
+}
+
+
+// Solves all the puzzles once, with each latency in latencies if given
+static
+void run_bench_pass(const unsigned char *grids, long count, const struct sudoku_solver_config *config,
+                    unsigned long *latencies, struct sudoku_stats *stats, long *solved_count)
+{
+  struct sudoku_board *board;
+  struct timespec start, end;
+  long i;
+
+  *solved_count = 0;
+  for (i=0; i<count; i++) {
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    board = create_board();
+    board->guessing_allowed = config->guessing_allowed;
+    board->chain_max_length = config->chain_max_length;
+    board->probe_budget = config->probe_budget;
+    board->stats = stats;
+    read_board_grid(board, grids + i * 81);
+    solve(board);
+    if (board->undetermined_count == 0)
+      (*solved_count)++;
+    destroy_board(&board);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (latencies)
+      latencies[i] = elapsed_ns(&start, &end);
+  }
+}
+
+
+static
+int run_bench_corpus(const char *file_name, const struct sudoku_solver_config *config, int run_count)
+{
+  struct sudoku_stats stats;
+  struct timespec start, end;
+  unsigned char *grids;
+  unsigned long *latencies, total_ns, latency_count, latency_sum, i;
+  long count, solved_count;
+  int run;
+
+  count = read_bench_corpus(file_name, &grids);
+  if (count < 0) {
+    fprintf(stderr, "Cound not read benchmark corpus: %s\n", file_name);
+    return -1;
+  }
+  if (count == 0) {
+    fprintf(stderr, "No pussles found in file: %s\n", file_name);
+    free(grids);
+    return -1;
+  }
+
+  latency_count = count * run_count;
+  latencies = (unsigned long*) malloc(latency_count * sizeof(unsigned long));
+  if (!latencies) {
+    fprintf(stderr, "Cound not allocate latencies for %lu puzzles\n", latency_count);
+    free(grids);
+    return -1;
+  }
+
+  // The solver is deterministic, so the statistics of the warm-up are those of every run -
+  // and counting stays out of the timed runs
+  memset(&stats, 0, sizeof(stats));
+  for (run=0; run<BENCH_WARMUP_RUN_COUNT; run++)
+    run_bench_pass(grids, count, config, NULL, (run ? NULL : &stats), &solved_count);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (run=0; run<run_count; run++)
+    run_bench_pass(grids, count, config, latencies + run * count, NULL, &solved_count);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  total_ns = elapsed_ns(&start, &end);
+
+  latency_sum = 0;
+  for (i=0; i<latency_count; i++)
+    latency_sum += latencies[i];
+  qsort(latencies, latency_count, sizeof(unsigned long), compare_latencies);
+
+  printf("{\"corpus\":\"%s\",\"puzzles\":%li,\"runs\":%i,\"solved\":%li,\"unsolved\":%li,"
+         "\"puzzles_per_second\":%.1f,\"mean_ns\":%lu,\"p50_ns\":%lu,\"p99_ns\":%lu,\"max_ns\":%lu,"
+         "\"guesses_per_puzzle\":%.3f}\n",
+         file_name, count, run_count, solved_count, count - solved_count,
+         (total_ns ? (double)latency_count * 1e9 / total_ns : 0.0), latency_sum / latency_count,
+         latencies[(latency_count - 1) * 50 / 100], latencies[(latency_count - 1) * 99 / 100], latencies[latency_count - 1],
+         (double)stats.guesses / count);
+  fflush(stdout);
+
+  free(latencies);
+  free(grids);
+  return 0;
+}
+
+
+int run_benchmark(int file_count, char **file_names, const struct sudoku_solver_config *config, int run_count)
+{
+  int i, status;
+
+  status = 0;
+  for (i=0; i<file_count; i++) {
+    if (run_bench_corpus(file_names[i], config, run_count) != 0)
+      status = -1;
+  }
+
+  return status;
+}
@@ -0,0 +1,340 @@
+//
+// sudoku - A SuDoKu solver
+//
+// Copyright (c) 2018  Linde Labs, LLC
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "sudoku.h"
+
+
+// === Binary puzzle and solution files ===
+//
+// A header, fixed-size records and an optional index block at the end:
+//   - Each record is the puzzle packed 4 bits per cell, then optionally the solution packed the
+//     same way and a small stats field, as given by the header flags.
+//   - The index block lists (puzzle hash, record number) sorted by hash, so a puzzle can be found
+//     without scanning. Records themselves are found by number since they have a fixed size.
+// All numbers are stored in host byte order. Files are read through a memory mapping.
+
+
+// Defines
+
+#define BINARY_MAGIC    "SDKBIN01"
+#define BINARY_VERSION  1
+
+
+// Struct & types
+
+struct sudoku_binary_header {
+  char magic[8];
+  unsigned int version;
+  unsigned int flags;
+  unsigned int record_size;
+  unsigned int reserved;
+  unsigned long record_count;
+  unsigned long index_offset; // 0 = no index
+};
+
+struct sudoku_binary_index_entry {
+  unsigned int hash;
+  unsigned int reserved;
+  unsigned long record;
+};
+
+
+// Functions
+
+static
+unsigned int binary_record_size(unsigned int flags)
+{
+  unsigned int size = PACKED_GRID_SIZE;
+
+  if (flags & BINARY_HAS_SOLUTIONS)
+    size += PACKED_GRID_SIZE;
+  if (flags & BINARY_HAS_STATS)
+    size += sizeof(struct sudoku_binary_stats);
+
+  return size;
+}
+
+
+int is_binary_input(struct sudoku_input *input)
+{
+  return ((input->size >= sizeof(struct sudoku_binary_header)) &&
+          (memcmp(input->data, BINARY_MAGIC, 8) == 0));
+}
+
+
+// The index goes after the records and must fit in the file, bounds are divided rather than
+// multiplied so a bad header can't overflow them
+static
+int is_binary_index_valid(const struct sudoku_binary_header *header, size_t size)
+{
+  return ((header->index_offset >= sizeof(*header) + header->record_count * header->record_size) &&
+          (header->index_offset <= size) &&
+          (header->record_count <= (size - header->index_offset) / sizeof(struct sudoku_binary_index_entry)));
+}
+
+
+struct sudoku_binary* open_binary(const char *file_name)
+{
+  struct sudoku_binary *binary;
+  struct sudoku_binary_header *header;
+  struct sudoku_input *input;
+
+  input = open_input(file_name);
+  if (!input)
+    return NULL;
+
+  // Records are read in place, so all of the file has to be mapped
+  header = (struct sudoku_binary_header*) input->data;
+  if (!input->mapped || !is_binary_input(input) ||
+      (header->version != BINARY_VERSION) ||
+      (header->record_size != binary_record_size(header->flags)) ||
+      (header->record_count > (input->size - sizeof(*header)) / header->record_size) ||
+      (header->index_offset && !is_binary_index_valid(header, input->size))) {
+    fprintf(stderr, "Not a valid binary Sudoku file: %s\n", file_name);
+    close_input(&input);
+    return NULL;
+  }
+
+  binary = (struct sudoku_binary*) calloc(1, sizeof(struct sudoku_binary));
+  if (!binary) {
+    close_input(&input);
+    return NULL;
+  }
+
+  binary->input = input;
+  binary->flags = header->flags;
+  binary->record_size = header->record_size;
+  binary->record_count = header->record_count;
+
+  return binary;
+}
+
+
+struct sudoku_binary* create_binary(const char *file_name, unsigned int flags)
+{
+  struct sudoku_binary *binary;
+  struct sudoku_binary_header header;
+
+  binary = (struct sudoku_binary*) calloc(1, sizeof(struct sudoku_binary));
+  if (!binary)
+    return NULL;
+
+  binary->f = fopen(file_name, "wb");
+  if (!binary->f) {
+    free(binary);
+    return NULL;
+  }
+
+  binary->flags = flags;
+  binary->record_size = binary_record_size(flags);
+
+  // Real header goes in when the file is closed
+  memset(&header, 0, sizeof(header));
+  if (fwrite(&header, sizeof(header), 1, binary->f) != 1) {
+    fclose(binary->f);
+    free(binary);
+    return NULL;
+  }
+
+  return binary;
+}
+
+
+static
+int compare_index_entries(const void *a, const void *b)
+{
+  const struct sudoku_binary_index_entry *entry_a = a, *entry_b = b;
+
+  if (entry_a->hash != entry_b->hash)
+    return ((entry_a->hash < entry_b->hash) ? -1 : 1);
+  if (entry_a->record != entry_b->record)
+    return ((entry_a->record < entry_b->record) ? -1 : 1);
+  return 0;
+}
+
+
+int close_binary(struct sudoku_binary **binary)
+{
+  struct sudoku_binary_header header;
+  int status;
+
+  if (!*binary)
+    return 0;
+
+  status = 0;
+  if ((*binary)->f) {
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BINARY_MAGIC, sizeof(header.magic));
+    header.version = BINARY_VERSION;
+    header.flags = (*binary)->flags;
+    header.record_size = (*binary)->record_size;
+    header.record_count = (*binary)->record_count;
+
+    // No index if we ran out of memory for it along the way
+    if ((*binary)->index && (*binary)->record_count) {
+      qsort((*binary)->index, (*binary)->record_count, sizeof(struct sudoku_binary_index_entry), compare_index_entries);
+      header.index_offset = sizeof(header) + (*binary)->record_count * (*binary)->record_size;
+      if (fwrite((*binary)->index, sizeof(struct sudoku_binary_index_entry), (*binary)->record_count, (*binary)->f) != (*binary)->record_count)
+        status = -1;
+    }
+
+    if ((fseek((*binary)->f, 0, SEEK_SET) != 0) ||
+        (fwrite(&header, sizeof(header), 1, (*binary)->f) != 1))
+      status = -1;
+    if (fclose((*binary)->f) != 0)
+      status = -1;
+    free((*binary)->index);
+  }
+
+  close_input(&(*binary)->input);
+  free(*binary);
+  *binary = NULL;
+
+  return status;
+}
+
+
+static
+const unsigned char* binary_record(struct sudoku_binary *binary, unsigned long record)
+{
+  return (const unsigned char*) binary->input->data + sizeof(struct sudoku_binary_header) + record * binary->record_size;
+}
+
+
+// Returns 1 if the record has a solution, solution and stats may be NULL
+int read_binary_record(struct sudoku_binary *binary, unsigned long record, unsigned char puzzle[81],
+                       unsigned char solution[81], struct sudoku_binary_stats *stats)
+{
+  const unsigned char *data;
+
+  assert(binary->input && (record < binary->record_count));
+
+  data = binary_record(binary, record);
+  unpack_grid(data, puzzle);
+  data += PACKED_GRID_SIZE;
+
+  if (binary->flags & BINARY_HAS_SOLUTIONS) {
+    if (solution)
+      unpack_grid(data, solution);
+    data += PACKED_GRID_SIZE;
+  }
+
+  if (stats) {
+    if (binary->flags & BINARY_HAS_STATS)
+      memcpy(stats, data, sizeof(*stats));
+    else
+      memset(stats, 0, sizeof(*stats));
+  }
+
+  return ((binary->flags & BINARY_HAS_SOLUTIONS) != 0);
+}
+
+
+int write_binary_record(struct sudoku_binary *binary, const unsigned char puzzle[81],
+                        const unsigned char solution[81], const struct sudoku_binary_stats *stats)
+{
+  unsigned char data[2*PACKED_GRID_SIZE + sizeof(struct sudoku_binary_stats)];
+  struct sudoku_binary_index_entry *index;
+  unsigned int size;
+
+  assert(binary->f);
+
+  pack_grid(puzzle, data);
+  size = PACKED_GRID_SIZE;
+
+  if (binary->flags & BINARY_HAS_SOLUTIONS) {
+    if (solution)
+      pack_grid(solution, data + size);
+    else
+      memset(data + size, 0, PACKED_GRID_SIZE);
+    size += PACKED_GRID_SIZE;
+  }
+
+  if (binary->flags & BINARY_HAS_STATS) {
+    if (stats)
+      memcpy(data + size, stats, sizeof(*stats));
+    else
+      memset(data + size, 0, sizeof(*stats));
+    size += sizeof(*stats);
+  }
+
+  // Grow the index as we go, give up on it (not the file) if there is no memory
+  if ((binary->record_count == binary->index_capacity) && (binary->index || (binary->record_count == 0))) {
+    binary->index_capacity = (binary->index_capacity ? 2 * binary->index_capacity : 4096);
+    index = (struct sudoku_binary_index_entry*) realloc(binary->index, binary->index_capacity * sizeof(*index));
+    if (!index) {
+      free(binary->index);
+      binary->index_capacity = 0;
+    }
+    binary->index = index;
+  }
+  if (binary->index) {
+    binary->index[binary->record_count].hash = packed_grid_hash(data, 0);
+    binary->index[binary->record_count].reserved = 0;
+    binary->index[binary->record_count].record = binary->record_count;
+  }
+
+  if (fwrite(data, size, 1, binary->f) != 1)
+    return -1;
+  binary->record_count++;
+
+  return 0;
+}
+
+
+// Returns the record number of the puzzle, -1 if it isn't there or there is no index
+long find_binary_record(struct sudoku_binary *binary, const unsigned char puzzle[81])
+{
+  const struct sudoku_binary_header *header;
+  const struct sudoku_binary_index_entry *index;
+  unsigned char packed[PACKED_GRID_SIZE];
+  unsigned long low, high, middle;
+  unsigned int hash;
+
+  assert(binary->input);
+
+  header = (const struct sudoku_binary_header*) binary->input->data;
+  if (!header->index_offset)
+    return -1;
+  index = (const struct sudoku_binary_index_entry*) (binary->input->data + header->index_offset);
+
+  pack_grid(puzzle, packed);
+  hash = packed_grid_hash(packed, 0);
+
+  // First entry with the hash
+  low = 0;
+  high = binary->record_count;
+  while (low < high) {
+    middle = low + (high - low) / 2;
+    if (index[middle].hash < hash)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+
+  for (; (low < binary->record_count) && (index[low].hash == hash); low++) {
+    if (memcmp(binary_record(binary, index[low].record), packed, PACKED_GRID_SIZE) == 0)
+      return index[low].record;
+  }
+
+  return -1;
+}
@@ -17,10 +17,22 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
+#include <pthread.h>
 #include "sudoku.h"
 
-static struct sudoku_board *free_board_pool = NULL;
+// One pool per thread so batch worker threads can create and destroy boards without locking.
+// The key frees the pool of a thread that exits, the thread may belong to a library user.
+static _Thread_local struct sudoku_board *free_board_pool = NULL;
+static _Thread_local int board_pool_registered = 0;
+static pthread_key_t board_pool_key;
+static pthread_once_t board_pool_key_once = PTHREAD_ONCE_INIT;
+
+// Number to output char, empty cells as '0', '.' and ' '
+static const char number_to_char[10]       = { '0', '1', '2', '3', '4', '5', '6', '7', '8', '9' };
+static const char number_to_dot_char[10]   = { '.', '1', '2', '3', '4', '5', '6', '7', '8', '9' };
+static const char number_to_space_char[10] = { ' ', '1', '2', '3', '4', '5', '6', '7', '8', '9' };
 
 static const unsigned int rowcol_to_tile[9][9] = {
   { 0, 0, 0, 1, 1, 1, 2, 2, 2 },
@@ -88,11 +100,15 @@ void init_board(struct sudoku_board *board)
   board->undetermined_count = (9*9);
   board->dead = 0;
   board->guessing_allowed = GUESSING_ALLOWED_DEFAULT;
+  board->chain_max_length = CHAIN_MAX_LENGTH_DEFAULT;
+  board->probe_budget = PROBE_BUDGET_DEFAULT;
+  board->solutions_max = MAX_SOLUTIONS;
   board->solutions_count = 0;
   board->solutions_list = NULL;
   board->next = NULL;
   board->nest_level = 0;
   board->debug_level = 0;
+  board->stats = NULL;
 }
 
 
@@ -148,11 +164,15 @@ void init_board_from_orig(struct sudoku_board *board, struct sudoku_board *orig_
   board->undetermined_count = orig_board->undetermined_count;
   board->dead = orig_board->dead;
   board->guessing_allowed = orig_board->guessing_allowed;
+  board->chain_max_length = orig_board->chain_max_length;
+  board->probe_budget = orig_board->probe_budget;
+  board->solutions_max = orig_board->solutions_max;
   board->solutions_count = 0;
   board->solutions_list = NULL;
   board->next = NULL;
   board->nest_level = orig_board->nest_level;
   board->debug_level = orig_board->debug_level;
+  board->stats = orig_board->stats;
 }
 
 
@@ -191,11 +211,54 @@ void copy_board(struct sudoku_board *src, struct sudoku_board *dest)
   dest->undetermined_count = src->undetermined_count;
   dest->dead = src->dead;
   dest->guessing_allowed = src->guessing_allowed;
+  dest->chain_max_length = src->chain_max_length;
+  dest->probe_budget = src->probe_budget;
+  dest->solutions_max = src->solutions_max;
   dest->nest_level = src->nest_level;
   dest->debug_level = src->debug_level;
 }
 
 
+static
+void free_board_list(struct sudoku_board *board)
+{
+  struct sudoku_board *next;
+
+  while (board) {
+    next = board->next;
+    free(board);
+    board = next;
+  }
+}
+
+
+static
+void destroy_board_pool(void *data)
+{
+  struct sudoku_board **pool = (struct sudoku_board**) data;
+
+  free_board_list(*pool);
+  *pool = NULL;
+}
+
+
+static
+void create_board_pool_key()
+{
+  pthread_key_create(&board_pool_key, destroy_board_pool);
+}
+
+
+// The first board pooled by a thread makes sure its pool is freed when the thread exits
+static
+void register_board_pool()
+{
+  pthread_once(&board_pool_key_once, create_board_pool_key);
+  pthread_setspecific(board_pool_key, &free_board_pool);
+  board_pool_registered = 1;
+}
+
+
 struct sudoku_board* create_board()
 {
   struct sudoku_board *board;
@@ -228,12 +291,22 @@ void destroy_board(struct sudoku_board **board)
     current = next;
   }
 
+  if (!board_pool_registered)
+    register_board_pool();
   (*board)->next = free_board_pool;
   free_board_pool = (*board); 
   *board = NULL;
 }
 
 
+// Frees the boards pooled by the calling thread now rather than when it exits
+void release_board_pool()
+{
+  free_board_list(free_board_pool);
+  free_board_pool = NULL;
+}
+
+
 struct sudoku_board* dupilcate_board(struct sudoku_board *board)
 {
   struct sudoku_board *dup;
@@ -280,15 +353,17 @@ void add_to_board_solutions_list(struct sudoku_board *board, struct sudoku_board
     assert(board->solutions_count == 0);
     board->solutions_count = 1;
   } else {
-    while (current) {
+    // Kept in the order found, so the first solution found is first
+    for (;;) {
       if (same_solution_boards(current, solution_board)) {
         destroy_board(&solution_board);
         return;
       }
+      if (!current->next)
+        break;
       current = current->next;
     }
-    solution_board->next = board->solutions_list;
-    board->solutions_list = solution_board;
+    current->next = solution_board;
     board->solutions_count++;   
   }
 }
@@ -308,67 +383,200 @@ void add_list_to_board_solutions_list(struct sudoku_board *board, struct sudoku_
 }
 
 
-void print_board(struct sudoku_board *board)
+size_t format_board(struct sudoku_board *board, char *buffer)
 {
   int row, col;
-  unsigned int number;
+  char *p = buffer;
 
   for (row=0; row<9; row++) {    
     for (col=0; col<9; col++) {
-      number = board->cells[row][col].number;
-
-      printf(" %c", ( (number > 0) ? ('0' + number) : '.' ) );
-      if ((col == 2) || (col == 5))
-          printf(" |");
+      *p++ = ' ';
+      *p++ = number_to_dot_char[board->cells[row][col].number];
+      if ((col == 2) || (col == 5)) {
+        memcpy(p, " |", 2);
+        p += 2;
+      }
+    }
+    *p++ = '\n';
+    if ((row == 2) || (row == 5)) {
+      memcpy(p, "-------+-------+-------\n", 24);
+      p += 24;
     }
-    printf("\n");
-    if ((row == 2) || (row == 5))
-      printf("-------+-------+-------\n");
   }
+
+  return p - buffer;
 }
 
 
-void print_board_simple(struct sudoku_board *board)
+size_t format_board_simple(struct sudoku_board *board, char *buffer)
 {
   int row, col;
+  char *p = buffer;
 
   for (row=0; row<9; row++) {    
-    for (col=0; col<9; col++) {
-      printf("%c", '0' + board->cells[row][col].number);
-    }
-    printf("\n");
+    for (col=0; col<9; col++)
+      *p++ = number_to_char[board->cells[row][col].number];
+    *p++ = '\n';
   }
+
+  return p - buffer;
 }
 
 
-void print_board_line(FILE *f, struct sudoku_board *board)
+size_t format_board_line(struct sudoku_board *board, char *buffer)
 {
   int row, col;
+  char *p = buffer;
 
   for (row=0; row<9; row++) {    
-    for (col=0; col<9; col++) {
-      fprintf(f, "%c", '0' + board->cells[row][col].number);
-    }
+    for (col=0; col<9; col++)
+      *p++ = number_to_char[board->cells[row][col].number];
   }
-  fprintf(f, "\n");
+  *p++ = '\n';
+
+  return p - buffer;
 }
 
 
-void print_board_latex(struct sudoku_board *board)
+size_t format_board_latex(struct sudoku_board *board, char *buffer)
 {
   int row, col;
-  char ch;
+  char *p = buffer;
 
   for (row=0; row<9; row++) {    
-    printf("\\setrow ");
+    memcpy(p, "\\setrow ", 8);
+    p += 8;
     for (col=0; col<9; col++) {
-      ch = ('0' + board->cells[row][col].number);
-      printf("{%c}", ((ch == '0') ? ' ' : ch));
-      if ((col == 2) || (col == 5))
-          printf("  ");
+      *p++ = '{';
+      *p++ = number_to_space_char[board->cells[row][col].number];
+      *p++ = '}';
+      if ((col == 2) || (col == 5)) {
+        memcpy(p, "  ", 2);
+        p += 2;
+      }
     }
-    printf("\n");
+    *p++ = '\n';
     if ((row == 2) || (row == 5))
-      printf("\n");
+      *p++ = '\n';
+  }
+
+  return p - buffer;
+}
+
+
+size_t format_grid_line(const unsigned char grid[81], char *buffer)
+{
+  int i;
+
+  for (i=0; i<81; i++)
+    buffer[i] = number_to_char[grid[i]];
+  buffer[81] = '\n';
+
+  return BOARD_LINE_SIZE;
+}
+
+
+// The print functions format the whole board first and write it with one call
+
+void print_board(struct sudoku_board *board)
+{
+  char buffer[BOARD_FORMAT_SIZE];
+
+  fwrite(buffer, 1, format_board(board, buffer), stdout);
+}
+
+
+void print_board_simple(struct sudoku_board *board)
+{
+  char buffer[BOARD_FORMAT_SIZE];
+
+  fwrite(buffer, 1, format_board_simple(board, buffer), stdout);
+}
+
+
+void print_board_line(FILE *f, struct sudoku_board *board)
+{
+  char buffer[BOARD_FORMAT_SIZE];
+
+  fwrite(buffer, 1, format_board_line(board, buffer), f);
+}
+
+
+void print_board_latex(struct sudoku_board *board)
+{
+  char buffer[BOARD_FORMAT_SIZE];
+
+  fwrite(buffer, 1, format_board_latex(board, buffer), stdout);
+}
+
+
+void board_to_grid(struct sudoku_board *board, unsigned char grid[81])
+{
+  int row, col;
+
+  for (row=0; row<9; row++)
+    for (col=0; col<9; col++)
+      grid[row*9 + col] = board->cells[row][col].number;
+}
+
+
+// Numbers still possible in an empty cell (b1=1, b2=2, ...), 0 for a cell with a number
+unsigned int get_possible_number_set(struct sudoku_board *board, unsigned int row, unsigned int col)
+{
+  struct sudoku_cell *cell = &board->cells[row][col];
+  unsigned int possible_number_set;
+
+  if (cell->number)
+    return 0;
+
+  possible_number_set = NUMBER_TAKEN_TO_AVAILABLE_SET(*cell->row_number_taken_set_ref | *cell->col_number_taken_set_ref |
+                                                      *cell->tile_number_taken_set_ref);
+  if (possible_number_set && cell->reserved_for_number_set)
+    possible_number_set &= cell->reserved_for_number_set;
+
+  return possible_number_set;
+}
+
+
+void print_grid_line(FILE *f, const unsigned char grid[81])
+{
+  char buffer[BOARD_LINE_SIZE];
+
+  fwrite(buffer, 1, format_grid_line(grid, buffer), f);
+}
+
+
+void pack_grid(const unsigned char grid[81], unsigned char packed[PACKED_GRID_SIZE])
+{
+  int i;
+
+  for (i=0; i<40; i++)
+    packed[i] = grid[2*i] | (grid[2*i + 1] << 4);
+  packed[40] = grid[80];
+}
+
+
+void unpack_grid(const unsigned char packed[PACKED_GRID_SIZE], unsigned char grid[81])
+{
+  int i;
+
+  for (i=0; i<40; i++) {
+    grid[2*i] = packed[i] & 0xF;
+    grid[2*i + 1] = packed[i] >> 4;
+  }
+  grid[80] = packed[40] & 0xF;
+}
+
+
+unsigned int packed_grid_hash(const unsigned char packed[PACKED_GRID_SIZE], unsigned int flags)
+{
+  unsigned int i, hash;
+
+  // FNV-1a
+  hash = 2166136261u ^ flags;
+  for (i=0; i<PACKED_GRID_SIZE; i++) {
+    hash ^= packed[i];
+    hash *= 16777619u;
   }
+  return hash;
 }
@@ -0,0 +1,234 @@
+//
+// sudoku - A SuDoKu solver
+//
+// Copyright (c) 2018  Linde Labs, LLC
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "sudoku.h"
+
+
+// === LRU result cache keyed by canonical puzzle form ===
+//
+// All entries are allocated up front from the memory budget. Entries are found through a chained
+// hash table and kept on a doubly linked LRU list (most recently used first), both linked by entry
+// index. When the cache is full the least recently used entry is reused.
+
+
+// Defines
+
+#define CACHE_NO_ENTRY 0xFFFFFFFF
+
+
+// Struct & types
+
+struct sudoku_cache_entry {
+  unsigned char key[PACKED_GRID_SIZE];      // Canonical puzzle
+  unsigned char solution[PACKED_GRID_SIZE]; // Solution in canonical form
+  unsigned char flags;
+  unsigned char solutions_count;
+  unsigned int hash;
+  unsigned int hash_next;
+  unsigned int lru_prev;
+  unsigned int lru_next;
+};
+
+
+// Functions
+
+struct sudoku_cache* create_cache(size_t memory_budget)
+{
+  struct sudoku_cache *cache;
+  unsigned int capacity, bucket_count, i;
+
+  // Each entry needs less than two buckets since bucket_count < 2*capacity
+  capacity = memory_budget / (sizeof(struct sudoku_cache_entry) + 2*sizeof(unsigned int));
+  if (capacity == 0)
+    return NULL;
+
+  // Power of two buckets, at least as many as entries
+  bucket_count = 1;
+  while (bucket_count < capacity)
+    bucket_count <<= 1;
+
+  cache = (struct sudoku_cache*) malloc(sizeof(struct sudoku_cache));
+  if (!cache)
+    return NULL;
+
+  cache->entries = (struct sudoku_cache_entry*) malloc(capacity * sizeof(struct sudoku_cache_entry));
+  cache->buckets = (unsigned int*) malloc(bucket_count * sizeof(unsigned int));
+  if (!cache->entries || !cache->buckets) {
+    free(cache->entries);
+    free(cache->buckets);
+    free(cache);
+    return NULL;
+  }
+
+  for (i=0; i<bucket_count; i++)
+    cache->buckets[i] = CACHE_NO_ENTRY;
+
+  cache->capacity = capacity;
+  cache->bucket_mask = bucket_count - 1;
+  cache->count = 0;
+  cache->lru_head = CACHE_NO_ENTRY;
+  cache->lru_tail = CACHE_NO_ENTRY;
+  cache->hits = 0;
+  cache->misses = 0;
+  cache->evictions = 0;
+
+  return cache;
+}
+
+
+void destroy_cache(struct sudoku_cache **cache)
+{
+  if (*cache) {
+    free((*cache)->entries);
+    free((*cache)->buckets);
+    free(*cache);
+    *cache = NULL;
+  }
+}
+
+
+static inline
+void cache_lru_unlink(struct sudoku_cache *cache, unsigned int index)
+{
+  struct sudoku_cache_entry *entry = &cache->entries[index];
+
+  if (entry->lru_prev != CACHE_NO_ENTRY)
+    cache->entries[entry->lru_prev].lru_next = entry->lru_next;
+  else
+    cache->lru_head = entry->lru_next;
+
+  if (entry->lru_next != CACHE_NO_ENTRY)
+    cache->entries[entry->lru_next].lru_prev = entry->lru_prev;
+  else
+    cache->lru_tail = entry->lru_prev;
+}
+
+
+static inline
+void cache_lru_push_front(struct sudoku_cache *cache, unsigned int index)
+{
+  struct sudoku_cache_entry *entry = &cache->entries[index];
+
+  entry->lru_prev = CACHE_NO_ENTRY;
+  entry->lru_next = cache->lru_head;
+  if (cache->lru_head != CACHE_NO_ENTRY)
+    cache->entries[cache->lru_head].lru_prev = index;
+  else
+    cache->lru_tail = index;
+  cache->lru_head = index;
+}
+
+
+static
+unsigned int cache_find(struct sudoku_cache *cache, const unsigned char key[PACKED_GRID_SIZE], unsigned int flags, unsigned int hash)
+{
+  struct sudoku_cache_entry *entry;
+  unsigned int index;
+
+  index = cache->buckets[hash & cache->bucket_mask];
+  while (index != CACHE_NO_ENTRY) {
+    entry = &cache->entries[index];
+    if ((entry->hash == hash) && (entry->flags == flags) && (memcmp(entry->key, key, PACKED_GRID_SIZE) == 0))
+      return index;
+    index = entry->hash_next;
+  }
+  return CACHE_NO_ENTRY;
+}
+
+
+static
+void cache_hash_unlink(struct sudoku_cache *cache, unsigned int index)
+{
+  unsigned int *link;
+
+  link = &cache->buckets[cache->entries[index].hash & cache->bucket_mask];
+  while (*link != index) {
+    assert(*link != CACHE_NO_ENTRY);
+    link = &cache->entries[*link].hash_next;
+  }
+  *link = cache->entries[index].hash_next;
+}
+
+
+int cache_lookup(struct sudoku_cache *cache, const unsigned char canon_grid[81], unsigned int flags,
+                 unsigned char canon_solution[81], unsigned int *solutions_count)
+{
+  unsigned char key[PACKED_GRID_SIZE];
+  unsigned int index;
+
+  pack_grid(canon_grid, key);
+  index = cache_find(cache, key, flags, packed_grid_hash(key, flags));
+  if (index == CACHE_NO_ENTRY) {
+    cache->misses++;
+    return 0;
+  }
+
+  cache->hits++;
+  cache_lru_unlink(cache, index);
+  cache_lru_push_front(cache, index);
+
+  unpack_grid(cache->entries[index].solution, canon_solution);
+  if (solutions_count)
+    *solutions_count = cache->entries[index].solutions_count;
+
+  return 1;
+}
+
+
+void cache_insert(struct sudoku_cache *cache, const unsigned char canon_grid[81], unsigned int flags,
+                  const unsigned char canon_solution[81], unsigned int solutions_count)
+{
+  struct sudoku_cache_entry *entry;
+  unsigned char key[PACKED_GRID_SIZE];
+  unsigned int index, hash, bucket;
+
+  pack_grid(canon_grid, key);
+  hash = packed_grid_hash(key, flags);
+  index = cache_find(cache, key, flags, hash);
+
+  if (index != CACHE_NO_ENTRY) {
+    // Already there - just refresh it
+    cache_lru_unlink(cache, index);
+  } else {
+    if (cache->count < cache->capacity) {
+      index = cache->count++;
+    } else {
+      // Full - reuse the least recently used entry
+      index = cache->lru_tail;
+      cache_lru_unlink(cache, index);
+      cache_hash_unlink(cache, index);
+      cache->evictions++;
+    }
+
+    entry = &cache->entries[index];
+    memcpy(entry->key, key, PACKED_GRID_SIZE);
+    entry->flags = flags;
+    entry->hash = hash;
+    bucket = hash & cache->bucket_mask;
+    entry->hash_next = cache->buckets[bucket];
+    cache->buckets[bucket] = index;
+  }
+
+  entry = &cache->entries[index];
+  pack_grid(canon_solution, entry->solution);
+  entry->solutions_count = solutions_count;
+  cache_lru_push_front(cache, index);
+}
@@ -0,0 +1,415 @@
+//
+// sudoku - A SuDoKu solver
+//
+// Copyright (c) 2018  Linde Labs, LLC
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <assert.h>
+#include "sudoku.h"
+
+
+// === Canonical form under the Sudoku symmetry group ===
+//
+// The canonical form of a grid is the lexicographically smallest 81 cell sequence (read row by row,
+// empty cells as 0) that can be reached by transposing, permuting bands, permuting rows within bands,
+// permuting stacks, permuting cols within stacks and relabeling numbers. Numbers are always relabeled
+// in order of first appearance, so the number relabeling never needs to be searched.
+//
+// The search builds the canonical grid one row at a time and only keeps the partial transformations
+// (candidates) that produce the smallest prefix so far. Leading empty rows leave the cols free, the
+// first row with numbers in it decides the col permutation (searched depth first with pruning) and
+// the remaining rows only pick among the allowed source rows.
+
+
+// Defines
+
+#define CANON_NO_NUMBER 10 // Larger than any number, used as "infinity" for the best grid
+
+
+// Struct & types
+
+struct canon_candidate {
+  // Everything up to row_map decides the future of a candidate (compared when removing duplicates)
+  unsigned char transposed;
+  unsigned char band;            // Source band of the last placed row
+  unsigned short used_row_set;   // Bitset representing the source rows already placed (b0=row0, b1=row1, ...)
+  unsigned char cols_decided;    // Set once a row with numbers in it has been placed
+  unsigned char col_map[9];      // col_map[c] = source col placed at canonical col c
+  unsigned char number_map[10];  // number_map[n] = canonical number for source number n (0 = not seen yet)
+  unsigned char next_number;
+  // Path taken so far
+  unsigned char row_map[9];      // row_map[r] = source row placed at canonical row r
+};
+
+#define CANON_CANDIDATE_KEY_SIZE (offsetof(struct canon_candidate, row_map))
+
+struct canon_list {
+  struct canon_candidate *candidates;
+  unsigned int count;
+  unsigned int size;
+};
+
+struct canon_context {
+  unsigned char source[2][81]; // The grid as given and transposed
+  unsigned char count[2][9];   // Number count per source row
+  unsigned char leading_zeros[2][9]; // Most empty cells a source row can start with
+  unsigned char best[81];      // Smallest grid found so far (only valid up to the row being placed)
+  struct canon_list *list;     // Candidates producing best
+};
+
+
+// Grow-only candidate lists, one pair per thread so canonicalize_grid() stays reentrant
+static _Thread_local struct canon_list canon_lists[2];
+
+
+// Functions
+
+static
+void canon_list_append(struct canon_list *list, const struct canon_candidate *candidate)
+{
+  struct canon_candidate *candidates;
+  unsigned int size;
+
+  if (list->count == list->size) {
+    size = (list->size ? (2 * list->size) : 1024);
+    candidates = (struct canon_candidate*) realloc(list->candidates, size * sizeof(struct canon_candidate));
+    if (!candidates) {
+      fprintf(stderr, "Out of memory in %s\n", __func__);
+      exit(1);
+    }
+    list->candidates = candidates;
+    list->size = size;
+  }
+
+  list->candidates[list->count++] = *candidate;
+}
+
+
+static
+int canon_candidate_compare(const void *a, const void *b)
+{
+  return memcmp(a, b, CANON_CANDIDATE_KEY_SIZE);
+}
+
+
+static
+void canon_list_remove_duplicates(struct canon_list *list)
+{
+  unsigned int i, count;
+
+  if (list->count <= 1)
+    return;
+
+  // Candidates with the same key produce the same rows from here on - keep one of them
+  qsort(list->candidates, list->count, sizeof(struct canon_candidate), &canon_candidate_compare);
+  count = 1;
+  for (i=1; i<list->count; i++) {
+    if (canon_candidate_compare(&list->candidates[count-1], &list->candidates[i]) != 0)
+      list->candidates[count++] = list->candidates[i];
+  }
+  list->count = count;
+}
+
+
+static inline
+unsigned int canon_map_number(struct canon_candidate *candidate, unsigned int number)
+{
+  if (number == 0)
+    return 0;
+  if (candidate->number_map[number] == 0)
+    candidate->number_map[number] = candidate->next_number++;
+  return candidate->number_map[number];
+}
+
+
+// Depth first search over all col permutations for the first row with numbers in it
+static
+void canon_place_cols(struct canon_context *ctx, struct canon_candidate *candidate, const unsigned char *row,
+                      unsigned char *best, unsigned int pos, unsigned int used_col_set)
+{
+  unsigned int col, col_set, stack, number;
+  int new_number;
+
+  if (pos >= 9) {
+    candidate->cols_decided = 1;
+    canon_list_append(ctx->list, candidate);
+    candidate->cols_decided = 0;
+    return;
+  }
+
+  if ((pos % 3) == 0) {
+    // Start of a new stack - any col in an unused stack
+    col_set = 0;
+    for (stack=0; stack<3; stack++) {
+      if ((used_col_set & (0x7 << (3*stack))) == 0)
+        col_set |= (0x7 << (3*stack));
+    }
+  } else {
+    // Stay within the stack of the previous col
+    col_set = (0x7 << (3*(candidate->col_map[pos-1]/3))) & ~used_col_set;
+  }
+
+  while (col_set) {
+    col = __builtin_ctz(col_set);
+    col_set &= (col_set - 1);
+
+    new_number = (row[col] && (candidate->number_map[row[col]] == 0));
+    number = (row[col] ? (new_number ? candidate->next_number : candidate->number_map[row[col]]) : 0);
+
+    if (number > best[pos])
+      continue;
+    if (number < best[pos]) {
+      // New smallest prefix - everything found so far is worse
+      best[pos] = number;
+      memset(&best[pos+1], CANON_NO_NUMBER, &ctx->best[81] - &best[pos+1]);
+      ctx->list->count = 0;
+    }
+
+    candidate->col_map[pos] = col;
+    if (new_number)
+      canon_map_number(candidate, row[col]);
+
+    canon_place_cols(ctx, candidate, row, best, pos+1, used_col_set | INDEX_TO_SET(col));
+
+    if (new_number) {
+      candidate->number_map[row[col]] = 0;
+      candidate->next_number--;
+    }
+  }
+}
+
+
+// Extend all candidates in src with one more row, keep the ones producing the smallest row in dest
+static
+void canon_next_row(struct canon_context *ctx, struct canon_list *src, struct canon_list *dest, unsigned int row)
+{
+  struct canon_candidate *candidate, next;
+  unsigned int i, band, source_row, source_row_set, row_set, col, most_zeros;
+  const unsigned char *source, *count, *leading_zeros;
+  unsigned char numbers[9], *best;
+  int cmp;
+
+  best = &ctx->best[row*9];
+  dest->count = 0;
+  ctx->list = dest;
+
+  for (i=0; i<src->count; i++) {
+    candidate = &src->candidates[i];
+    source = ctx->source[candidate->transposed];
+    count = ctx->count[candidate->transposed];
+    leading_zeros = ctx->leading_zeros[candidate->transposed];
+
+    if ((row % 3) == 0) {
+      // Start of a new band - any row in an unused band
+      source_row_set = 0;
+      for (band=0; band<3; band++) {
+        if ((candidate->used_row_set & (0x7 << (3*band))) == 0)
+          source_row_set |= (0x7 << (3*band));
+      }
+    } else {
+      // Stay within the band of the previous row
+      source_row_set = (0x7 << (3*candidate->band)) & ~candidate->used_row_set;
+    }
+
+    if (!candidate->cols_decided) {
+      // With the cols still free the row's numbers come after as many empty cells as its stacks
+      // allow, and a row with more of them beats any row with fewer, so only those can come next
+      most_zeros = 0;
+      for (row_set=source_row_set; row_set; row_set &= (row_set - 1)) {
+        if (leading_zeros[__builtin_ctz(row_set)] > most_zeros)
+          most_zeros = leading_zeros[__builtin_ctz(row_set)];
+      }
+      for (row_set=source_row_set; row_set; row_set &= (row_set - 1)) {
+        if (leading_zeros[__builtin_ctz(row_set)] != most_zeros)
+          source_row_set &= ~INDEX_TO_SET(__builtin_ctz(row_set));
+      }
+    }
+
+    while (source_row_set) {
+      source_row = __builtin_ctz(source_row_set);
+      source_row_set &= (source_row_set - 1);
+
+      next = *candidate;
+      next.band = source_row / 3;
+      next.used_row_set |= INDEX_TO_SET(source_row);
+      next.row_map[row] = source_row;
+
+      if (!next.cols_decided && count[source_row]) {
+        // First row with numbers in it decides the col permutation
+        canon_place_cols(ctx, &next, &source[source_row*9], best, 0, 0);
+        continue;
+      }
+
+      for (col=0; col<9; col++)
+        numbers[col] = canon_map_number(&next, source[source_row*9 + next.col_map[col]]);
+
+      cmp = memcmp(numbers, best, 9);
+      if (cmp > 0)
+        continue;
+      if (cmp < 0) {
+        // New smallest row - drop the candidates found so far
+        memcpy(best, numbers, 9);
+        memset(&ctx->best[(row+1)*9], CANON_NO_NUMBER, (8-row)*9);
+        dest->count = 0;
+      }
+
+      canon_list_append(dest, &next);
+    }
+  }
+
+  canon_list_remove_duplicates(dest);
+}
+
+
+// Empty stacks first, then the stack with the most empty cells with those cells first
+static
+unsigned int canon_leading_zeros(const unsigned char *row)
+{
+  unsigned int stack, zeros, leading, most;
+
+  leading = 0;
+  most = 0;
+  for (stack=0; stack<3; stack++) {
+    zeros = (row[3*stack] == 0) + (row[3*stack + 1] == 0) + (row[3*stack + 2] == 0);
+    if (zeros == 3)
+      leading += 3;
+    else if (zeros > most)
+      most = zeros;
+  }
+  return leading + most;
+}
+
+
+static
+void complete_number_map(unsigned char number_map[10], unsigned int next_number)
+{
+  unsigned int number;
+
+  // Numbers not in the grid get the remaining labels in increasing order
+  number_map[0] = 0;
+  for (number=1; number<=9; number++) {
+    if (number_map[number] == 0)
+      number_map[number] = next_number++;
+  }
+  assert(next_number == 10);
+}
+
+
+void canonicalize_grid(const unsigned char grid[81], unsigned char canon_grid[81], struct sudoku_transform *transform)
+{
+  struct canon_context ctx;
+  struct canon_candidate candidate;
+  struct canon_list *src, *dest, *tmp;
+  unsigned int transposed, row, col;
+
+  for (row=0; row<9; row++) {
+    ctx.count[0][row] = 0;
+    ctx.count[1][row] = 0;
+  }
+  for (row=0; row<9; row++) {
+    for (col=0; col<9; col++) {
+      assert(grid[row*9 + col] <= 9);
+      ctx.source[0][row*9 + col] = grid[row*9 + col];
+      ctx.source[1][row*9 + col] = grid[col*9 + row];
+      ctx.count[0][row] += (grid[row*9 + col] != 0);
+      ctx.count[1][col] += (grid[row*9 + col] != 0);
+    }
+  }
+  for (row=0; row<9; row++) {
+    ctx.leading_zeros[0][row] = canon_leading_zeros(&ctx.source[0][row*9]);
+    ctx.leading_zeros[1][row] = canon_leading_zeros(&ctx.source[1][row*9]);
+  }
+  memset(ctx.best, CANON_NO_NUMBER, sizeof(ctx.best));
+
+  // Start with the cols free, they get decided by the first row with numbers in it
+  src = &canon_lists[0];
+  dest = &canon_lists[1];
+  src->count = 0;
+  for (transposed=0; transposed<2; transposed++) {
+    memset(&candidate, 0, sizeof(candidate));
+    candidate.transposed = transposed;
+    candidate.next_number = 1;
+    for (col=0; col<9; col++)
+      candidate.col_map[col] = col;
+    canon_list_append(src, &candidate);
+  }
+
+  for (row=0; row<9; row++) {
+    canon_next_row(&ctx, src, dest, row);
+    tmp = src;
+    src = dest;
+    dest = tmp;
+  }
+
+  assert(src->count > 0);
+  memcpy(canon_grid, ctx.best, 81);
+
+  if (transform) {
+    candidate = src->candidates[0];
+    transform->transposed = candidate.transposed;
+    memcpy(transform->row_map, candidate.row_map, sizeof(transform->row_map));
+    memcpy(transform->col_map, candidate.col_map, sizeof(transform->col_map));
+    memcpy(transform->number_map, candidate.number_map, sizeof(transform->number_map));
+    complete_number_map(transform->number_map, candidate.next_number);
+  }
+}
+
+
+void canonicalize_board(struct sudoku_board *board, unsigned char canon_grid[81], struct sudoku_transform *transform)
+{
+  unsigned char grid[81];
+
+  board_to_grid(board, grid);
+  canonicalize_grid(grid, canon_grid, transform);
+}
+
+
+void transform_grid(const struct sudoku_transform *transform, const unsigned char grid[81], unsigned char result_grid[81])
+{
+  unsigned int row, col, source_index;
+
+  for (row=0; row<9; row++) {
+    for (col=0; col<9; col++) {
+      if (transform->transposed)
+        source_index = transform->col_map[col]*9 + transform->row_map[row];
+      else
+        source_index = transform->row_map[row]*9 + transform->col_map[col];
+      result_grid[row*9 + col] = transform->number_map[grid[source_index]];
+    }
+  }
+}
+
+
+void untransform_grid(const struct sudoku_transform *transform, const unsigned char canon_grid[81], unsigned char grid[81])
+{
+  unsigned char inverse_number_map[10];
+  unsigned int row, col, number, source_index;
+
+  for (number=0; number<=9; number++)
+    inverse_number_map[transform->number_map[number]] = number;
+
+  for (row=0; row<9; row++) {
+    for (col=0; col<9; col++) {
+      if (transform->transposed)
+        source_index = transform->col_map[col]*9 + transform->row_map[row];
+      else
+        source_index = transform->row_map[row]*9 + transform->col_map[col];
+      grid[source_index] = inverse_number_map[canon_grid[row*9 + col]];
+    }
+  }
+}
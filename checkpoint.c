@@ -0,0 +1,130 @@
+//
+// sudoku - A SuDoKu solver
+//
+// Copyright (c) 2018  Linde Labs, LLC
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "sudoku.h"
+
+
+// === Batch run checkpoints ===
+//
+// A checkpoint is a small text file with one "name value" pair per line. It is written to a
+// temporary file, synced and renamed over the old one, so a run killed at any point leaves
+// either the old checkpoint or the new one behind, never a partial one.
+
+
+// Defines
+
+#define CHECKPOINT_HEADER "sudoku checkpoint 1"
+
+
+// Functions
+
+int read_checkpoint(const char *file_name, struct sudoku_checkpoint *checkpoint)
+{
+  FILE *f;
+  char line[128], name[64];
+  unsigned long value;
+  int count;
+
+  f = fopen(file_name, "r");
+  if (!f)
+    return -1;
+
+  if (!fgets(line, sizeof(line), f) || (strncmp(line, CHECKPOINT_HEADER "\n", sizeof(line)) != 0)) {
+    fclose(f);
+    return -1;
+  }
+
+  memset(checkpoint, 0, sizeof(*checkpoint));
+  count = 0;
+  while (fgets(line, sizeof(line), f)) {
+    if (sscanf(line, "%63s %lu", name, &value) != 2)
+      continue;
+    count++;
+    if (strcmp(name, "input_size") == 0)
+      checkpoint->input_size = value;
+    else if (strcmp(name, "input_position") == 0)
+      checkpoint->input_position = value;
+    else if (strcmp(name, "output_offset") == 0)
+      checkpoint->output_offset = value;
+    else if (strcmp(name, "shard") == 0)
+      checkpoint->shard = value;
+    else if (strcmp(name, "shard_count") == 0)
+      checkpoint->shard_count = value;
+    else if (strcmp(name, "total_solved") == 0)
+      checkpoint->total_solved = value;
+    else if (strcmp(name, "total_unsolved") == 0)
+      checkpoint->total_unsolved = value;
+    else if (strcmp(name, "total_canonicalized") == 0)
+      checkpoint->total_canonicalized = value;
+    else if (strcmp(name, "total_copied") == 0)
+      checkpoint->total_copied = value;
+    else
+      count--;
+  }
+  fclose(f);
+
+  // All or nothing
+  return ((count == 9) ? 0 : -1);
+}
+
+
+int write_checkpoint(const char *file_name, const struct sudoku_checkpoint *checkpoint)
+{
+  FILE *f;
+  char *tmp_file_name;
+  int status;
+
+  tmp_file_name = (char*) malloc(strlen(file_name) + 16);
+  if (!tmp_file_name)
+    return -1;
+  sprintf(tmp_file_name, "%s.%i.tmp", file_name, (int)getpid());
+
+  f = fopen(tmp_file_name, "w");
+  if (!f) {
+    free(tmp_file_name);
+    return -1;
+  }
+
+  fprintf(f, CHECKPOINT_HEADER "\n");
+  fprintf(f, "input_size %lu\n", checkpoint->input_size);
+  fprintf(f, "input_position %lu\n", checkpoint->input_position);
+  fprintf(f, "output_offset %lu\n", checkpoint->output_offset);
+  fprintf(f, "shard %lu\n", checkpoint->shard);
+  fprintf(f, "shard_count %lu\n", checkpoint->shard_count);
+  fprintf(f, "total_solved %lu\n", checkpoint->total_solved);
+  fprintf(f, "total_unsolved %lu\n", checkpoint->total_unsolved);
+  fprintf(f, "total_canonicalized %lu\n", checkpoint->total_canonicalized);
+  fprintf(f, "total_copied %lu\n", checkpoint->total_copied);
+
+  status = 0;
+  if ((fflush(f) != 0) || (fsync(fileno(f)) != 0))
+    status = -1;
+  if (fclose(f) != 0)
+    status = -1;
+  if ((status == 0) && (rename(tmp_file_name, file_name) != 0))
+    status = -1;
+  if (status != 0)
+    unlink(tmp_file_name);
+  free(tmp_file_name);
+
+  return status;
+}
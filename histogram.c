@@ -0,0 +1,186 @@
+//
+// sudoku - A SuDoKu solver
+//
+// Copyright (c) 2018  Linde Labs, LLC
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>
+
+#include <stdio.h>
+#include <string.h>
+#include "sudoku.h"
+
+
+// === Log-linear latency histograms ===
+//
+// Like HdrHistogram: values below 2^HISTOGRAM_SUB_BUCKET_BITS have a bucket each, above that
+// every power of two is split into 2^(HISTOGRAM_SUB_BUCKET_BITS-1) equal buckets. A value is
+// off by less than 1/2^(HISTOGRAM_SUB_BUCKET_BITS-1) of itself, whatever its size. Recording
+// is a few shifts and an add, so each thread keeps its own histograms and they're added up
+// when the results are printed.
+
+
+// Defines
+
+#define HISTOGRAM_HALF_SUB_BUCKET_COUNT (1UL << (HISTOGRAM_SUB_BUCKET_BITS - 1))
+#define HISTOGRAM_MAX_VALUE ((1UL << HISTOGRAM_MAX_BITS) - 1)
+
+
+// Functions
+
+static inline
+unsigned int get_histogram_index(unsigned long value)
+{
+  unsigned int shift;
+
+  if (value > HISTOGRAM_MAX_VALUE)
+    value = HISTOGRAM_MAX_VALUE;
+  if (value < (1UL << HISTOGRAM_SUB_BUCKET_BITS))
+    return value;
+
+  // Shift the value down to HISTOGRAM_SUB_BUCKET_BITS-1 bits below its top bit
+  shift = (63 - __builtin_clzl(value)) - (HISTOGRAM_SUB_BUCKET_BITS - 1);
+  return (shift + 1) * HISTOGRAM_HALF_SUB_BUCKET_COUNT + ((value >> shift) - HISTOGRAM_HALF_SUB_BUCKET_COUNT);
+}
+
+
+static inline
+unsigned long get_histogram_bucket_low(unsigned int index)
+{
+  unsigned int shift;
+
+  if (index < (1UL << HISTOGRAM_SUB_BUCKET_BITS))
+    return index;
+
+  shift = index / HISTOGRAM_HALF_SUB_BUCKET_COUNT - 1;
+  return (HISTOGRAM_HALF_SUB_BUCKET_COUNT + index % HISTOGRAM_HALF_SUB_BUCKET_COUNT) << shift;
+}
+
+
+static inline
+unsigned long get_histogram_bucket_high(unsigned int index)
+{
+  if (index == HISTOGRAM_BUCKET_COUNT - 1)
+    return HISTOGRAM_MAX_VALUE;
+  return get_histogram_bucket_low(index + 1) - 1;
+}
+
+
+void record_histogram(struct sudoku_histogram *histogram, unsigned long value)
+{
+  histogram->buckets[get_histogram_index(value)]++;
+  histogram->count++;
+  if (value > histogram->max)
+    histogram->max = value;
+}
+
+
+void add_histogram(struct sudoku_histogram *total, const struct sudoku_histogram *histogram)
+{
+  int i;
+
+  for (i=0; i<HISTOGRAM_BUCKET_COUNT; i++)
+    total->buckets[i] += histogram->buckets[i];
+  total->count += histogram->count;
+  if (histogram->max > total->max)
+    total->max = histogram->max;
+}
+
+
+// The highest value in the bucket that holds the percentile, but never more than the max
+unsigned long get_histogram_percentile(const struct sudoku_histogram *histogram, double percentile)
+{
+  unsigned long rank, count;
+  unsigned long value;
+  int i;
+
+  if (histogram->count == 0)
+    return 0;
+
+  rank = (unsigned long)(percentile / 100.0 * histogram->count + 0.5);
+  if (rank < 1)
+    rank = 1;
+
+  count = 0;
+  for (i=0; i<HISTOGRAM_BUCKET_COUNT; i++) {
+    count += histogram->buckets[i];
+    if (count >= rank)
+      break;
+  }
+
+  value = get_histogram_bucket_high(i);
+  return ((value < histogram->max) ? value : histogram->max);
+}
+
+
+static
+void print_latency_line(const char *name, const struct sudoku_histogram *histogram)
+{
+  printf("%-10s %10lu %10.1f %10.1f %10.1f %10.1f %10.1f\n", name, histogram->count,
+         get_histogram_percentile(histogram, 50.0) / 1000.0, get_histogram_percentile(histogram, 90.0) / 1000.0,
+         get_histogram_percentile(histogram, 99.0) / 1000.0, get_histogram_percentile(histogram, 99.9) / 1000.0,
+         histogram->max / 1000.0);
+}
+
+
+static
+void print_histogram_buckets(const char *name, const struct sudoku_histogram *histogram)
+{
+  unsigned long count;
+  int i;
+
+  printf("%s buckets (ns):\n", name);
+  count = 0;
+  for (i=0; i<HISTOGRAM_BUCKET_COUNT; i++) {
+    if (histogram->buckets[i] == 0)
+      continue;
+    count += histogram->buckets[i];
+    printf("%14lu - %-14lu %10lu %9.4f%%\n", get_histogram_bucket_low(i), get_histogram_bucket_high(i),
+           histogram->buckets[i], 100.0 * count / histogram->count);
+  }
+}
+
+
+// Prints percentiles in us of all puzzles and of each outcome, with print_buckets also every
+// bucket in use with the percentage of puzzles up to it
+void print_latency(const struct sudoku_histogram histograms[OUTCOME_COUNT], int print_buckets)
+{
+  static const char *outcome_names[OUTCOME_COUNT] = { "solved", "unsolved", "multiple" };
+  struct sudoku_histogram total;
+  int i;
+
+  memset(&total, 0, sizeof(total));
+  for (i=0; i<OUTCOME_COUNT; i++)
+    add_histogram(&total, &histograms[i]);
+
+  printf("%-10s %10s %10s %10s %10s %10s %10s\n", "Latency us", "Puzzles", "p50", "p90", "p99", "p99.9", "max");
+  print_latency_line("all", &total);
+  for (i=0; i<OUTCOME_COUNT; i++) {
+    if (histograms[i].count)
+      print_latency_line(outcome_names[i], &histograms[i]);
+  }
+
+  if (print_buckets) {
+    for (i=0; i<OUTCOME_COUNT; i++) {
+      if (histograms[i].count)
+        print_histogram_buckets(outcome_names[i], &histograms[i]);
+    }
+  }
+}
+
+
+enum sudoku_outcome get_outcome(int solutions_count)
+{
+  if (solutions_count == 0)
+    return OUTCOME_UNSOLVED;
+  return ((solutions_count == 1) ? OUTCOME_SOLVED : OUTCOME_MULTIPLE);
+}
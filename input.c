@@ -0,0 +1,260 @@
+//
+// sudoku - A SuDoKu solver
+//
+// Copyright (c) 2018  Linde Labs, LLC
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "sudoku.h"
+
+
+// === Memory-mapped puzzle input ===
+//
+// Regular files are mapped read only and lines are handed out as pointers into the mapping, so
+// nothing is copied on the way to read_board_length(). Anything that can't be mapped (pipes,
+// devices) is streamed through one fixed-size buffer instead, refilled from the fd as the lines
+// are used up. A streamed line only stays put until the next one is asked for.
+
+
+// Defines
+
+#define INPUT_READ_CHUNK  (1 << 20) // Streaming buffer, longer lines are cut short
+
+
+// Functions
+
+// Moves what is left to the front of the buffer and reads after it, until the buffer is full or
+// the input ends - or a newline comes in, unless until_full. Returns -1 on a read error.
+static
+int fill_input_stream(struct sudoku_input *input, int until_full)
+{
+  ssize_t bytes_read;
+  int status;
+
+  memmove(input->data, input->data + input->offset, input->size - input->offset);
+  input->size -= input->offset;
+  input->offset = 0;
+
+  status = 0;
+  while ((input->fd >= 0) && (input->size < INPUT_READ_CHUNK)) {
+    bytes_read = read(input->fd, input->data + input->size, INPUT_READ_CHUNK - input->size);
+    if ((bytes_read < 0) && (errno == EINTR))
+      continue;
+    if (bytes_read <= 0) {
+      // The end, one way or the other
+      if (bytes_read < 0) {
+        input->error = 1;
+        status = -1;
+      }
+      close(input->fd);
+      input->fd = -1;
+      break;
+    }
+    input->size += bytes_read;
+    if (!until_full && memchr(input->data + input->size - bytes_read, '\n', bytes_read))
+      break;
+  }
+
+  input->end = input->size;
+  return status;
+}
+
+
+struct sudoku_input* open_input(const char *file_name)
+{
+  struct sudoku_input *input;
+  struct stat st;
+  void *map;
+  int fd, regular;
+
+  fd = open(file_name, O_RDONLY);
+  if (fd < 0)
+    return NULL;
+
+  input = (struct sudoku_input*) malloc(sizeof(struct sudoku_input));
+  if (!input) {
+    close(fd);
+    return NULL;
+  }
+  input->data = NULL;
+  input->size = 0;
+  input->offset = 0;
+  input->end = 0;
+  input->mapped = 0;
+  input->streamed = 0;
+  input->fd = -1;
+  input->error = 0;
+  input->cut = 0;
+
+  map = MAP_FAILED;
+  regular = ((fstat(fd, &st) == 0) && S_ISREG(st.st_mode));
+  if (regular && (st.st_size > 0))
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+  if (map != MAP_FAILED) {
+    // Read once front to back - let the kernel read ahead and drop pages behind us
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    input->data = (char*) map;
+    input->size = st.st_size;
+    input->mapped = 1;
+  } else if (!regular || (st.st_size > 0)) {
+    // The first chunk is read right away, so the start of the input can be looked at
+    input->data = (char*) malloc(INPUT_READ_CHUNK);
+    input->streamed = 1;
+    input->fd = fd;
+    if (!input->data || (fill_input_stream(input, 1) != 0)) {
+      close_input(&input);
+      return NULL;
+    }
+    return input;
+  }
+
+  close(fd); // The mapping stays valid
+  input->end = input->size;
+  return input;
+}
+
+
+void close_input(struct sudoku_input **input)
+{
+  if (*input) {
+    if ((*input)->mapped)
+      munmap((*input)->data, (*input)->size);
+    else
+      free((*input)->data);
+    if ((*input)->fd >= 0)
+      close((*input)->fd);
+    free(*input);
+    *input = NULL;
+  }
+}
+
+
+// Returns the start of the first line starting at or after position
+static
+size_t align_to_line(struct sudoku_input *input, size_t position)
+{
+  const char *end;
+
+  if ((position == 0) || (position >= input->size))
+    return position;
+  if (input->data[position - 1] == '\n')
+    return position;
+
+  end = (const char*) memchr(input->data + position, '\n', input->size - position);
+  return (end ? (end - input->data) + 1 : input->size);
+}
+
+
+// Limits the input to the lines starting in the shard's share of the bytes. Every line lands in
+// exactly one of the shard_count shards, and the shards in order cover the input in order.
+void shard_input(struct sudoku_input *input, unsigned long shard, unsigned long shard_count)
+{
+  assert((shard < shard_count) && !input->streamed);
+
+  input->offset = align_to_line(input, input->size / shard_count * shard);
+  input->end = ((shard + 1 == shard_count) ? input->size : align_to_line(input, input->size / shard_count * (shard + 1)));
+}
+
+
+// Drops what is left of a streamed line that didn't fit in the buffer, up to its newline
+static
+void skip_cut_line(struct sudoku_input *input)
+{
+  const char *end;
+
+  for (;;) {
+    end = (const char*) memchr(input->data + input->offset, '\n', input->end - input->offset);
+    if (end) {
+      input->offset = (end - input->data) + 1;
+      break;
+    }
+    input->offset = input->end;
+    if (input->fd < 0)
+      break;
+    fill_input_stream(input, 0);
+  }
+  input->cut = 0;
+}
+
+
+// Returns the length of the next line including its newline (if any), 0 at the end of input
+size_t next_input_line(struct sudoku_input *input, const char **line)
+{
+  const char *start, *end;
+  size_t remaining;
+
+  if (input->cut)
+    skip_cut_line(input);
+
+  // memchr() scans a vector at a time
+  remaining = input->end - input->offset;
+  start = input->data + input->offset;
+  end = (remaining ? (const char*) memchr(start, '\n', remaining) : NULL);
+
+  // A streamed line may go on in what hasn't been read yet. If it fills the buffer, that much
+  // of it will have to do.
+  if (!end && (input->fd >= 0)) {
+    fill_input_stream(input, 0);
+    remaining = input->end - input->offset;
+    start = input->data + input->offset;
+    end = (remaining ? (const char*) memchr(start, '\n', remaining) : NULL);
+    input->cut = (!end && (input->fd >= 0));
+  }
+
+  if (remaining == 0)
+    return 0;
+  end = (end ? end + 1 : start + remaining);
+
+  input->offset += end - start;
+  *line = start;
+
+  return end - start;
+}
+
+
+// Puts back the line just read, so the next call hands it out again
+void unread_input_line(struct sudoku_input *input, size_t length)
+{
+  assert(length <= input->offset);
+
+  input->offset -= length;
+  input->cut = 0; // Set again when a cut piece is handed out again
+}
+
+
+// Returns the length of the next run of input, 0 at the end. That's all the rest of a mapped
+// file, or what is in the buffer of a streamed one.
+size_t next_input_chunk(struct sudoku_input *input, const char **chunk)
+{
+  size_t length;
+
+  if ((input->offset == input->end) && (input->fd >= 0))
+    fill_input_stream(input, 1);
+
+  length = input->end - input->offset;
+  *chunk = input->data + input->offset;
+  input->offset = input->end;
+
+  return length;
+}
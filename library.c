@@ -0,0 +1,134 @@
+//
+// sudoku - A SuDoKu solver
+//
+// Copyright (c) 2018  Linde Labs, LLC
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "sudoku.h"
+
+
+// === Embeddable solver API ===
+//
+// A solver context only holds settings and is never changed by solving, so one context can be
+// used from any number of threads at the same time. Boards come from the calling thread's pool,
+// which is freed when the thread exits, and nothing is printed, results only go to the caller's
+// buffers. Include libsudoku.h to use it, the rest of libsudoku.so is hidden.
+
+
+// Struct & types
+
+struct sudoku_solver {
+  int guessing_allowed;
+  unsigned int chain_max_length;
+  unsigned int probe_budget;
+};
+
+
+// Functions
+
+struct sudoku_solver* create_solver(const struct sudoku_solver_config *config)
+{
+  struct sudoku_solver *solver;
+
+  init(); // Only does anything the first time
+
+  solver = (struct sudoku_solver*) malloc(sizeof(struct sudoku_solver));
+  if (!solver)
+    return NULL;
+
+  if (config) {
+    solver->guessing_allowed = config->guessing_allowed;
+    solver->chain_max_length = config->chain_max_length;
+    solver->probe_budget = config->probe_budget;
+  } else {
+    solver->guessing_allowed = GUESSING_ALLOWED_DEFAULT;
+    solver->chain_max_length = CHAIN_MAX_LENGTH_DEFAULT;
+    solver->probe_budget = PROBE_BUDGET_DEFAULT;
+  }
+
+  return solver;
+}
+
+
+void destroy_solver(struct sudoku_solver **solver)
+{
+  if (*solver) {
+    free(*solver);
+    *solver = NULL;
+  }
+}
+
+
+// Solves 81 chars of [0-9.] into 81 chars of solution (the board as far as it got if not solved)
+int solve_one(struct sudoku_solver *solver, const char puzzle[81], char solution[81])
+{
+  struct sudoku_board *board;
+  char line[BOARD_LINE_SIZE];
+  int i, status;
+
+  for (i=0; i<81; i++) {
+    if ((puzzle[i] != '.') && ((puzzle[i] < '0') || (puzzle[i] > '9'))) {
+      memset(solution, '0', 81);
+      return SOLVE_STATUS_INVALID;
+    }
+  }
+
+  board = create_board();
+  if (!board) {
+    memset(solution, '0', 81);
+    return SOLVE_STATUS_INVALID;
+  }
+
+  if (read_board_length(board, puzzle, 81) != 0) {
+    destroy_board(&board);
+    memcpy(solution, puzzle, 81);
+    return SOLVE_STATUS_INVALID;
+  }
+
+  board->guessing_allowed = solver->guessing_allowed;
+  board->chain_max_length = solver->chain_max_length;
+  board->probe_budget = solver->probe_budget;
+
+  status = (solve(board) ? SOLVE_STATUS_SOLVED : SOLVE_STATUS_UNSOLVED);
+
+  format_board_line(board, line);
+  memcpy(solution, line, 81);
+  destroy_board(&board);
+
+  return status;
+}
+
+
+// Solves count puzzles of 81 chars each, back to back, into count solutions of 81 chars each.
+// statuses (if not NULL) gets the status of each. Returns the number of puzzles solved.
+size_t solve_many(struct sudoku_solver *solver, const char *puzzles, size_t count, char *solutions, int *statuses)
+{
+  size_t i, solved;
+  int status;
+
+  solved = 0;
+  for (i=0; i<count; i++) {
+    status = solve_one(solver, puzzles + i*81, solutions + i*81);
+    if (statuses)
+      statuses[i] = status;
+    solved += (status == SOLVE_STATUS_SOLVED);
+  }
+
+  return solved;
+}
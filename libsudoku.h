@@ -0,0 +1,48 @@
+//
+// sudoku - A SuDoKu solver
+//
+// Copyright (c) 2018  Linde Labs, LLC
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>
+
+#ifndef __LIBSUDOKU_H__
+#define __LIBSUDOKU_H__
+
+// The public API of libsudoku, the only symbols libsudoku.so exports.
+// Puzzles and solutions are 81 chars, row by row, empty cells as '0' or '.'.
+
+#include <stddef.h>
+
+#define SUDOKU_API __attribute__((visibility("default")))
+
+#define SOLVE_STATUS_SOLVED    1 // solve_one() results
+#define SOLVE_STATUS_UNSOLVED  0
+#define SOLVE_STATUS_INVALID  -1
+
+struct sudoku_solver; // Opaque
+
+struct sudoku_solver_config {
+  int guessing_allowed;
+  unsigned int chain_max_length;
+  unsigned int probe_budget;
+};
+
+SUDOKU_API struct sudoku_solver* create_solver(const struct sudoku_solver_config *config);
+
+SUDOKU_API void destroy_solver(struct sudoku_solver **solver);
+
+SUDOKU_API int solve_one(struct sudoku_solver *solver, const char puzzle[81], char solution[81]);
+
+SUDOKU_API size_t solve_many(struct sudoku_solver *solver, const char *puzzles, size_t count, char *solutions, int *statuses);
+
+#endif
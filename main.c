@@ -17,237 +17,1400 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 #include <unistd.h>
+#include <getopt.h>
 #include <errno.h>
+#include <pthread.h>
+#include <time.h>
 #include "sudoku.h"
 
 
 #define BUFFER_SIZE 10000
+#define BATCH_JOB_COUNT 256 // Puzzles in a batch
+#define BATCH_COUNT(thread_count) (4*(thread_count) + 4) // Batches in a pipeline
+#define BATCH_TEXT_SIZE JSON_INPUT_MAX_LENGTH // Room in a batch for copies of streamed input lines
+#define THREAD_COUNT_MAX 1024
+#define JSON_RECORD_SIZE 1024 // Longest JSON line of one puzzle, besides its input line
+#define JSON_CHAR_SIZE      6 // Longest JSON escape of one input char
+#define JSON_INPUT_MAX_LENGTH (64*1024) // Longer input lines are cut short in JSON output
+#define CHECKPOINT_INTERVAL 10 // Seconds between checkpoints with --resume
+
+// Long options without a short one
+#define OPTION_SHARD 256
+#define OPTION_MERGE 257
+#define OPTION_RESUME 258
+#define OPTION_BENCH 259
+#define OPTION_RUNS 260
+#define OPTION_STATS 261
+#define OPTION_TRACE 262
+#define OPTION_LATENCY 263
 
 
 struct options {
   int verbose_level;
   int quiet_mode;
   int guessing_allowed;
+  long chain_max_length;
+  long probe_budget;
   int pretty_print; 
   int print_latex;
   int print_help;
   int run_builtin_test;
+  int canonical_form;
+  long cache_size; // kB, 0 = no cache
+  char *store_file_name;
   char *input_file_name;
   char *output_file_name;
+  long thread_count;
+  int unordered_output;
+  int binary_output;
+  int json_output;
+  int copy_only;
+  int stream_stdin;
+  char *socket_path;
+  long port;
+  unsigned long shard;       // Which part of the input to solve, 0 .. shard_count-1
+  unsigned long shard_count; // 0 = not sharded
+  int merge_files;
+  int resume;
+  int bench_mode;
+  long bench_run_count;
+  int print_stats;
+  int count_cycles;
+  int count_perf;
+  char *trace_file_name;
+  int latency;               // 1 = latency percentiles, 2 = and the histogram buckets
 };
 
 
 static
 int run_from_file(const char *file_name, struct options *options)
 {
-  FILE *f;
-  long fsize;
+  struct sudoku_input *input;
   struct sudoku_board *board;
-  char *input_str;
   int solutions_count;
 
-  f = fopen(file_name, "rb");
-  if (!f) {
+  input = open_input(file_name);
+  if (!input) {
     fprintf(stderr, "Cound not open file: %s\n", file_name);
     return -1;
   }
 
-  fseek(f, 0, SEEK_END);
-  fsize = ftell(f);
-  fseek(f, 0, SEEK_SET);
-  input_str = (char*)malloc(fsize + 1);
-  fread(input_str, fsize, 1, f);
-  fclose(f);
+  board = create_board();
+  board->debug_level = options->verbose_level;
+  board->guessing_allowed = options->guessing_allowed;
+  board->chain_max_length = options->chain_max_length;
+  board->probe_budget = options->probe_budget;
+  read_board_length(board, input->data, input->size);
+
+  if (options->verbose_level) {
+    printf("-------- Input --------\n");
+    print_board(board);
+    if (options->print_latex) 
+      print_board_latex(board);
+    printf("---Solve---\n");
+    if (!options->guessing_allowed) 
+      printf("Guessing not allowed\n");
+  }
+
+  solutions_count = solve(board);
+  
+  if (options->verbose_level) {
+    if (!options->guessing_allowed) 
+      printf("Guessing not allowed\n");
+    if (solutions_count)
+      printf("Found %i solution(s)\n", solutions_count);
+    else
+      printf("No solution found\n");
+    printf("-------- Output -------\n");
+    print_solutions(board);
+    printf("\n");    
+  }
+
+  if (options->pretty_print) 
+    print_board(board);
+  else if (options->print_latex) 
+    print_board_latex(board);
+  else
+    print_board_simple(board);
+
+  destroy_board(&board);
+  close_input(&input);
+
+  return 0;
+}
+
+
+static
+int solve_stream_puzzle(const char cells[81], struct options *options)
+{
+  struct sudoku_board *board;
+  int solutions_count;
+
+  board = create_board();
+  read_board_length(board, cells, 81);
+
+  board->debug_level = options->verbose_level;
+  board->guessing_allowed = options->guessing_allowed;
+  board->chain_max_length = options->chain_max_length;
+  board->probe_budget = options->probe_budget;
+  if (options->verbose_level) {
+    printf("-------- Input --------\n");
+    print_board(board);
+    printf("---Solve---\n");
+  }
+
+  solutions_count = solve(board);
+
+  if (options->verbose_level) {
+    printf("-------- Output -------\n");
+    print_solutions(board);
+    printf("\n");     
+  }
+
+  if (options->pretty_print) {
+    print_board(board);
+    printf("\n");
+  } else if (options->print_latex) {
+    print_board_latex(board);
+    printf("\n");
+  } else {
+    print_board_line(stdout, board);
+  }
+
+  // Whoever reads our output gets each solution as soon as it's there
+  fflush(stdout);
+
+  destroy_board(&board);
+
+  return solutions_count;
+}
+
+
+// Every 81 cells on stdin make a puzzle - one per line or spread over several lines.
+// Only the current line and puzzle are kept, so any amount of input can be piped through.
+static
+int run_stdio_stream(struct options *options)
+{
+  char *line, cells[81], ch;
+  size_t line_size;
+  ssize_t chars_read, i;
+  int cell_count, total_solved, total_unsolved;
+
+  line = NULL;
+  line_size = 0;
+  cell_count = 0;
+  total_solved = 0;
+  total_unsolved = 0;
+
+  while ((chars_read = getline(&line, &line_size, stdin)) != -1) {
+    if ((line[0] == '#') || (line[0] == ';') || (line[0] == '!'))
+      continue;
+
+    for (i=0; i<chars_read; i++) {
+      ch = line[i];
+      if ((ch == '.') || (ch == '?') || ((ch >= '0') && (ch <= '9'))) {
+        cells[cell_count++] = ch;
+        if (cell_count == 81) {
+          if (solve_stream_puzzle(cells, options))
+            total_solved++;
+          else
+            total_unsolved++;
+          cell_count = 0;
+          break; // The rest of the line doesn't start a new puzzle
+        }
+      }
+    }
+  }
+  free(line);
+
+  // stdout is for solutions only
+  if (!options->quiet_mode)
+    fprintf(stderr, "Number of solved: %i  Number of unsolved: %i\n", total_solved, total_unsolved);
+
+  return 0;
+}
+
+
+static
+int run_stdio(struct options *options)
+{
+  struct sudoku_board *board;
+  char *buffer, *line;
+  size_t line_size, buffer_size, buffer_bytes;
+  ssize_t chars_read;
+  int solutions_count;
+
+  buffer_size = BUFFER_SIZE;
+  buffer = (char*)malloc(buffer_size);
+  buffer_bytes = 0;
+
+  line = NULL;
+  line_size = 0;
+
+  while ((chars_read = getline(&line, &line_size, stdin)) != -1) {
+    if ((chars_read) && (line[0] != '#') && (line[0] != ';') && (line[0] != '!')) {
+      if (buffer_bytes + chars_read >= buffer_size) {
+        while (buffer_bytes + chars_read >= buffer_size)
+          buffer_size *= 2;
+        buffer = (char*)realloc(buffer, buffer_size);
+      }
+      memcpy(buffer + buffer_bytes, line, chars_read);
+      buffer_bytes += chars_read;
+    }
+  }
+  buffer[buffer_bytes] = 0;
+  free(line);
+
+  board = create_board();
+  read_board(board, buffer);
+
+  board->debug_level = options->verbose_level;
+  board->guessing_allowed = options->guessing_allowed;
+  board->chain_max_length = options->chain_max_length;
+  board->probe_budget = options->probe_budget;
+  if (options->verbose_level) {
+    printf("-------- Input --------\n");
+    print_board(board);
+    if (options->print_latex) 
+      print_board_latex(board);
+  }
+
+  solutions_count = solve(board);
+
+  if (options->verbose_level) {
+    printf("-------- Output -------\n");
+    print_solutions(board);
+    printf("\n");     
+  }
+
+  if (options->pretty_print) 
+    print_board(board);
+  else if (options->print_latex) 
+    print_board_latex(board);
+  else
+    print_board_simple(board);
+  
+  destroy_board(&board);
+  free(buffer);
+
+  return solutions_count;
+}
+
+
+struct batch_job {
+  const char *line;        // Points into the input, not null terminated, NULL for binary input
+  size_t line_length;
+  unsigned char puzzle[81];
+  unsigned char grid[81];  // Solved (or canonical) board
+  int solutions_count;
+  int has_solution;        // Binary input record came with a solution in grid
+  int invalid;             // The puzzle has clashing numbers
+  struct sudoku_binary_stats stats;
+  struct sudoku_stats solve_stats; // Only with -J or --stats
+  unsigned long wall_ns;
+  int dead;
+};
+
+struct batch {
+  unsigned long sequence;  // Order in the input
+  unsigned long input_end; // Input position after the batch, for checkpoints
+  int job_count;           // 0 = end of input
+  struct batch_job jobs[BATCH_JOB_COUNT];
+  char text[BATCH_TEXT_SIZE]; // The lines of the jobs, when the input is streamed
+};
+
+struct batch_context {
+  struct options *options;
+  struct sudoku_input *input;
+  struct sudoku_binary *binary_input;
+  struct sudoku_binary *binary_output;
+  struct sudoku_output *output;     // Text and JSON output
+  struct sudoku_cache *cache;
+  struct sudoku_store *store;
+  pthread_mutex_t lock;    // Guards cache and store when running on several threads
+  unsigned long next_record;        // Next record of binary input
+  unsigned long end_record;         // End of this shard's binary records
+  int batch_count;
+  struct batch **pending;           // Solved batches waiting for earlier ones, by sequence
+  struct sudoku_ring *free_ring;    // Writer -> reader
+  struct sudoku_ring *read_ring;    // Reader -> solvers
+  struct sudoku_ring *solved_ring;  // Solvers -> writer
+  int total_solved;
+  int total_unsolved;
+  int total_canonicalized;
+  int total_copied;
+  int total_skipped;       // Lines that are not a whole puzzle, with -r
+  struct sudoku_stats run_stats;    // All the jobs written, with --stats
+  struct sudoku_search_histogram search_histogram;
+  struct sudoku_histogram latency[OUTCOME_COUNT]; // Solve times of the jobs written, with --latency
+  char *checkpoint_file_name;       // NULL = no checkpoints
+  unsigned long input_position;     // Input written out up to here
+  struct timespec checkpoint_time;
+};
+
+
+static inline
+int is_batch_line(const char *line, size_t chars_read)
+{
+  return (chars_read >= ((8*8)+1) && (line[0] != '#') && (line[0] != ';') && (line[0] != '!'));
+}
+
+
+static
+void batch_lock(struct batch_context *context)
+{
+  if (context->options->thread_count > 1)
+    pthread_mutex_lock(&context->lock);
+}
+
+
+static
+void batch_unlock(struct batch_context *context)
+{
+  if (context->options->thread_count > 1)
+    pthread_mutex_unlock(&context->lock);
+}
+
+
+// Solves (or canonicalizes) one puzzle line into job->grid and job->solutions_count
+static
+void solve_batch_job(struct batch_context *context, struct batch_job *job)
+{
+  struct options *options = context->options;
+  struct sudoku_board *board;
+  struct sudoku_transform transform;
+  unsigned char canon_grid[81], canon_solution[81];
+  unsigned int cached_solutions_count;
+  struct timespec start_time, end_time;
+  int i, solutions_count, cache_hit, store_hit;
+
+  if (options->copy_only) {
+    // Just pass the puzzle on - a binary record's solution if it has one
+    if (job->line)
+      memset(&job->stats, 0, sizeof(job->stats));
+    if (!job->has_solution)
+      memcpy(job->grid, job->puzzle, sizeof(job->grid));
+    return;
+  }
+
+  if (options->json_output || options->print_stats) {
+    memset(&job->solve_stats, 0, sizeof(job->solve_stats));
+    job->solve_stats.count_cycles = options->count_cycles;
+    job->solve_stats.count_perf = options->count_perf;
+  }
+  if (options->json_output || options->latency)
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+
+  // Clashing numbers are dropped, the later ones in reading order
+  board = create_board();
+  read_board_grid(board, job->puzzle);
+
+  if (options->canonical_form) {
+    // Just the canonical form of the puzzle - no solving
+    canonicalize_board(board, job->grid, NULL);
+    job->solutions_count = 0;
+    destroy_board(&board);
+    return;
+  }
+
+  board->debug_level = options->verbose_level;
+  board->guessing_allowed = options->guessing_allowed;
+  board->chain_max_length = options->chain_max_length;
+  board->probe_budget = options->probe_budget;
+  // Latencies are by outcome, so a puzzle with a second solution has to be told from one without
+  if (options->latency)
+    board->solutions_max = 2;
+  if (options->json_output || options->print_stats)
+    board->stats = &job->solve_stats;
+  if (options->verbose_level) {
+    printf("-------- Input --------\n");
+    print_board(board);
+    if (options->print_latex) 
+      print_board_latex(board);
+    printf("--- Solve---\n");
+    if (!options->guessing_allowed) 
+      printf("Guessing not allowed\n");
+  }
+
+  // Symmetric variants of a puzzle share the same canonical form and cache entry
+  cache_hit = 0;
+  if (context->cache) {
+    canonicalize_board(board, canon_grid, &transform);
+    batch_lock(context);
+    cache_hit = cache_lookup(context->cache, canon_grid, board->guessing_allowed, canon_solution, &cached_solutions_count);
+    batch_unlock(context);
+    if (cache_hit) {
+      untransform_grid(&transform, canon_solution, job->grid);
+      read_board_grid(board, job->grid);
+      if (options->verbose_level)
+        printf("Found in cache\n");
+    }
+  }
+
+  // Puzzles solved in earlier runs are in the store, but their counts may stop at one solution
+  store_hit = 0;
+  if (context->store && !cache_hit && !options->latency) {
+    batch_lock(context);
+    store_hit = store_lookup(context->store, job->puzzle, board->guessing_allowed, job->grid, &cached_solutions_count);
+    batch_unlock(context);
+    if (store_hit) {
+      read_board_grid(board, job->grid);
+      if (options->verbose_level)
+        printf("Found in solution store\n");
+    }
+  }
+
+  if (cache_hit || store_hit)
+    solutions_count = cached_solutions_count;
+  else
+    solutions_count = solve(board);
+
+  if (options->json_output || options->latency) {
+    clock_gettime(CLOCK_MONOTONIC, &end_time);
+    job->wall_ns = (end_time.tv_sec - start_time.tv_sec) * 1000000000UL + end_time.tv_nsec - start_time.tv_nsec;
+  }
+
+  board_to_grid(board, job->grid);
+  job->solutions_count = solutions_count;
+  job->dead = board->dead;
+  job->stats.flags = ((board->undetermined_count == 0) ? BINARY_RECORD_SOLVED : 0) | ((cache_hit || store_hit) ? BINARY_RECORD_CACHED : 0);
+  job->stats.solutions_count = solutions_count;
+  job->stats.clue_count = 0;
+  for (i=0; i<81; i++)
+    job->stats.clue_count += (job->puzzle[i] != 0);
+  job->stats.reserved = 0;
+
+  // Only solved boards are kept - a partial board depends on the order the logic ran in
+  if (!cache_hit && (board->undetermined_count == 0)) {
+    if (context->cache)
+      transform_grid(&transform, job->grid, canon_solution);
+    batch_lock(context);
+    if (context->store && !store_hit && (store_insert(context->store, job->puzzle, board->guessing_allowed, job->grid, solutions_count) != 0) &&
+        (context->store->skipped == 1))
+      fprintf(stderr, "Cound not grow solution store, new solutions are not kept: %s\n", options->store_file_name);
+    if (context->cache)
+      cache_insert(context->cache, canon_grid, board->guessing_allowed, canon_solution, solutions_count);
+    batch_unlock(context);
+  }
+
+  if (options->verbose_level) {
+    if (!options->guessing_allowed) 
+      printf("Guessing not allowed\n");
+    if (solutions_count)
+      printf("Found %i solution(s)\n", solutions_count);
+    else
+      printf("No solution found\n"); 
+    printf("-------- Output -------\n");
+    print_solutions(board);
+    if (options->print_latex) 
+      print_board_latex(board);
+    printf("\n=====================\n\n");
+  }
+
+  destroy_board(&board);
+}
+
+
+// Length of the input line echoed in JSON, without its line end
+static inline
+size_t get_json_input_length(struct batch_job *job)
+{
+  size_t length = job->line_length;
+
+  while ((length > 0) && ((job->line[length-1] == '\n') || (job->line[length-1] == '\r')))
+    length--;
+
+  return ((length < JSON_INPUT_MAX_LENGTH) ? length : JSON_INPUT_MAX_LENGTH);
+}
+
+
+// Writes str as a quoted JSON string, returns its length
+static
+size_t format_json_string(const char *str, size_t length, char *buffer)
+{
+  size_t i, buffer_length;
+  unsigned char ch;
+
+  buffer_length = 0;
+  buffer[buffer_length++] = '"';
+  for (i=0; i<length; i++) {
+    ch = (unsigned char) str[i];
+    if ((ch == '"') || (ch == '\\')) {
+      buffer[buffer_length++] = '\\';
+      buffer[buffer_length++] = ch;
+    } else if (ch < 0x20) {
+      buffer_length += sprintf(buffer + buffer_length, "\\u%04x", ch);
+    } else {
+      buffer[buffer_length++] = ch;
+    }
+  }
+  buffer[buffer_length++] = '"';
+
+  return buffer_length;
+}
+
+
+// Space needed for the JSON record of a job
+static inline
+size_t get_json_record_size(struct batch_job *job)
+{
+  return JSON_RECORD_SIZE + (job->line ? JSON_CHAR_SIZE * get_json_input_length(job) : 0);
+}
+
+
+// One JSON object per line with the puzzle as it was in the input, its solution and how it was solved
+static
+size_t format_json_record(struct batch_context *context, struct batch_job *job, char *buffer)
+{
+  const char *status;
+  char puzzle_line[BOARD_LINE_SIZE], solution_line[BOARD_LINE_SIZE];
+  size_t length;
+  int i, solved;
+
+  // Clashing givens are dropped to solve the rest, but that's not a solution of the puzzle
+  solved = (!job->invalid && (job->stats.flags & BINARY_RECORD_SOLVED));
+  if (job->invalid)
+    status = "invalid";
+  else if (solved)
+    status = "solved";
+  else if (job->dead)
+    status = "dead";
+  else if (!context->options->guessing_allowed)
+    status = "guessing_not_allowed";
+  else
+    status = "unsolved";
+
+  format_grid_line(job->grid, solution_line);
+  solution_line[81] = '\0';
+
+  // Text lines are echoed without their line end, binary records have only the puzzle
+  length = sprintf(buffer, "{\"input\":");
+  if (job->line) {
+    length += format_json_string(job->line, get_json_input_length(job), buffer + length);
+  } else {
+    format_grid_line(job->puzzle, puzzle_line);
+    length += format_json_string(puzzle_line, 81, buffer + length);
+  }
+  length += sprintf(buffer + length, ",\"status\":\"%s\",\"solutions\":[", status);
+  if (solved)
+    length += sprintf(buffer + length, "\"%s\"", solution_line);
+  length += sprintf(buffer + length, "],\"solution_count\":%i,\"wall_ns\":%lu,\"guesses\":%lu,\"max_nest_level\":%u,\"placements\":{",
+                    (job->invalid ? 0 : job->solutions_count), job->wall_ns, job->solve_stats.guesses, job->solve_stats.max_nest_level);
+  for (i=0; i<STRATEGY_COUNT; i++)
+    length += sprintf(buffer + length, "%s\"%s\":%lu", (i ? "," : ""), get_strategy_name(i), job->solve_stats.placements[i]);
+  length += sprintf(buffer + length, "},\"nodes\":%lu,\"backtracks\":%lu,\"dead_ends\":{",
+                    job->solve_stats.nodes, job->solve_stats.backtracks);
+  for (i=0; i<STRATEGY_COUNT; i++)
+    length += sprintf(buffer + length, "%s\"%s\":%lu", (i ? "," : ""), get_strategy_name(i), job->solve_stats.dead_ends[i]);
+  length += sprintf(buffer + length, "},\"cached\":%s}\n", ((job->stats.flags & BINARY_RECORD_CACHED) ? "true" : "false"));
+
+  assert(length < get_json_record_size(job));
+  return length;
+}
+
+
+// Counts and writes one finished job
+static
+void write_batch_job(struct batch_context *context, struct batch_job *job)
+{
+  if (context->options->copy_only)
+    context->total_copied++;
+  else if (context->options->canonical_form)
+    context->total_canonicalized++;
+  else if (job->solutions_count)
+    context->total_solved++;
+  else
+    context->total_unsolved++;
+
+  if (context->options->print_stats) {
+    add_stats(&context->run_stats, &job->solve_stats);
+    add_to_search_histogram(&context->search_histogram, &job->solve_stats);
+  }
+
+  // Jobs from all the solver threads come through here, so one set of histograms will do
+  if (context->options->latency)
+    record_histogram(&context->latency[get_outcome(job->solutions_count)], job->wall_ns);
+
+  if (context->binary_output) {
+    // Copies and canonical forms have no solution to go with the puzzle
+    if (context->options->copy_only)
+      write_binary_record(context->binary_output, job->puzzle, job->grid, &job->stats);
+    else if (context->options->canonical_form)
+      write_binary_record(context->binary_output, job->grid, NULL, NULL);
+    else
+      write_binary_record(context->binary_output, job->puzzle, job->grid, &job->stats);
+  } else if (context->options->json_output) {
+    commit_output(context->output, format_json_record(context, job, get_output_space(context->output, get_json_record_size(job))));
+  } else if (context->output) {
+    commit_output(context->output, format_grid_line(job->grid, get_output_space(context->output, BOARD_LINE_SIZE)));
+  }
+}
+
+
+// Fills in the jobs of the batch from the input, returns how many. The puzzles are parsed and
+// checked here, so the solver threads only solve.
+static
+int read_batch_jobs(struct batch_context *context, struct batch *batch)
+{
+  struct batch_job *job;
+  size_t chars_read, text_used;
+  int count;
+
+  count = 0;
+  text_used = 0;
+  while (count < BATCH_JOB_COUNT) {
+    job = &batch->jobs[count];
+    if (context->binary_input) {
+      if (context->next_record >= context->end_record)
+        break;
+      job->line = NULL;
+      job->has_solution = read_binary_record(context->binary_input, context->next_record++, job->puzzle, job->grid, &job->stats);
+    } else {
+      chars_read = next_input_line(context->input, &job->line);
+      if (chars_read == 0)
+        break;
+      job->line_length = chars_read;
+      job->has_solution = 0;
+      if (!is_batch_line(job->line, chars_read))
+        continue;
+      // Copies keep the numbers as they are, clashing or not, but only of whole puzzles
+      if ((read_grid_length(job->line, chars_read, job->puzzle) != 81) && context->options->copy_only) {
+        context->total_skipped++;
+        continue;
+      }
+
+      // A streamed line is gone once the next is read, so the batch keeps its own copy. If it
+      // doesn't fit it's put back for the next batch.
+      if (context->input->streamed) {
+        if ((text_used + chars_read > BATCH_TEXT_SIZE) && (count > 0)) {
+          unread_input_line(context->input, chars_read);
+          break;
+        }
+        if (job->line_length > BATCH_TEXT_SIZE)
+          job->line_length = BATCH_TEXT_SIZE; // Only echoed in JSON output, which cuts it shorter
+        memcpy(batch->text + text_used, job->line, job->line_length);
+        job->line = batch->text + text_used;
+        text_used += job->line_length;
+      }
+    }
+    job->invalid = grid_has_clashes(job->puzzle);
+    count++;
+  }
+
+  return count;
+}
+
+
+static inline
+unsigned long batch_input_position(struct batch_context *context)
+{
+  return (context->binary_input ? context->next_record : context->input->offset);
+}
+
+
+// Syncs the output and records how far the run got, so --resume can go on from there
+static
+void checkpoint_batch_run(struct batch_context *context)
+{
+  struct sudoku_checkpoint checkpoint;
+
+  if (sync_output(context->output) != 0)
+    return; // Reported when the output is closed
+
+  checkpoint.input_size = (context->binary_input ? context->binary_input->input->size : context->input->size);
+  checkpoint.input_position = context->input_position;
+  checkpoint.output_offset = context->output->offset;
+  checkpoint.shard = context->options->shard;
+  checkpoint.shard_count = context->options->shard_count;
+  checkpoint.total_solved = context->total_solved;
+  checkpoint.total_unsolved = context->total_unsolved;
+  checkpoint.total_canonicalized = context->total_canonicalized;
+  checkpoint.total_copied = context->total_copied;
+  if (write_checkpoint(context->checkpoint_file_name, &checkpoint) != 0)
+    fprintf(stderr, "Cound not write checkpoint file: %s\n", context->checkpoint_file_name);
+}
+
+
+// Picks up the input, output and totals of a killed run from its checkpoint, if there is one
+static
+int resume_batch_run(struct batch_context *context, unsigned long *output_offset)
+{
+  struct options *options = context->options;
+  struct sudoku_checkpoint checkpoint;
+  unsigned long input_size, start, end;
+
+  *output_offset = 0;
+  if (read_checkpoint(context->checkpoint_file_name, &checkpoint) != 0)
+    return 0; // Nothing to resume - start from the beginning
+
+  if (context->binary_input) {
+    input_size = context->binary_input->input->size;
+    start = context->next_record;
+    end = context->end_record;
+  } else {
+    input_size = context->input->size;
+    start = context->input->offset;
+    end = context->input->end;
+  }
+  if ((checkpoint.input_size != input_size) || (checkpoint.shard != options->shard) || (checkpoint.shard_count != options->shard_count) ||
+      (checkpoint.input_position < start) || (checkpoint.input_position > end)) {
+    fprintf(stderr, "Checkpoint doesn't match the input file: %s\n", context->checkpoint_file_name);
+    return -1;
+  }
+
+  if (context->binary_input)
+    context->next_record = checkpoint.input_position;
+  else
+    context->input->offset = checkpoint.input_position;
+  context->input_position = checkpoint.input_position;
+  context->total_solved = checkpoint.total_solved;
+  context->total_unsolved = checkpoint.total_unsolved;
+  context->total_canonicalized = checkpoint.total_canonicalized;
+  context->total_copied = checkpoint.total_copied;
+  *output_offset = checkpoint.output_offset;
+
+  if (!options->quiet_mode)
+    printf("Resuming from checkpoint: %s\n", context->checkpoint_file_name);
+
+  return 0;
+}
+
+
+static
+void write_batch(struct batch_context *context, struct batch *batch)
+{
+  struct timespec now;
+  int i;
+
+  for (i=0; i<batch->job_count; i++)
+    write_batch_job(context, &batch->jobs[i]);
+
+  context->input_position = batch->input_end;
+  if (context->checkpoint_file_name) {
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (now.tv_sec - context->checkpoint_time.tv_sec >= CHECKPOINT_INTERVAL) {
+      checkpoint_batch_run(context);
+      context->checkpoint_time = now;
+    }
+  }
+}
+
+
+// Solver stage - an empty batch means the input is done, pass it on to the other solvers
+static
+void* batch_solver(void *arg)
+{
+  struct batch_context *context = (struct batch_context*) arg;
+  struct batch *batch;
+  int i;
+
+  for (;;) {
+    batch = (struct batch*) ring_pop_wait(context->read_ring);
+    if (batch->job_count == 0) {
+      ring_push_wait(context->read_ring, batch);
+      break;
+    }
+    for (i=0; i<batch->job_count; i++)
+      solve_batch_job(context, &batch->jobs[i]);
+    ring_push_wait(context->solved_ring, batch);
+  }
+
+  release_board_pool();
+  return NULL;
+}
+
+
+// Writer stage - puts the batches back in input order unless -u, an empty batch means all done
+static
+void* batch_writer(void *arg)
+{
+  struct batch_context *context = (struct batch_context*) arg;
+  struct batch *batch, **pending;
+  unsigned long next_sequence;
+
+  // At most batch_count batches are out, so their sequence numbers never share a slot
+  pending = context->pending;
+  next_sequence = 0;
+
+  for (;;) {
+    batch = (struct batch*) ring_pop_wait(context->solved_ring);
+    if (batch->job_count == 0)
+      break;
+
+    if (context->options->unordered_output) {
+      write_batch(context, batch);
+      ring_push_wait(context->free_ring, batch);
+      continue;
+    }
+
+    pending[batch->sequence % context->batch_count] = batch;
+    while ((batch = pending[next_sequence % context->batch_count]) && (batch->sequence == next_sequence)) {
+      pending[next_sequence % context->batch_count] = NULL;
+      write_batch(context, batch);
+      ring_push_wait(context->free_ring, batch);
+      next_sequence++;
+    }
+  }
+
+  return NULL;
+}
+
+
+// The last nest level also counts the deeper ones
+static
+const char* format_nest_level(int level, char *buffer)
+{
+  sprintf(buffer, ((level == SEARCH_DEPTH_COUNT - 1) ? "%i+" : "%i"), level);
+  return buffer;
+}
+
+
+// An event per 1000 instructions, or "-" if the event wasn't counted
+static
+const char* format_per_kilo_instruction(const unsigned long perf[PERF_EVENT_COUNT], enum sudoku_perf_event event,
+                                        unsigned int event_mask, char *buffer)
+{
+  if (!(event_mask & (1 << event)) || !(event_mask & (1 << PERF_INSTRUCTIONS)) || (perf[PERF_INSTRUCTIONS] == 0))
+    return "-";
+  sprintf(buffer, "%.2f", 1000.0 * perf[event] / perf[PERF_INSTRUCTIONS]);
+  return buffer;
+}
+
+
+// By step of solve(), the guesses with the nested boards they solved. Misses are per 1000
+// instructions (MPKI), so steps of different sizes can be compared.
+static
+void print_perf_stats(const struct sudoku_stats *stats)
+{
+  const unsigned long *perf;
+  unsigned int event_mask;
+  char ipc[16], branch[16], l1d[16], llc[16];
+  int i;
+
+  event_mask = get_perf_event_mask();
+  if (!(event_mask & (1 << PERF_CYCLES))) {
+    printf("Hardware counters: not available (no PMU, or not allowed by perf_event_paranoid)\n");
+    return;
+  }
+
+  printf("%-32s %16s %16s %6s %12s %12s %12s\n", "Step", "Cycles", "Instructions", "IPC", "Branch MPKI", "L1D MPKI", "LLC MPKI");
+  for (i=0; i<STRATEGY_COUNT; i++) {
+    perf = stats->perf[i];
+    if (!(event_mask & (1 << PERF_INSTRUCTIONS)) || (perf[PERF_CYCLES] == 0))
+      strcpy(ipc, "-");
+    else
+      sprintf(ipc, "%.2f", (double)perf[PERF_INSTRUCTIONS] / perf[PERF_CYCLES]);
+    printf("%-32s %16lu %16lu %6s %12s %12s %12s\n", get_strategy_name(i), perf[PERF_CYCLES],
+           perf[PERF_INSTRUCTIONS], ipc,
+           format_per_kilo_instruction(perf, PERF_BRANCH_MISSES, event_mask, branch),
+           format_per_kilo_instruction(perf, PERF_L1D_MISSES, event_mask, l1d),
+           format_per_kilo_instruction(perf, PERF_LLC_MISSES, event_mask, llc));
+  }
+
+  // Shared with other events the counters only ran part of the time, those counts are scaled up
+  if (stats->perf_multiplexed)
+    printf("Hardware counters: multiplexed in %lu of %lu steps, their counts are scaled up estimates\n",
+           stats->perf_multiplexed, stats->perf_steps);
+  else
+    printf("Hardware counters: counted all the time in %lu steps\n", stats->perf_steps);
+}
+
+
+static
+void print_solve_stats(const struct sudoku_stats *stats, const struct sudoku_search_histogram *histogram, int count_cycles, int count_perf)
+{
+  char label[16];
+  int i;
+
+  printf("%-32s %12s %12s %12s", "Pass", "Calls", "Placements", "Changes");
+  if (count_cycles)
+    printf(" %16s", "Cycles");
+  printf("\n");
+  for (i=0; i<PASS_COUNT; i++) {
+    printf("%-32s %12lu %12lu %12lu", get_pass_name(i), stats->passes[i].calls, stats->passes[i].placements, stats->passes[i].changes);
+    if (count_cycles)
+      printf(" %16lu", stats->passes[i].cycles);
+    printf("\n");
+  }
+  printf("Guesses: %lu  Max nest level: %u  Probes: %lu in %lu rounds\n", stats->guesses, stats->max_nest_level,
+         stats->probes, stats->probe_rounds);
+
+  printf("Nodes: %lu  Backtracks: %lu  Dead ends:", stats->nodes, stats->backtracks);
+  for (i=0; i<STRATEGY_COUNT; i++)
+    printf(" %s %lu", get_strategy_name(i), stats->dead_ends[i]);
+  printf("\n");
+
+  // Only the levels and buckets that have something in them
+  printf("%-12s %14s %14s %16s\n", "Nest level", "Branch points", "Branches", "Branching factor");
+  for (i=0; i<SEARCH_DEPTH_COUNT; i++) {
+    if (stats->branch_points[i])
+      printf("%-12s %14lu %14lu %16.2f\n", format_nest_level(i, label), stats->branch_points[i], stats->branches[i],
+             (double)stats->branches[i] / stats->branch_points[i]);
+  }
+
+  printf("%-12s %14s\n", "Max nest", "Puzzles");
+  for (i=0; i<SEARCH_DEPTH_COUNT; i++) {
+    if (histogram->max_nest_levels[i])
+      printf("%-12s %14lu\n", format_nest_level(i, label), histogram->max_nest_levels[i]);
+  }
+
+  printf("%-24s %14s\n", "Nodes", "Puzzles");
+  for (i=0; i<SEARCH_NODES_BUCKET_COUNT; i++) {
+    if (histogram->nodes[i] && (i == SEARCH_NODES_BUCKET_COUNT - 1))
+      printf("%10lu +%12s %14lu\n", 1UL << i, "", histogram->nodes[i]);
+    else if (histogram->nodes[i])
+      printf("%10lu - %-11lu %14lu\n", 1UL << i, (2UL << i) - 1, histogram->nodes[i]);
+  }
+
+  if (count_perf)
+    print_perf_stats(stats);
+}
+
+
+static
+void print_ring_metrics(const char *name, struct sudoku_ring *ring)
+{
+  printf("%s: Batches: %lu  Average depth: %.1f  Max depth: %lu  Full waits: %lu  Empty waits: %lu\n",
+         name, ring->push_count, (ring->push_count ? (double)ring->depth_sum / ring->push_count : 0.0),
+         ring->depth_max, ring->full_waits, ring->empty_waits);
+}
+
+
+// Reader (this thread) -> read ring -> solver threads -> solved ring -> writer thread -> free ring -> reader.
+// The reader can only read as far ahead as there are free batches, which bounds the memory used.
+static
+int run_batch_pipeline(struct batch_context *context)
+{
+  struct options *options = context->options;
+  struct batch *batches, *batch;
+  pthread_t *solvers, writer;
+  unsigned long sequence;
+  int i;
+
+  context->batch_count = BATCH_COUNT(options->thread_count);
+  batches = (struct batch*) malloc(context->batch_count * sizeof(struct batch));
+  context->pending = (struct batch**) calloc(context->batch_count, sizeof(struct batch*));
+  solvers = (pthread_t*) calloc(options->thread_count, sizeof(pthread_t));
+  context->free_ring = create_ring(context->batch_count);
+  context->read_ring = create_ring(context->batch_count);
+  context->solved_ring = create_ring(context->batch_count);
+  if (!batches || !context->pending || !solvers || !context->free_ring || !context->read_ring || !context->solved_ring) {
+    fprintf(stderr, "Cound not allocate %i batches\n", context->batch_count);
+    destroy_ring(&context->free_ring);
+    destroy_ring(&context->read_ring);
+    destroy_ring(&context->solved_ring);
+    free(context->pending);
+    free(solvers);
+    free(batches);
+    return -1;
+  }
+
+  for (i=0; i<context->batch_count; i++)
+    ring_push(context->free_ring, &batches[i]);
+
+  // Threads waiting on the rings can't be stopped, so give up if any of them can't start
+  pthread_mutex_init(&context->lock, NULL);
+  if (pthread_create(&writer, NULL, batch_writer, context) != 0) {
+    fprintf(stderr, "Cound not start batch writer thread\n");
+    exit(1);
+  }
+  for (i=0; i<options->thread_count; i++) {
+    if (pthread_create(&solvers[i], NULL, batch_solver, context) != 0) {
+      fprintf(stderr, "Cound not start batch solver thread %i\n", i);
+      exit(1);
+    }
+  }
+
+  // Read until an empty batch, which tells the solvers to stop
+  sequence = 0;
+  do {
+    batch = (struct batch*) ring_pop_wait(context->free_ring);
+    batch->job_count = read_batch_jobs(context, batch);
+    batch->input_end = batch_input_position(context);
+    batch->sequence = sequence++;
+    ring_push_wait(context->read_ring, batch);
+  } while (batch->job_count);
+
+  for (i=0; i<options->thread_count; i++)
+    pthread_join(solvers[i], NULL);
+
+  // Everything solved is in the solved ring ahead of the empty batch, so it tells the writer it's done
+  batch = (struct batch*) ring_pop(context->read_ring);
+  ring_push_wait(context->solved_ring, batch);
+  pthread_join(writer, NULL);
+  pthread_mutex_destroy(&context->lock);
+
+  if (!options->quiet_mode) {
+    print_ring_metrics("Read queue", context->read_ring);
+    print_ring_metrics("Solved queue", context->solved_ring);
+    print_ring_metrics("Free queue", context->free_ring);
+  }
+
+  destroy_ring(&context->free_ring);
+  destroy_ring(&context->read_ring);
+  destroy_ring(&context->solved_ring);
+  free(context->pending);
+  free(solvers);
+  free(batches);
+
+  return 0;
+}
+
+
+// Closes whatever was opened for a batch run, returns -1 if the output couldn't be completed.
+// A completed run has nothing to resume, so its checkpoint goes too.
+static
+int close_batch_files(struct batch_context *context, int completed)
+{
+  int status = 0;
+
+  destroy_cache(&context->cache);
+  close_store(&context->store);
+  close_input(&context->input);
+  close_binary(&context->binary_input);
+  if (context->binary_output && (close_binary(&context->binary_output) != 0)) {
+    fprintf(stderr, "Cound not write output file: %s\n", context->options->output_file_name);
+    status = -1;
+  }
+  if (context->output && (close_output(&context->output) != 0)) {
+    fprintf(stderr, "Cound not write output file: %s\n", context->options->output_file_name);
+    status = -1;
+  }
+  if (context->checkpoint_file_name && completed && (status == 0))
+    unlink(context->checkpoint_file_name);
+  free(context->checkpoint_file_name);
+  context->checkpoint_file_name = NULL;
+
+  return status;
+}
+
+
+static
+int run_batch_from_file(struct options *options)
+{
+  struct batch_context context;
+  struct batch *batch;
+  unsigned int binary_flags;
+  unsigned long output_offset;
+  int i, status;
+
+  context.options = options;
+  context.input = NULL;
+  context.binary_input = NULL;
+  context.binary_output = NULL;
+  context.cache = NULL;
+  context.store = NULL;
+  context.output = NULL;
+  context.total_solved = 0;
+  context.total_unsolved = 0;
+  context.total_canonicalized = 0;
+  context.total_copied = 0;
+  context.total_skipped = 0;
+  context.next_record = 0;
+  context.checkpoint_file_name = NULL;
+  context.input_position = 0;
+  memset(&context.run_stats, 0, sizeof(context.run_stats));
+  memset(&context.search_histogram, 0, sizeof(context.search_histogram));
+  memset(context.latency, 0, sizeof(context.latency));
+
+  // Text or binary input - binary files are known by their header
+  context.input = open_input(options->input_file_name);
+  if (!context.input) {
+    fprintf(stderr, "Cound not open input file: %s\n", options->input_file_name);
+    return -1;
+  }
+  if (is_binary_input(context.input)) {
+    close_input(&context.input);
+    context.binary_input = open_binary(options->input_file_name);
+    if (!context.binary_input)
+      return -1;
+  }
+
+  // A shard is a contiguous run of lines (or records), so shard outputs in order are the whole output
+  if (context.binary_input) {
+    context.next_record = 0;
+    context.end_record = context.binary_input->record_count;
+    if (options->shard_count) {
+      context.next_record = context.binary_input->record_count / options->shard_count * options->shard;
+      if (options->shard + 1 < options->shard_count)
+        context.end_record = context.binary_input->record_count / options->shard_count * (options->shard + 1);
+    }
+  } else if (context.input->streamed && (options->shard_count || options->resume)) {
+    // Only part of it is ever at hand, and it can't be read again
+    fprintf(stderr, "Cound not shard or resume input that is not a regular file: %s\n", options->input_file_name);
+    close_input(&context.input);
+    return -1;
+  } else if (options->shard_count) {
+    shard_input(context.input, options->shard, options->shard_count);
+  }
+
+  // The checkpoint goes next to the output
+  output_offset = 0;
+  if (options->resume) {
+    context.checkpoint_file_name = (char*) malloc(strlen(options->output_file_name) + 8);
+    if (!context.checkpoint_file_name) {
+      close_batch_files(&context, 0);
+      return -1;
+    }
+    sprintf(context.checkpoint_file_name, "%s.ckpt", options->output_file_name);
+    clock_gettime(CLOCK_MONOTONIC, &context.checkpoint_time);
+    if (resume_batch_run(&context, &output_offset) != 0) {
+      close_batch_files(&context, 0);
+      return -1;
+    }
+  }
+
+  if (options->output_file_name && options->binary_output) {
+    // Copies keep what the input has, canonical forms have no solutions
+    if (options->copy_only)
+      binary_flags = (context.binary_input ? context.binary_input->flags : 0);
+    else if (options->canonical_form)
+      binary_flags = 0;
+    else
+      binary_flags = BINARY_HAS_SOLUTIONS | BINARY_HAS_STATS;
+    context.binary_output = create_binary(options->output_file_name, binary_flags);
+    if (!context.binary_output) {
+      fprintf(stderr, "Cound not open output file: %s\n", options->output_file_name);
+      close_batch_files(&context, 0);
+      return -1;
+    }
+  } else if (options->output_file_name) {
+    context.output = create_output(options->output_file_name, output_offset);
+    if (!context.output) {
+      fprintf(stderr, "Cound not open output file: %s\n", options->output_file_name);
+      close_batch_files(&context, 0);
+      return -1;
+    }
+  }
+
+  if (options->cache_size) {
+    context.cache = create_cache(options->cache_size * 1024);
+    if (!context.cache) {
+      fprintf(stderr, "Cound not create cache of %li kB\n", options->cache_size);
+      close_batch_files(&context, 0);
+      return -1;
+    }
+  }
 
-  board = create_board();
-  board->debug_level = options->verbose_level;
-  board->guessing_allowed = options->guessing_allowed;
-  read_board(board, input_str);
+  if (options->store_file_name) {
+    context.store = open_store(options->store_file_name, 1, STORE_SLOT_COUNT_DEFAULT);
+    if (!context.store) {
+      fprintf(stderr, "Cound not open solution store: %s\n", options->store_file_name);
+      close_batch_files(&context, 0);
+      return -1;
+    }
+    if (!context.store->writable && !options->quiet_mode)
+      fprintf(stderr, "Solution store in use by another writer, opened read only: %s\n", options->store_file_name);
+  }
 
-  if (options->verbose_level) {
-    printf("-------- Input --------\n");
-    print_board(board);
-    if (options->print_latex) 
-      print_board_latex(board);
-    printf("---Solve---\n");
-    if (!options->guessing_allowed) 
-      printf("Guessing not allowed\n");
+  // Several threads make a pipeline, one thread just reads, solves and writes a batch at a time
+  status = 0;
+  if (options->thread_count > 1) {
+    status = run_batch_pipeline(&context);
+  } else {
+    batch = (struct batch*) malloc(sizeof(struct batch));
+    if (batch) {
+      while ((batch->job_count = read_batch_jobs(&context, batch))) {
+        batch->input_end = batch_input_position(&context);
+        for (i=0; i<batch->job_count; i++)
+          solve_batch_job(&context, &batch->jobs[i]);
+        write_batch(&context, batch);
+      }
+      free(batch);
+    } else {
+      fprintf(stderr, "Cound not allocate batch\n");
+      status = -1;
+    }
   }
 
-  solutions_count = solve(board);
-  
-  if (options->verbose_level) {
-    if (!options->guessing_allowed) 
-      printf("Guessing not allowed\n");
-    if (solutions_count)
-      printf("Found %i solution(s)\n", solutions_count);
+  if (!options->quiet_mode) {
+    if (context.total_copied)
+      printf("Number of copied: %i\n", context.total_copied);
+    else if (context.total_canonicalized)
+      printf("Number of canonicalized: %i\n", context.total_canonicalized);
+    else if (context.total_solved + context.total_unsolved)
+      printf("Number of solved: %i  Number of unsolved: %i\n", context.total_solved, context.total_unsolved);
     else
-      printf("No solution found\n");
-    printf("-------- Output -------\n");
-    print_solutions(board);
-    printf("\n");    
+      printf("No pussles found in file: %s\n", options->input_file_name);    
+    if (context.total_skipped)
+      printf("Number of skipped lines that are not a whole puzzle: %i\n", context.total_skipped);
+    if (context.cache)
+      printf("Cache hits: %lu  Cache misses: %lu  Cache evictions: %lu\n", context.cache->hits, context.cache->misses, context.cache->evictions);
+    if (context.store)
+      printf("Store hits: %lu  Store misses: %lu  Store inserts: %lu  Store skipped: %lu  Store grows: %lu\n", context.store->hits,
+             context.store->misses, context.store->inserts, context.store->skipped, context.store->grows);
   }
 
-  if (options->pretty_print) 
-    print_board(board);
-  else if (options->print_latex) 
-    print_board_latex(board);
-  else
-    print_board_simple(board);
+  if (context.input && context.input->error) {
+    fprintf(stderr, "Cound not read all of input file: %s\n", options->input_file_name);
+    status = -1;
+  }
 
-  destroy_board(&board);
-  free(input_str);
+  // Asked for, so printed even in quiet mode
+  if (options->print_stats)
+    print_solve_stats(&context.run_stats, &context.search_histogram, options->count_cycles, options->count_perf);
+  if (options->latency)
+    print_latency(context.latency, (options->latency > 1));
 
-  return 0;
+  if (close_batch_files(&context, (status == 0)) != 0)
+    status = -1;
+
+  return status;
 }
 
 
+// Appends the text files to the output as they are
 static
-int run_stdio(struct options *options)
+int merge_text_files(struct options *options, int file_count, char **file_names)
 {
-  struct sudoku_board *board;
-  char *buffer, *line;
-  size_t line_size;
-  int buffer_bytes, chars_read, solutions_count;
-
-  buffer = (char*)malloc(BUFFER_SIZE);
-  buffer_bytes = 0;
-
-  line = buffer;
-  line_size = BUFFER_SIZE;
+  struct sudoku_input *input;
+  const char *chunk;
+  size_t length;
+  FILE *fout;
+  int i, status;
+
+  fout = fopen(options->output_file_name, "w");
+  if (!fout) {
+    fprintf(stderr, "Cound not open output file: %s\n", options->output_file_name);
+    return -1;
+  }
 
-  while ((chars_read = getline(&line, &line_size, stdin)) != -1) {
-    if ((chars_read) && (line[0] != '#') && (line[0] != ';') && (line[0] != '!')) {
-      line += chars_read;
-      line_size -= chars_read;
-      buffer_bytes += chars_read;
+  status = 0;
+  for (i=0; (i<file_count) && (status == 0); i++) {
+    input = open_input(file_names[i]);
+    if (!input) {
+      fprintf(stderr, "Cound not open file: %s\n", file_names[i]);
+      status = -1;
+    } else if (is_binary_input(input)) {
+      fprintf(stderr, "Cound not merge binary file with text files: %s\n", file_names[i]);
+      status = -1;
+    } else {
+      while ((length = next_input_chunk(input, &chunk)) && (status == 0)) {
+        if (fwrite(chunk, 1, length, fout) != length)
+          status = -1;
+      }
+      if (input->error)
+        status = -1;
     }
+    close_input(&input);
   }
-  buffer[buffer_bytes] = 0;
 
-  board = create_board();
-  read_board(board, buffer);
+  if ((fclose(fout) != 0) && (status == 0))
+    status = -1;
+  if (status != 0)
+    fprintf(stderr, "Cound not write output file: %s\n", options->output_file_name);
 
-  board->debug_level = options->verbose_level;
-  board->guessing_allowed = options->guessing_allowed;
-  if (options->verbose_level) {
-    printf("-------- Input --------\n");
-    print_board(board);
-    if (options->print_latex) 
-      print_board_latex(board);
-  }
+  return status;
+}
 
-  solutions_count = solve(board);
 
-  if (options->verbose_level) {
-    printf("-------- Output -------\n");
-    print_solutions(board);
-    printf("\n");     
+// Copies the records of the binary files to one binary output with a new index
+static
+int merge_binary_files(struct options *options, int file_count, char **file_names)
+{
+  struct sudoku_binary *binary_input, *binary_output;
+  struct sudoku_binary_stats stats;
+  unsigned char puzzle[81], solution[81];
+  unsigned long record;
+  int i, has_solution, status;
+
+  binary_input = open_binary(file_names[0]);
+  if (!binary_input)
+    return -1;
+  binary_output = create_binary(options->output_file_name, binary_input->flags);
+  if (!binary_output) {
+    fprintf(stderr, "Cound not open output file: %s\n", options->output_file_name);
+    close_binary(&binary_input);
+    return -1;
   }
 
-  if (options->pretty_print) 
-    print_board(board);
-  else if (options->print_latex) 
-    print_board_latex(board);
-  else
-    print_board_simple(board);
-  
-  destroy_board(&board);
-  free(buffer);
+  status = 0;
+  for (i=0; (i<file_count) && (status == 0); i++) {
+    if (i > 0)
+      binary_input = open_binary(file_names[i]);
+    if (!binary_input) {
+      status = -1;
+      break;
+    }
+    if (binary_input->flags != binary_output->flags) {
+      fprintf(stderr, "Cound not merge binary files with different contents: %s\n", file_names[i]);
+      status = -1;
+    }
+    for (record=0; (record<binary_input->record_count) && (status == 0); record++) {
+      has_solution = read_binary_record(binary_input, record, puzzle, solution, &stats);
+      write_binary_record(binary_output, puzzle, (has_solution ? solution : NULL), ((binary_input->flags & BINARY_HAS_STATS) ? &stats : NULL));
+    }
+    close_binary(&binary_input);
+  }
 
-  return solutions_count;
+  if ((close_binary(&binary_output) != 0) && (status == 0)) {
+    fprintf(stderr, "Cound not write output file: %s\n", options->output_file_name);
+    status = -1;
+  }
+
+  return status;
 }
 
 
+// Recombines shard outputs, given in shard order, into one output - in the format of the first one
 static
-int run_batch_from_file(struct options *options)
+int run_merge(struct options *options, int file_count, char **file_names)
 {
-  FILE *fin, *fout;
-  char *line = NULL;
-  size_t line_size = BUFFER_SIZE;
-  struct sudoku_board *board;
-  int chars_read, solutions_count, total_solved, total_unsolved;
+  struct sudoku_input *input;
+  int binary, status;
 
-  fin = fopen(options->input_file_name, "r");
-  if (!fin) {
-    fprintf(stderr, "Cound not open input file: %s\n", options->input_file_name);
+  input = open_input(file_names[0]);
+  if (!input) {
+    fprintf(stderr, "Cound not open file: %s\n", file_names[0]);
     return -1;
   }
+  binary = is_binary_input(input);
+  close_input(&input);
 
-  fout = NULL;
-  if (options->output_file_name) {
-    fout = fopen(options->output_file_name, "w");
-    if (!fout) {
-      fprintf(stderr, "Cound not open output file: %s\n", options->output_file_name);
-      fclose(fin);
-      return -1;
-    }
-  }
+  if (binary)
+    status = merge_binary_files(options, file_count, file_names);
+  else
+    status = merge_text_files(options, file_count, file_names);
 
-  total_solved = 0;
-  total_unsolved = 0;
-  line = (char*)malloc(line_size);
-  while ((chars_read = getline(&line, &line_size, fin)) != -1) {
-    if (chars_read >= ((8*8)+1) && (line[0] != '#') && (line[0] != ';') && (line[0] != '!')) {
-      board = create_board();
-      read_board(board, line);
-      
-      board->debug_level = options->verbose_level;
-      board->guessing_allowed = options->guessing_allowed;
-      if (options->verbose_level) {
-        printf("-------- Input --------\n");
-        print_board(board);
-        if (options->print_latex) 
-          print_board_latex(board);
-        printf("--- Solve---\n");
-        if (!options->guessing_allowed) 
-          printf("Guessing not allowed\n");
-      }
+  if ((status == 0) && !options->quiet_mode)
+    printf("Number of merged files: %i\n", file_count);
 
-      solutions_count = solve(board);
-      
-      if (options->verbose_level && !options->guessing_allowed) 
-        printf("Guessing not allowed\n");
-      if (solutions_count){     
-        if (options->verbose_level)
-          printf("Found %i solution(s)\n", solutions_count);
-        total_solved++;
-      } else {
-        if (options->verbose_level)
-          printf("No solution found\n"); 
-        total_unsolved++;
-      }
+  return status;
+}
 
-      if (options->verbose_level) {
-        printf("-------- Output -------\n");
-        print_solutions(board);
-        if (options->print_latex) 
-          print_board_latex(board);
-        printf("\n=====================\n\n");
-      }
-  
-      if (fout)
-        print_board_line(fout, board);
 
-      destroy_board(&board);
-    }
-  }
+static
+int run_benchmark_from_options(struct options *options, int file_count, char **file_names)
+{
+  struct sudoku_solver_config config;
 
-  if (!options->quiet_mode) {
-    if (total_solved + total_unsolved)
-      printf("Number of solved: %i  Number of unsolved: %i\n", total_solved, total_unsolved);
-    else
-      printf("No pussles found in file: %s\n", options->input_file_name);    
-  }
+  config.guessing_allowed = options->guessing_allowed;
+  config.chain_max_length = options->chain_max_length;
+  config.probe_budget = options->probe_budget;
 
-  fclose(fin);
-  if (fout)
-    fclose(fout);
-  free(line);
+  return run_benchmark(file_count, file_names, &config, options->bench_run_count);
+}
 
-  return 0;
+
+static
+int run_server_from_options(struct options *options)
+{
+  struct sudoku_server_options server_options;
+
+  server_options.socket_path = options->socket_path;
+  server_options.port = options->port;
+  server_options.thread_count = (options->thread_count ? options->thread_count : SERVER_THREAD_COUNT_DEFAULT);
+  server_options.guessing_allowed = options->guessing_allowed;
+  server_options.chain_max_length = options->chain_max_length;
+  server_options.probe_budget = options->probe_budget;
+  server_options.quiet_mode = options->quiet_mode;
+  server_options.latency = options->latency;
+  server_options.cache_size = options->cache_size;
+
+  return run_server(&server_options);
 }
 
 
@@ -260,6 +1423,19 @@ void print_legal()
          "under certain conditions; see LICENSE file for details.\n" );
 }
 
+static const struct option long_options[] = {
+  { "shard", required_argument, NULL, OPTION_SHARD },
+  { "merge", no_argument,       NULL, OPTION_MERGE },
+  { "resume", no_argument,      NULL, OPTION_RESUME },
+  { "bench", no_argument,       NULL, OPTION_BENCH },
+  { "runs",  required_argument, NULL, OPTION_RUNS },
+  { "stats", optional_argument, NULL, OPTION_STATS },
+  { "trace", required_argument, NULL, OPTION_TRACE },
+  { "latency", optional_argument, NULL, OPTION_LATENCY },
+  { NULL,    0,                 NULL, 0 }
+};
+
+
 static
 int parse_argument(int argc, char **argv, struct options *options)
 {
@@ -271,16 +1447,102 @@ int parse_argument(int argc, char **argv, struct options *options)
   options->verbose_level = 0;
   options->quiet_mode = 0;
   options->guessing_allowed = 1;
+  options->chain_max_length = CHAIN_MAX_LENGTH_DEFAULT;
+  options->probe_budget = PROBE_BUDGET_DEFAULT;
   options->pretty_print = 0;
   options->print_latex = 0;
   options->print_help = 0;
   options->run_builtin_test  = 0;
+  options->canonical_form = 0;
+  options->cache_size = 0;
+  options->store_file_name = NULL;
   options->input_file_name = NULL;
   options->output_file_name = NULL;
+  options->thread_count = 0; // Not given
+  options->unordered_output = 0;
+  options->binary_output = 0;
+  options->json_output = 0;
+  options->copy_only = 0;
+  options->stream_stdin = 0;
+  options->socket_path = NULL;
+  options->port = 0;
+  options->shard = 0;
+  options->shard_count = 0;
+  options->merge_files = 0;
+  options->resume = 0;
+  options->bench_mode = 0;
+  options->bench_run_count = BENCH_RUN_COUNT_DEFAULT;
+  options->print_stats = 0;
+  options->count_cycles = 0;
+  options->count_perf = 0;
+  options->trace_file_name = NULL;
+  options->latency = 0;
 
   opterr = 0;
-  while ((c = getopt(argc, argv, "vqnd:xho:f:pt")) != -1) {
+  while ((c = getopt_long(argc, argv, "vqnd:xho:f:ptcm:s:l:b:j:uzJriU:P:", long_options, NULL)) != -1) {
     switch (c) {
+      case OPTION_SHARD:
+        // i/N - shards are numbered from 0
+        value = strtol(optarg, &dummy, 10);
+        if ((dummy == optarg) || (*dummy != '/') || (value < 0)) {
+          fprintf(stderr, "Option --shard needs i/N with 0 <= i < N. Use -h for help.\n");
+          return 1;
+        }
+        options->shard = value;
+        value = strtol(dummy + 1, &dummy, 10);
+        if ((*dummy != '\0') || (value <= (long)options->shard)) {
+          fprintf(stderr, "Option --shard needs i/N with 0 <= i < N. Use -h for help.\n");
+          return 1;
+        }
+        options->shard_count = value;
+        break;
+
+      case OPTION_MERGE:
+        options->merge_files = 1;
+        break;
+
+      case OPTION_RESUME:
+        options->resume = 1;
+        break;
+
+      case OPTION_BENCH:
+        options->bench_mode = 1;
+        break;
+
+      case OPTION_STATS:
+        // --stats=cycles also reads the time stamp counter around each pass, --stats=perf the hardware counters
+        options->print_stats = 1;
+        if (optarg && (strcmp(optarg, "cycles") == 0)) {
+          options->count_cycles = 1;
+        } else if (optarg && (strcmp(optarg, "perf") == 0)) {
+          options->count_perf = 1;
+        } else if (optarg) {
+          fprintf(stderr, "Option --stats only takes =cycles or =perf. Use -h for help.\n");
+          return 1;
+        }
+        break;
+
+      case OPTION_LATENCY:
+        // --latency=buckets also prints every bucket of the histograms
+        options->latency = 1;
+        if (optarg && (strcmp(optarg, "buckets") == 0)) {
+          options->latency = 2;
+        } else if (optarg) {
+          fprintf(stderr, "Option --latency only takes =buckets. Use -h for help.\n");
+          return 1;
+        }
+        break;
+
+      case OPTION_TRACE:
+        options->trace_file_name = optarg;
+        break;
+
+      case OPTION_RUNS:
+        value  = strtol(optarg, &dummy, 10);
+        if ((errno != ERANGE) && (value > 0))
+          options->bench_run_count = value;
+        break;
+
       case 'v':
         options->verbose_level = 1;
         break;
@@ -302,6 +1564,71 @@ int parse_argument(int argc, char **argv, struct options *options)
         }
         break;
 
+      case 'l':
+        if (optarg) {
+          value  = strtol(optarg, &dummy, 10);
+          if ((errno != ERANGE) && (value >= 0))
+            options->chain_max_length = value;
+        }
+        break;
+
+      case 'b':
+        if (optarg) {
+          value  = strtol(optarg, &dummy, 10);
+          if ((errno != ERANGE) && (value >= 0))
+            options->probe_budget = value;
+        }
+        break;
+
+      case 'm':
+        if (optarg) {
+          value  = strtol(optarg, &dummy, 10);
+          if ((errno != ERANGE) && (value >= 0))
+            options->cache_size = value;
+        }
+        break;
+
+      case 'j':
+        if (optarg) {
+          value  = strtol(optarg, &dummy, 10);
+          if ((errno != ERANGE) && (value > 0) && (value <= THREAD_COUNT_MAX))
+            options->thread_count = value;
+        }
+        break;
+
+      case 'u':
+        options->unordered_output = 1;
+        break;
+
+      case 'U':
+        options->socket_path = optarg;
+        break;
+
+      case 'P':
+        value = strtol(optarg, &dummy, 10);
+        if ((dummy == optarg) || (*dummy != '\0') || (value <= 0) || (value > 65535)) {
+          fprintf(stderr, "Option -P needs a port from 1 to 65535. Use -h for help.\n");
+          return 1;
+        }
+        options->port = value;
+        break;
+
+      case 'i':
+        options->stream_stdin = 1;
+        break;
+
+      case 'z':
+        options->binary_output = 1;
+        break;
+
+      case 'J':
+        options->json_output = 1;
+        break;
+
+      case 'r':
+        options->copy_only = 1;
+        break;
+
       case 'x':
         options->print_latex = 1;
         break;
@@ -314,6 +1641,10 @@ int parse_argument(int argc, char **argv, struct options *options)
         options->input_file_name = optarg;
         break;
 
+      case 's':
+        options->store_file_name = optarg;
+        break;
+
       case 'p':
         options->pretty_print = 1;
         break;
@@ -322,19 +1653,40 @@ int parse_argument(int argc, char **argv, struct options *options)
         options->run_builtin_test = 1;
         break;
 
+      case 'c':
+        options->canonical_form = 1;
+        break;
+
       case 'h':
         options->print_help = 1;
         break;
         
       case '?':
-        fprintf(stderr, "Unknown option -%c. Use -h for help.\n", optopt);
+        if (optopt == OPTION_SHARD)
+          fprintf(stderr, "Option --shard without i/N. Use -h for help.\n");
+        else if (optopt == OPTION_RUNS)
+          fprintf(stderr, "Option --runs without count. Use -h for help.\n");
+        else if (optopt == OPTION_TRACE)
+          fprintf(stderr, "Option --trace without filename. Use -h for help.\n");
+        else if (optopt)
+          fprintf(stderr, "Unknown option -%c. Use -h for help.\n", optopt);
+        else
+          fprintf(stderr, "Unknown option %s. Use -h for help.\n", argv[optind - 1]);
         return 1;
 
       case ':':
-        if ((optopt == 'f') || (optopt == 'o')) 
+        if ((optopt == 'f') || (optopt == 'o') || (optopt == 's') || (optopt == 'U')) 
           fprintf(stderr, "Option -%c without filename. Use -h for help.\n", optopt);
         else if (optopt == 'd') 
           fprintf(stderr, "Option -%c without level. Use -h for help.\n", optopt);
+        else if (optopt == 'm') 
+          fprintf(stderr, "Option -%c without size. Use -h for help.\n", optopt);
+        else if (optopt == 'l') 
+          fprintf(stderr, "Option -%c without length. Use -h for help.\n", optopt);
+        else if ((optopt == 'b') || (optopt == 'j')) 
+          fprintf(stderr, "Option -%c without count. Use -h for help.\n", optopt);
+        else if (optopt == 'P') 
+          fprintf(stderr, "Option -%c without port. Use -h for help.\n", optopt);
         return 1;
 
       default:
@@ -347,11 +1699,116 @@ int parse_argument(int argc, char **argv, struct options *options)
     return 1;
   }
 
-  if (options->output_file_name && !options->input_file_name) {
+  if (options->trace_file_name && (TRACE_LEVEL == 0)) {
+    fprintf(stderr, "Option --trace needs a build with tracing (make TRACE_LEVEL=4). Use -h for help.\n");
+    return 1;
+  }
+
+  if (options->trace_file_name && !options->verbose_level) {
+    fprintf(stderr, "Option --trace needs -v or -d <level>. Use -h for help.\n");
+    return 1;
+  }
+
+  if (options->merge_files && (!options->output_file_name || options->input_file_name || (argc <= optind))) {
+    fprintf(stderr, "Option --merge needs -o filename and the files to merge, without -f. Use -h for help.\n");
+    return 1;
+  }
+
+  if (options->bench_mode && ((argc <= optind) || options->input_file_name || options->output_file_name || options->stream_stdin || options->socket_path || options->port)) {
+    fprintf(stderr, "Option --bench needs corpus files as arguments and can't be used with -f, -o, -i, -U or -P. Use -h for help.\n");
+    return 1;
+  }
+
+  if ((options->bench_run_count != BENCH_RUN_COUNT_DEFAULT) && !options->bench_mode) {
+    fprintf(stderr, "Option --runs can't be given without --bench. Use -h for help.\n");
+    return 1;
+  }
+
+  if (options->print_stats && (!options->input_file_name || options->copy_only || options->canonical_form)) {
+    fprintf(stderr, "Option --stats needs -f filename and can't be used with -r or -c. Use -h for help.\n");
+    return 1;
+  }
+
+  if (options->latency && ((!options->input_file_name && !options->socket_path && !options->port) || options->copy_only || options->canonical_form)) {
+    fprintf(stderr, "Option --latency needs -f filename, -U or -P and can't be used with -r or -c. Use -h for help.\n");
+    return 1;
+  }
+
+  if (options->resume && (!options->output_file_name || options->binary_output || options->unordered_output)) {
+    fprintf(stderr, "Option --resume needs -o filename and can't be used with -z or -u. Use -h for help.\n");
+    return 1;
+  }
+
+  if (options->shard_count && !options->input_file_name) {
+    fprintf(stderr, "Option --shard can't be given without -f filename. Use -h for help.\n");
+    return 1;
+  }
+
+  if (options->output_file_name && !options->input_file_name && !options->merge_files) {
     fprintf(stderr, "Option -o filename can't be given without -f filename. Use -h for help.\n");
     return 1;
   }
 
+  if (options->cache_size && !options->input_file_name && !options->socket_path && !options->port) {
+    fprintf(stderr, "Option -m size can't be given without -f filename, -U or -P. Use -h for help.\n");
+    return 1;
+  }
+
+  if (options->store_file_name && !options->input_file_name) {
+    fprintf(stderr, "Option -s filename can't be given without -f filename. Use -h for help.\n");
+    return 1;
+  }
+
+  if (options->binary_output && !options->output_file_name) {
+    fprintf(stderr, "Option -z can't be given without -o filename. Use -h for help.\n");
+    return 1;
+  }
+
+  if (options->json_output && !options->output_file_name) {
+    fprintf(stderr, "Option -J can't be given without -o filename. Use -h for help.\n");
+    return 1;
+  }
+
+  if (options->json_output && (options->binary_output || options->copy_only || options->canonical_form)) {
+    fprintf(stderr, "Option -J can't be used with -z, -r or -c. Use -h for help.\n");
+    return 1;
+  }
+
+  if (options->copy_only && !options->input_file_name) {
+    fprintf(stderr, "Option -r can't be given without -f filename. Use -h for help.\n");
+    return 1;
+  }
+
+  if (options->canonical_form && !options->input_file_name) {
+    fprintf(stderr, "Option -c can't be given without -f filename. Use -h for help.\n");
+    return 1;
+  }
+
+  if ((options->socket_path || options->port) && (options->input_file_name || options->stream_stdin || (argc > optind))) {
+    fprintf(stderr, "Option -U and -P can't be used with -f, -i or file arguments. Use -h for help.\n");
+    return 1;
+  }
+
+  if ((options->socket_path || options->port) && options->verbose_level) {
+    fprintf(stderr, "Option -U and -P can't be used with -v. Use -h for help.\n");
+    return 1;
+  }
+
+  if (((options->thread_count > 1) || options->unordered_output) && !options->input_file_name && !options->socket_path && !options->port) {
+    fprintf(stderr, "Option -j and -u can't be given without -f filename. Use -h for help.\n");
+    return 1;
+  }
+
+  if ((options->thread_count > 1) && options->verbose_level) {
+    fprintf(stderr, "Option -j and -v can't be used together. Use -h for help.\n");
+    return 1;
+  }
+
+  if (options->stream_stdin && (options->input_file_name || (argc > optind))) {
+    fprintf(stderr, "Option -i can't be used with -f or file arguments. Use -h for help.\n");
+    return 1;
+  }
+
   if (options->input_file_name && (argc > optind)) {
     fprintf(stderr, "Option -f can't be used with arguments. Use -h for help.\n");
     return 1;
@@ -366,12 +1823,33 @@ int parse_argument(int argc, char **argv, struct options *options)
     printf("  -v    Verbose\n");
     printf("  -q    Quiet mode\n");
     printf("  -n    No guessing allowed - just use pure logic to solve\n");
+    printf("  -l <length>  Longest chain (in links) to look for before guessing, such as 12, 0 = no chains (default %i)\n", CHAIN_MAX_LENGTH_DEFAULT);
+    printf("  -b <count>  Bivalue cells to probe both ways before guessing, 0 = no probing (default %i)\n", PROBE_BUDGET_DEFAULT);
     printf("  -a    Find all solutions not just the first\n");
+    printf("  -U <path>  Serve requests on a Unix domain socket, one line of puzzles per request\n");
+    printf("  -P <port>  Serve requests on a localhost TCP port\n");
+    printf("  -i    Solve each Sudoku on stdin as it arrives, one per line or 81 cells over several lines\n");
     printf("  -f <filename>  Input file with one Sudoku per line\n");
     printf("  -o <filename>  Output file with one Sudoku per line\n");
+    printf("  -m <size>  Cache solutions of up to <size> kB of puzzles and their symmetric variants (with -f, -U or -P)\n");
+    printf("  -s <filename>  Look up and keep solutions in a persistent solution store (with -f)\n");
+    printf("  -j <count>  Solve puzzles on <count> threads (with -f, -U or -P)\n");
+    printf("  -u    Write solutions in the order they finish instead of input order (with -j)\n");
+    printf("  -z    Write a binary file with packed puzzles and solutions instead of text (with -o)\n");
+    printf("  -J    Write one JSON line per Sudoku with its solution and solve statistics instead of text (with -o)\n");
+    printf("  -r    Copy the puzzles to the output without solving, to convert between text and binary (with -f)\n");
+    printf("  --shard <i/N>  Solve only part i of N (from 0) of the input, for splitting a batch over processes (with -f)\n");
+    printf("  --resume  Go on from the checkpoint of a run that was stopped, checkpoints are kept in <output>.ckpt (with -o)\n");
+    printf("  --stats[=cycles|perf]  Print how often each solving pass ran and what it did, =cycles adds CPU cycles, =perf hardware counters by step (with -f)\n");
+    printf("  --latency[=buckets]  Print solve time percentiles by outcome, looking for a second solution to tell multiple solutions apart, =buckets adds the histograms (with -f, -U or -P)\n");
+    printf("  --bench  Benchmark the corpus files given as arguments, one JSON line of results per file\n");
+    printf("  --runs <count>  Timed runs over each corpus after a warm-up run (with --bench, default %i)\n", BENCH_RUN_COUNT_DEFAULT);
+    printf("  --merge  Join the output files of all the shards given as arguments, in shard order, into one (with -o)\n");
+    printf("  -c    Write the canonical form of each Sudoku instead of solving (with -f)\n");
     printf("  -p    Pretty print Sudoku instead of just numbers\n");
     printf("  -x    Print latex code for Sudoku\n");
     printf("  -d <level>  Turn on debug level\n");
+    printf("  --trace <filename>  Write what the solver does at the debug level to a trace file, print it with sudoku-trace\n");
     printf("  -t    Run built-in tests\n");
     print_legal();
   }
@@ -397,10 +1875,29 @@ int main(int argc, char **argv)
   init();
   status = 0;
 
+  // The trace is closed at exit, after the threads that traced have ended
+  if (options.trace_file_name) {
+    if (open_trace(options.trace_file_name) != 0) {
+      fprintf(stderr, "Cound not open trace file: %s\n", options.trace_file_name);
+      return 1;
+    }
+    atexit(close_trace);
+  }
+
   // If we got an -t then go with that
   if (options.run_builtin_test)
     return run_built_in_tests(&options);
 
+  if (options.merge_files)
+    return run_merge(&options, argc - optind, argv + optind);
+
+  if (options.bench_mode)
+    return run_benchmark_from_options(&options, argc - optind, argv + optind);
+
+  // A server runs until it's stopped
+  if (options.socket_path || options.port)
+    return run_server_from_options(&options);
+
   // If we got an -i then go with that first
   if (options.input_file_name)
     status = run_batch_from_file(&options);
@@ -413,7 +1910,9 @@ int main(int argc, char **argv)
   }
 
   // Still no input, go with stdio
-  if ((file_name == NULL) && (options.input_file_name == NULL))
+  if (options.stream_stdin)
+    status = run_stdio_stream(&options);
+  else if ((file_name == NULL) && (options.input_file_name == NULL))
     status = run_stdio(&options);    
   
   return status;
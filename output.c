@@ -0,0 +1,412 @@
+//
+// sudoku - A SuDoKu solver
+//
+// Copyright (c) 2018  Linde Labs, LLC
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "sudoku.h"
+
+
+// === Asynchronous batch output ===
+//
+// Output is formatted straight into one of a few large buffers. A full buffer is handed to the
+// kernel as a single io_uring write of a registered (fixed) buffer at its file offset, and the
+// next buffer is filled while it's being written - the writer only waits when every buffer is
+// in flight. io_uring is used through the raw system calls. Where it isn't available (old
+// kernels, seccomp filters, pipes and terminals) the buffers are written with plain write().
+
+
+// Struct & types
+
+struct sudoku_uring {
+  int fd;
+  unsigned int *sq_head;
+  unsigned int *sq_tail;
+  unsigned int *sq_mask;
+  unsigned int *sq_array;
+  unsigned int *cq_head;
+  unsigned int *cq_tail;
+  unsigned int *cq_mask;
+  struct io_uring_sqe *sqes;
+  struct io_uring_cqe *cqes;
+  void *sq_map;
+  void *cq_map;
+  size_t sq_map_size;
+  size_t cq_map_size;
+  size_t sqes_size;
+};
+
+
+// Functions
+
+static
+void destroy_uring(struct sudoku_uring **ring)
+{
+  if (*ring) {
+    if ((*ring)->sqes)
+      munmap((*ring)->sqes, (*ring)->sqes_size);
+    if ((*ring)->cq_map && ((*ring)->cq_map != (*ring)->sq_map))
+      munmap((*ring)->cq_map, (*ring)->cq_map_size);
+    if ((*ring)->sq_map)
+      munmap((*ring)->sq_map, (*ring)->sq_map_size);
+    close((*ring)->fd);
+    free(*ring);
+    *ring = NULL;
+  }
+}
+
+
+// Returns NULL if io_uring isn't there - the caller falls back to write()
+static
+struct sudoku_uring* create_uring(unsigned int entries, char *buffers, size_t buffer_size, unsigned int buffer_count)
+{
+  struct sudoku_uring *ring;
+  struct io_uring_params params;
+  struct iovec iovecs[OUTPUT_BUFFER_COUNT];
+  unsigned char *sq, *cq;
+  unsigned int i;
+  int fd;
+
+  memset(&params, 0, sizeof(params));
+  fd = syscall(__NR_io_uring_setup, entries, &params);
+  if (fd < 0)
+    return NULL;
+
+  ring = (struct sudoku_uring*) calloc(1, sizeof(struct sudoku_uring));
+  if (!ring) {
+    close(fd);
+    return NULL;
+  }
+  ring->fd = fd;
+
+  ring->sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+  ring->cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    if (ring->cq_map_size > ring->sq_map_size)
+      ring->sq_map_size = ring->cq_map_size;
+    ring->cq_map_size = ring->sq_map_size;
+  }
+
+  ring->sq_map = mmap(NULL, ring->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  if (ring->sq_map == MAP_FAILED) {
+    ring->sq_map = NULL;
+    destroy_uring(&ring);
+    return NULL;
+  }
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    ring->cq_map = ring->sq_map;
+  } else {
+    ring->cq_map = mmap(NULL, ring->cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    if (ring->cq_map == MAP_FAILED) {
+      ring->cq_map = NULL;
+      destroy_uring(&ring);
+      return NULL;
+    }
+  }
+  ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sqes = (struct io_uring_sqe*) mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+  if (ring->sqes == MAP_FAILED) {
+    ring->sqes = NULL;
+    destroy_uring(&ring);
+    return NULL;
+  }
+
+  sq = (unsigned char*) ring->sq_map;
+  cq = (unsigned char*) ring->cq_map;
+  ring->sq_head = (unsigned int*) (sq + params.sq_off.head);
+  ring->sq_tail = (unsigned int*) (sq + params.sq_off.tail);
+  ring->sq_mask = (unsigned int*) (sq + params.sq_off.ring_mask);
+  ring->sq_array = (unsigned int*) (sq + params.sq_off.array);
+  ring->cq_head = (unsigned int*) (cq + params.cq_off.head);
+  ring->cq_tail = (unsigned int*) (cq + params.cq_off.tail);
+  ring->cq_mask = (unsigned int*) (cq + params.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe*) (cq + params.cq_off.cqes);
+
+  // Registered buffers are pinned once instead of mapped for every write
+  assert(buffer_count <= OUTPUT_BUFFER_COUNT);
+  for (i=0; i<buffer_count; i++) {
+    iovecs[i].iov_base = buffers + i * buffer_size;
+    iovecs[i].iov_len = buffer_size;
+  }
+  if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_BUFFERS, iovecs, buffer_count) != 0) {
+    destroy_uring(&ring);
+    return NULL;
+  }
+
+  return ring;
+}
+
+
+static
+int uring_submit_write(struct sudoku_uring *ring, int fd, unsigned int buffer_index, const char *data, size_t length, unsigned long offset)
+{
+  struct io_uring_sqe *sqe;
+  unsigned int tail, index;
+
+  tail = *ring->sq_tail;
+  index = tail & *ring->sq_mask;
+  sqe = &ring->sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = IORING_OP_WRITE_FIXED;
+  sqe->fd = fd;
+  sqe->addr = (unsigned long) data;
+  sqe->len = length;
+  sqe->off = offset;
+  sqe->buf_index = buffer_index;
+  sqe->user_data = buffer_index;
+  ring->sq_array[index] = index;
+
+  // The kernel must see the entry before the new tail
+  __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+  while (syscall(__NR_io_uring_enter, ring->fd, 1, 0, 0, NULL, 0) < 0) {
+    if (errno != EINTR)
+      return -1;
+  }
+  return 0;
+}
+
+
+// Waits for the next finished write, returns its buffer index and result
+static
+int uring_wait(struct sudoku_uring *ring, unsigned int *buffer_index, int *result)
+{
+  struct io_uring_cqe *cqe;
+  unsigned int head;
+
+  head = *ring->cq_head;
+  while (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+    if ((syscall(__NR_io_uring_enter, ring->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0) && (errno != EINTR))
+      return -1;
+  }
+
+  cqe = &ring->cqes[head & *ring->cq_mask];
+  *buffer_index = cqe->user_data;
+  *result = cqe->res;
+  __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+
+  return 0;
+}
+
+
+// Writes all of data at offset, or where the file is if offset < 0
+static
+int write_all(int fd, const char *data, size_t length, long offset)
+{
+  ssize_t written;
+
+  while (length) {
+    if (offset < 0)
+      written = write(fd, data, length);
+    else
+      written = pwrite(fd, data, length, offset);
+    if (written < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    data += written;
+    length -= written;
+    if (offset >= 0)
+      offset += written;
+  }
+  return 0;
+}
+
+
+// Reaps one finished write and frees its buffer
+static
+void output_reap(struct sudoku_output *output)
+{
+  unsigned int buffer_index;
+  int result;
+
+  if (uring_wait(output->ring, &buffer_index, &result) != 0) {
+    output->status = -1;
+    output->in_flight_count = 0; // Nothing more will come back
+    memset(output->in_flight, 0, sizeof(output->in_flight));
+    return;
+  }
+
+  assert(buffer_index < OUTPUT_BUFFER_COUNT);
+  assert(output->in_flight[buffer_index]);
+  if (result < 0) {
+    output->status = -1;
+  } else if ((size_t)result < output->lengths[buffer_index]) {
+    // Short write - finish it the plain way
+    if (write_all(output->fd, output->buffers + buffer_index * OUTPUT_BUFFER_SIZE + result,
+                  output->lengths[buffer_index] - result, output->offsets[buffer_index] + result) != 0)
+      output->status = -1;
+  }
+  output->in_flight[buffer_index] = 0;
+  output->in_flight_count--;
+}
+
+
+// Sends the current buffer off and moves on to a free one
+static
+void output_submit(struct sudoku_output *output)
+{
+  int i, current;
+
+  current = output->current;
+  if (output->used == 0)
+    return;
+
+  if (!output->ring) {
+    if (write_all(output->fd, output->buffers, output->used, -1) != 0)
+      output->status = -1;
+    output->offset += output->used; // Checkpoints resume from it
+    output->used = 0;
+    return;
+  }
+
+  output->lengths[current] = output->used;
+  output->offsets[current] = output->offset;
+  if (uring_submit_write(output->ring, output->fd, current, output->buffers + current * OUTPUT_BUFFER_SIZE, output->used, output->offset) == 0) {
+    output->in_flight[current] = 1;
+    output->in_flight_count++;
+  } else if (write_all(output->fd, output->buffers + current * OUTPUT_BUFFER_SIZE, output->used, output->offset) != 0) {
+    output->status = -1;
+  }
+  output->offset += output->used;
+  output->used = 0;
+
+  // Wait only if all the buffers are being written
+  if (output->in_flight_count == OUTPUT_BUFFER_COUNT)
+    output_reap(output);
+  for (i=1; i<=OUTPUT_BUFFER_COUNT; i++) {
+    if (!output->in_flight[(current + i) % OUTPUT_BUFFER_COUNT]) {
+      output->current = (current + i) % OUTPUT_BUFFER_COUNT;
+      break;
+    }
+  }
+  assert(!output->in_flight[output->current]);
+}
+
+
+// Starts writing at offset, anything after it is cut off - offset 0 is a new file
+struct sudoku_output* create_output(const char *file_name, unsigned long offset)
+{
+  struct sudoku_output *output;
+  struct stat st;
+
+  output = (struct sudoku_output*) calloc(1, sizeof(struct sudoku_output));
+  if (!output)
+    return NULL;
+
+  output->fd = open(file_name, O_WRONLY | O_CREAT | (offset ? 0 : O_TRUNC), 0644);
+  if (output->fd < 0) {
+    free(output);
+    return NULL;
+  }
+  if (offset && ((ftruncate(output->fd, offset) != 0) || (lseek(output->fd, offset, SEEK_SET) < 0))) {
+    close(output->fd);
+    free(output);
+    return NULL;
+  }
+  output->offset = offset;
+
+  output->buffers = (char*) mmap(NULL, OUTPUT_BUFFER_COUNT * OUTPUT_BUFFER_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (output->buffers == MAP_FAILED) {
+    close(output->fd);
+    free(output);
+    return NULL;
+  }
+
+  // Writes at offsets only work on regular files
+  if ((fstat(output->fd, &st) == 0) && S_ISREG(st.st_mode))
+    output->ring = create_uring(OUTPUT_BUFFER_COUNT, output->buffers, OUTPUT_BUFFER_SIZE, OUTPUT_BUFFER_COUNT);
+
+  return output;
+}
+
+
+// Writes with plain write() from now on, as without io_uring - call before writing anything
+void use_plain_writes(struct sudoku_output *output)
+{
+  assert((output->used == 0) && (output->in_flight_count == 0));
+  destroy_uring(&output->ring);
+}
+
+
+// Returns room for at least size more bytes, to be taken with commit_output()
+char* get_output_space(struct sudoku_output *output, size_t size)
+{
+  assert(size <= OUTPUT_BUFFER_SIZE);
+
+  if (output->used + size > OUTPUT_BUFFER_SIZE)
+    output_submit(output);
+
+  return output->buffers + output->current * OUTPUT_BUFFER_SIZE + output->used;
+}
+
+
+void commit_output(struct sudoku_output *output, size_t length)
+{
+  assert(output->used + length <= OUTPUT_BUFFER_SIZE);
+  output->used += length;
+}
+
+
+// Writes everything so far and waits until it's on disk, returns -1 if anything couldn't be written
+int sync_output(struct sudoku_output *output)
+{
+  output_submit(output);
+  while (output->in_flight_count)
+    output_reap(output);
+
+  // Pipes and terminals can't be synced, and don't need to be
+  if ((fdatasync(output->fd) != 0) && (errno != EINVAL))
+    output->status = -1;
+
+  return output->status;
+}
+
+
+// Writes what's left and waits for it, returns -1 if anything couldn't be written
+int close_output(struct sudoku_output **output)
+{
+  int status;
+
+  if (!*output)
+    return 0;
+
+  output_submit(*output);
+  while ((*output)->in_flight_count)
+    output_reap(*output);
+
+  status = (*output)->status;
+  if (close((*output)->fd) != 0)
+    status = -1;
+  destroy_uring(&(*output)->ring);
+  munmap((*output)->buffers, OUTPUT_BUFFER_COUNT * OUTPUT_BUFFER_SIZE);
+  free(*output);
+  *output = NULL;
+
+  return status;
+}
@@ -0,0 +1,215 @@
+//
+// sudoku - A SuDoKu solver
+//
+// Copyright (c) 2018  Linde Labs, LLC
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "sudoku.h"
+
+
+// === Hardware performance counters ===
+//
+// Each thread that reads the counters gets its own perf_event_open() group, counting that
+// thread in user space only, with cycles as the group leader. The whole group is read with one
+// read() call, along with the times it was enabled and running. When other events share the
+// PMU the kernel multiplexes them and the group only counts part of the time, so the counts
+// between two reads are scaled up by how long it ran. Events the CPU or kernel doesn't have
+// are left out of the group and read as 0; if not even cycles can be counted (no PMU,
+// perf_event_paranoid, seccomp) there are no counters at all and read_perf_counters() says so.
+
+
+// Struct & types
+
+struct sudoku_perf_group {
+  int fds[PERF_EVENT_COUNT];
+  int events[PERF_EVENT_COUNT]; // Which event each value read is, in group order
+  int count;
+};
+
+
+// Functions
+
+static pthread_key_t perf_key;
+static pthread_once_t perf_key_once = PTHREAD_ONCE_INIT;
+static unsigned int perf_event_mask; // Events counted on any thread
+static _Thread_local struct sudoku_perf_group *perf_group;
+static _Thread_local int perf_failed;
+
+
+static
+void destroy_perf_group(void *data)
+{
+  struct sudoku_perf_group *group = (struct sudoku_perf_group*) data;
+  int i;
+
+  for (i=0; i<group->count; i++)
+    close(group->fds[i]);
+  free(group);
+}
+
+
+static
+void create_perf_key()
+{
+  pthread_key_create(&perf_key, destroy_perf_group);
+}
+
+
+static
+int open_perf_event(enum sudoku_perf_event event, int group_fd)
+{
+  struct perf_event_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+  attr.disabled = (group_fd < 0); // The leader starts the whole group
+
+  switch (event) {
+    case PERF_CYCLES:
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = PERF_COUNT_HW_CPU_CYCLES;
+      break;
+    case PERF_INSTRUCTIONS:
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+      break;
+    case PERF_BRANCH_MISSES:
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+      break;
+    case PERF_L1D_MISSES:
+      attr.type = PERF_TYPE_HW_CACHE;
+      attr.config = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+      break;
+    case PERF_LLC_MISSES:
+      attr.type = PERF_TYPE_HW_CACHE;
+      attr.config = PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+      break;
+    default:
+      return -1;
+  }
+
+  return syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+
+static
+struct sudoku_perf_group* open_perf_group()
+{
+  struct sudoku_perf_group *group;
+  int event, fd;
+
+  group = (struct sudoku_perf_group*) malloc(sizeof(struct sudoku_perf_group));
+  if (!group)
+    return NULL;
+
+  group->count = 0;
+  for (event=0; event<PERF_EVENT_COUNT; event++) {
+    fd = open_perf_event(event, (group->count ? group->fds[0] : -1));
+    if (fd < 0) {
+      if (event == PERF_CYCLES)
+        break; // No leader, no group
+      continue;
+    }
+    group->fds[group->count] = fd;
+    group->events[group->count] = event;
+    group->count++;
+  }
+
+  if ((group->count == 0) || (ioctl(group->fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP) != 0)) {
+    destroy_perf_group(group);
+    return NULL;
+  }
+
+  for (event=0; event<group->count; event++)
+    __atomic_or_fetch(&perf_event_mask, 1 << group->events[event], __ATOMIC_RELAXED);
+
+  pthread_once(&perf_key_once, create_perf_key);
+  pthread_setspecific(perf_key, group);
+
+  return group;
+}
+
+
+// Reads this thread's counters, returns -1 if there are none
+int read_perf_counters(struct sudoku_perf_sample *sample)
+{
+  unsigned long data[3 + PERF_EVENT_COUNT]; // Number of values, time enabled, time running, then the values
+  int i;
+
+  if (perf_failed)
+    return -1;
+
+  if (!perf_group) {
+    perf_group = open_perf_group();
+    if (!perf_group) {
+      perf_failed = 1;
+      return -1;
+    }
+  }
+
+  if (read(perf_group->fds[0], data, sizeof(data)) < (ssize_t)((3 + perf_group->count) * sizeof(unsigned long)))
+    return -1;
+
+  sample->time_enabled = data[1];
+  sample->time_running = data[2];
+  memset(sample->values, 0, sizeof(sample->values));
+  for (i=0; i<perf_group->count; i++)
+    sample->values[perf_group->events[i]] = data[3 + i];
+
+  return 0;
+}
+
+
+// Adds the counts between two reads to totals, scaled up if the group was multiplexed in
+// between. Returns 1 if it was, the totals are estimates then.
+int add_perf_counts(unsigned long totals[PERF_EVENT_COUNT], const struct sudoku_perf_sample *start, const struct sudoku_perf_sample *end)
+{
+  unsigned long enabled, running;
+  int i;
+
+  enabled = end->time_enabled - start->time_enabled;
+  running = end->time_running - start->time_running;
+
+  if (running == enabled) {
+    for (i=0; i<PERF_EVENT_COUNT; i++)
+      totals[i] += end->values[i] - start->values[i];
+    return 0;
+  }
+
+  // Not counting at all in between leaves nothing to scale
+  if (running > 0) {
+    for (i=0; i<PERF_EVENT_COUNT; i++)
+      totals[i] += (unsigned long) ((double) (end->values[i] - start->values[i]) * enabled / running);
+  }
+  return 1;
+}
+
+
+// Bit (1 << event) is set for the events counted on at least one thread
+unsigned int get_perf_event_mask()
+{
+  return __atomic_load_n(&perf_event_mask, __ATOMIC_RELAXED);
+}
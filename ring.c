@@ -0,0 +1,244 @@
+//
+// sudoku - A SuDoKu solver
+//
+// Copyright (c) 2018  Linde Labs, LLC
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "sudoku.h"
+
+
+// === Bounded lock-free ring buffer ===
+//
+// A multi-producer multi-consumer queue of pointers (also fine with a single producer or
+// consumer). Each slot has a sequence number that tells whether it is ready to be written or
+// read for the current lap around the ring, so producers and consumers only ever contend on
+// the position counters. The _wait() variants spin a little and then sleep on a futex until
+// they can go ahead, which is what gives a pipeline its backpressure. Each push and pop bumps
+// an event counter to wait on, and only wakes someone if a waiter has said it's there.
+
+
+// Defines
+
+#define RING_SPIN_COUNT 128 // Tries before going to sleep
+
+
+// Struct & types
+
+struct sudoku_ring_slot {
+  unsigned long sequence;
+  void *data;
+};
+
+
+// Functions
+
+struct sudoku_ring* create_ring(unsigned long capacity)
+{
+  struct sudoku_ring *ring;
+  unsigned long i, size;
+
+  size = 1;
+  while (size < capacity)
+    size <<= 1;
+
+  ring = (struct sudoku_ring*) calloc(1, sizeof(struct sudoku_ring));
+  if (!ring)
+    return NULL;
+
+  ring->slots = (struct sudoku_ring_slot*) malloc(size * sizeof(struct sudoku_ring_slot));
+  if (!ring->slots) {
+    free(ring);
+    return NULL;
+  }
+
+  for (i=0; i<size; i++)
+    ring->slots[i].sequence = i;
+  ring->mask = size - 1;
+
+  return ring;
+}
+
+
+void destroy_ring(struct sudoku_ring **ring)
+{
+  if (*ring) {
+    free((*ring)->slots);
+    free(*ring);
+    *ring = NULL;
+  }
+}
+
+
+static inline
+void ring_cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#endif
+}
+
+
+// Sleeps until *event is no longer event (or a spurious wakeup)
+static inline
+void ring_futex_wait(unsigned int *event_ref, unsigned int event)
+{
+  syscall(SYS_futex, event_ref, FUTEX_WAIT_PRIVATE, event, NULL, NULL, 0);
+}
+
+
+static inline
+void ring_signal(unsigned int *event_ref, unsigned int *waiters_ref)
+{
+  // Sequentially consistent with the waiter's count and check, so either it sees the change or we see it
+  __atomic_add_fetch(event_ref, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(waiters_ref, __ATOMIC_SEQ_CST))
+    syscall(SYS_futex, event_ref, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+
+// Returns 0 if the ring is full
+int ring_push(struct sudoku_ring *ring, void *data)
+{
+  struct sudoku_ring_slot *slot;
+  unsigned long position, sequence, depth;
+  long diff;
+
+  position = __atomic_load_n(&ring->push_position, __ATOMIC_RELAXED);
+  for (;;) {
+    slot = &ring->slots[position & ring->mask];
+    sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+    diff = (long)sequence - (long)position;
+    if (diff == 0) {
+      if (__atomic_compare_exchange_n(&ring->push_position, &position, position + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        break;
+    } else if (diff < 0) {
+      return 0; // Slot still holds last lap's data
+    } else {
+      position = __atomic_load_n(&ring->push_position, __ATOMIC_RELAXED);
+    }
+  }
+
+  slot->data = data;
+  __atomic_store_n(&slot->sequence, position + 1, __ATOMIC_RELEASE);
+
+  // Queue depth seen by this push, for the metrics
+  depth = position + 1 - __atomic_load_n(&ring->pop_position, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&ring->push_count, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&ring->depth_sum, depth, __ATOMIC_RELAXED);
+  if (depth > __atomic_load_n(&ring->depth_max, __ATOMIC_RELAXED))
+    __atomic_store_n(&ring->depth_max, depth, __ATOMIC_RELAXED); // Racy, but only a metric
+
+  ring_signal(&ring->push_event, &ring->pop_waiters);
+
+  return 1;
+}
+
+
+// Returns NULL if the ring is empty
+void* ring_pop(struct sudoku_ring *ring)
+{
+  struct sudoku_ring_slot *slot;
+  unsigned long position, sequence;
+  long diff;
+  void *data;
+
+  position = __atomic_load_n(&ring->pop_position, __ATOMIC_RELAXED);
+  for (;;) {
+    slot = &ring->slots[position & ring->mask];
+    sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+    diff = (long)sequence - (long)(position + 1);
+    if (diff == 0) {
+      if (__atomic_compare_exchange_n(&ring->pop_position, &position, position + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        break;
+    } else if (diff < 0) {
+      return NULL; // Nothing pushed here yet
+    } else {
+      position = __atomic_load_n(&ring->pop_position, __ATOMIC_RELAXED);
+    }
+  }
+
+  data = slot->data;
+  __atomic_store_n(&slot->sequence, position + ring->mask + 1, __ATOMIC_RELEASE);
+
+  ring_signal(&ring->pop_event, &ring->push_waiters);
+
+  return data;
+}
+
+
+void ring_push_wait(struct sudoku_ring *ring, void *data)
+{
+  unsigned int event;
+  int i;
+
+  if (ring_push(ring, data))
+    return;
+
+  __atomic_add_fetch(&ring->full_waits, 1, __ATOMIC_RELAXED);
+  for (i=0; i<RING_SPIN_COUNT; i++) {
+    ring_cpu_relax();
+    if (ring_push(ring, data))
+      return;
+  }
+
+  // Say we're waiting before looking again, a pop after that will wake us
+  __atomic_add_fetch(&ring->push_waiters, 1, __ATOMIC_SEQ_CST);
+  for (;;) {
+    event = __atomic_load_n(&ring->pop_event, __ATOMIC_SEQ_CST);
+    if (ring_push(ring, data))
+      break;
+    ring_futex_wait(&ring->pop_event, event);
+  }
+  __atomic_sub_fetch(&ring->push_waiters, 1, __ATOMIC_RELAXED);
+}
+
+
+void* ring_pop_wait(struct sudoku_ring *ring)
+{
+  unsigned int event;
+  void *data;
+  int i;
+
+  data = ring_pop(ring);
+  if (data)
+    return data;
+
+  __atomic_add_fetch(&ring->empty_waits, 1, __ATOMIC_RELAXED);
+  for (i=0; i<RING_SPIN_COUNT; i++) {
+    ring_cpu_relax();
+    data = ring_pop(ring);
+    if (data)
+      return data;
+  }
+
+  __atomic_add_fetch(&ring->pop_waiters, 1, __ATOMIC_SEQ_CST);
+  for (;;) {
+    event = __atomic_load_n(&ring->push_event, __ATOMIC_SEQ_CST);
+    data = ring_pop(ring);
+    if (data)
+      break;
+    ring_futex_wait(&ring->push_event, event);
+  }
+  __atomic_sub_fetch(&ring->pop_waiters, 1, __ATOMIC_RELAXED);
+
+  return data;
+}
@@ -0,0 +1,797 @@
+//
+// sudoku - A SuDoKu solver
+//
+// Copyright (c) 2018  Linde Labs, LLC
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "sudoku.h"
+
+
+// === Solver daemon ===
+//
+// Listens on a Unix domain socket and/or a localhost TCP port. One I/O thread polls the
+// listening sockets and all connections, splits the request frames into puzzles and hands them
+// to a pool of solver threads through a ring. The solvers mark their task done and wake the I/O
+// thread, which writes the responses of each connection in request order. An idle connection
+// costs nothing but its buffers, and the puzzles of one frame are solved in parallel.
+//
+// The protocol is line based. A request frame is one line with one or more puzzles separated
+// by spaces, tabs or commas, each puzzle 81 chars of [0-9.]. The response has one line per
+// puzzle, in order, with a status code and the board:
+//   200 <solution>    Solved
+//   422 <board>       No solution found, the board as far as it got
+//   400 -             Not a puzzle, or clashing givens
+// Clients may send any number of frames without waiting for the responses. Empty lines and
+// lines starting with '#' get no response. A client that doesn't read its responses is not
+// read from once it has SERVER_CONNECTION_TASKS puzzles waiting.
+//
+// With a cache (-m) the solvers share one, so symmetric variants of a puzzle asked for by any
+// client are only solved once. With latency histograms on, each solver records the solve times
+// in its own histograms, which are added up and printed when the server is stopped. The solvers
+// then look for a second solution, so puzzles with more than one are counted as such.
+
+
+// Defines
+
+#define SERVER_STATUS_SOLVED     200
+#define SERVER_STATUS_BAD_INPUT  400
+#define SERVER_STATUS_UNSOLVED   422
+#define SERVER_LISTEN_BACKLOG    128
+#define SERVER_INPUT_SIZE        (64*1024) // Longest request line
+#define SERVER_OUTPUT_SIZE       (64*1024)
+#define SERVER_RESPONSE_SIZE     (4 + BOARD_LINE_SIZE) // "200 " and the board
+#define SERVER_TASK_COUNT        4096      // Puzzles being solved or waiting to be written, all connections
+#define SERVER_CONNECTION_TASKS  256       // Per connection, so one client can't take them all
+#define SERVER_CONNECTION_MAX    1024
+
+
+// Struct & types
+
+struct server_connection;
+
+struct server_task {
+  struct server_connection *connection;
+  struct server_task *next;  // In the connection's queue, or the free list
+  int done;                  // Set by the solver when the response is ready
+  int response_length;
+  char puzzle[81];
+  char response[SERVER_RESPONSE_SIZE];
+};
+
+struct server_connection {
+  int fd;
+  int closing;               // Client hung up, close once its responses are out
+  int broken;                // Can't write to it any more, drop its responses
+  int skip_line;             // Rest of a too long frame is skipped
+  int mid_frame;             // Some puzzles of the frame at input_start have been taken
+  char input[SERVER_INPUT_SIZE];
+  size_t input_start;        // Not parsed yet from here
+  size_t input_used;
+  char output[SERVER_OUTPUT_SIZE];
+  size_t output_start;       // Not written yet from here
+  size_t output_used;
+  struct server_task *queue_head; // Tasks in request order
+  struct server_task *queue_tail;
+  int task_count;
+};
+
+struct server_context {
+  const struct sudoku_server_options *options;
+  struct pollfd listen_fds[2];
+  int listen_count;
+  struct server_connection *connections[SERVER_CONNECTION_MAX];
+  int connection_count;
+  struct server_task *tasks;
+  struct server_task *free_tasks;   // Only touched by the I/O thread
+  struct sudoku_ring *request_ring; // Tasks for the solvers
+  int event_fd;                     // Solvers wake the I/O thread through it
+  int wakeup_pending;
+  int stopping;
+  struct sudoku_cache *cache;       // NULL = no cache
+  pthread_mutex_t cache_lock;
+  struct sudoku_histogram *latency; // OUTCOME_COUNT per solver, NULL = no histograms
+  int worker_count;
+};
+
+
+// Functions
+
+// Pushed once for each solver to make it stop
+static struct server_task server_stop_task;
+
+
+static
+void wake_server_io(struct server_context *context)
+{
+  unsigned long one = 1;
+
+  // One wakeup covers all tasks done until the I/O thread looks again
+  if (!__atomic_exchange_n(&context->wakeup_pending, 1, __ATOMIC_SEQ_CST)) {
+    if (write(context->event_fd, &one, sizeof(one)) < 0)
+      perror("eventfd");
+  }
+}
+
+
+static
+int solve_server_puzzle(struct server_context *context, struct sudoku_histogram *latency, const char *puzzle, char *response)
+{
+  const struct sudoku_server_options *options = context->options;
+  struct sudoku_board *board;
+  struct sudoku_transform transform;
+  struct timespec start_time, end_time;
+  unsigned char grid[81], canon_grid[81], canon_solution[81];
+  unsigned int cached_solutions_count;
+  int status, solutions_count, cache_hit;
+
+  if (latency)
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+
+  board = create_board();
+  if (read_board_length(board, puzzle, 81) != 0) {
+    destroy_board(&board);
+    memcpy(response, "400 -\n", 6);
+    return 6;
+  }
+
+  board->guessing_allowed = options->guessing_allowed;
+  board->chain_max_length = options->chain_max_length;
+  board->probe_budget = options->probe_budget;
+  if (latency)
+    board->solutions_max = 2; // So puzzles with more than one solution are told apart
+
+  // Symmetric variants of a puzzle share the same canonical form and cache entry
+  cache_hit = 0;
+  if (context->cache) {
+    canonicalize_board(board, canon_grid, &transform);
+    pthread_mutex_lock(&context->cache_lock);
+    cache_hit = cache_lookup(context->cache, canon_grid, board->guessing_allowed, canon_solution, &cached_solutions_count);
+    pthread_mutex_unlock(&context->cache_lock);
+    if (cache_hit) {
+      untransform_grid(&transform, canon_solution, grid);
+      read_board_grid(board, grid);
+    }
+  }
+
+  if (cache_hit) {
+    solutions_count = cached_solutions_count;
+  } else {
+    solutions_count = solve(board);
+    // Only solved boards are kept - a partial board depends on the order the logic ran in
+    if (context->cache && (board->undetermined_count == 0)) {
+      board_to_grid(board, grid);
+      transform_grid(&transform, grid, canon_solution);
+      pthread_mutex_lock(&context->cache_lock);
+      cache_insert(context->cache, canon_grid, board->guessing_allowed, canon_solution, solutions_count);
+      pthread_mutex_unlock(&context->cache_lock);
+    }
+  }
+  status = (solutions_count ? SERVER_STATUS_SOLVED : SERVER_STATUS_UNSOLVED);
+
+  sprintf(response, "%3i ", status);
+  format_board_line(board, response + 4);
+  destroy_board(&board);
+
+  if (latency) {
+    clock_gettime(CLOCK_MONOTONIC, &end_time);
+    record_histogram(&latency[get_outcome(solutions_count)],
+                     (end_time.tv_sec - start_time.tv_sec) * 1000000000UL + end_time.tv_nsec - start_time.tv_nsec);
+  }
+
+  return SERVER_RESPONSE_SIZE;
+}
+
+
+static
+void* server_worker(void *arg)
+{
+  struct server_context *context = (struct server_context*) arg;
+  struct sudoku_histogram *latency;
+  struct server_task *task;
+
+  latency = NULL;
+  if (context->latency)
+    latency = context->latency + OUTCOME_COUNT * __atomic_fetch_add(&context->worker_count, 1, __ATOMIC_RELAXED);
+
+  for (;;) {
+    task = (struct server_task*) ring_pop_wait(context->request_ring);
+    if (task == &server_stop_task)
+      break;
+
+    // Once stopping the responses go nowhere, so don't bother solving
+    if (!__atomic_load_n(&context->stopping, __ATOMIC_RELAXED))
+      task->response_length = solve_server_puzzle(context, latency, task->puzzle, task->response);
+    __atomic_store_n(&task->done, 1, __ATOMIC_RELEASE);
+    wake_server_io(context);
+  }
+
+  release_board_pool();
+  return NULL;
+}
+
+
+// Queues a task for the next puzzle of a connection, to be solved or with a bad input response
+static
+void add_server_task(struct server_context *context, struct server_connection *connection, const char *puzzle, size_t length)
+{
+  struct server_task *task;
+  size_t i;
+  int valid;
+
+  task = context->free_tasks;
+  context->free_tasks = task->next;
+  task->connection = connection;
+  task->next = NULL;
+  task->done = 0;
+
+  // Exactly 81 cells, nothing else
+  valid = (length == 81);
+  for (i=0; valid && (i<81); i++)
+    valid = ((puzzle[i] == '.') || ((puzzle[i] >= '0') && (puzzle[i] <= '9')));
+
+  if (connection->queue_tail)
+    connection->queue_tail->next = task;
+  else
+    connection->queue_head = task;
+  connection->queue_tail = task;
+  connection->task_count++;
+
+  if (valid) {
+    memcpy(task->puzzle, puzzle, 81);
+    ring_push_wait(context->request_ring, task); // Never full, the ring has room for all tasks
+  } else {
+    memcpy(task->response, "400 -\n", 6);
+    task->response_length = 6;
+    task->done = 1;
+  }
+}
+
+
+static inline
+int is_server_separator(char ch)
+{
+  return ((ch == ' ') || (ch == '\t') || (ch == ',') || (ch == '\r'));
+}
+
+
+static inline
+int can_take_task(struct server_context *context, struct server_connection *connection)
+{
+  return (context->free_tasks && (connection->task_count < SERVER_CONNECTION_TASKS));
+}
+
+
+// Turns as many whole frames of the input into tasks as there are tasks for
+static
+void parse_connection_input(struct server_context *context, struct server_connection *connection)
+{
+  char *input, *newline;
+  size_t start, end, line_end;
+
+  input = connection->input;
+  start = connection->input_start;
+
+  while (!connection->broken && can_take_task(context, connection)) {
+    newline = memchr(input + start, '\n', connection->input_used - start);
+    if (!newline)
+      break;
+    line_end = newline - input;
+
+    if (connection->skip_line || (!connection->mid_frame && ((start == line_end) || (input[start] == '#')))) {
+      connection->skip_line = 0;
+      start = line_end + 1;
+      continue;
+    }
+
+    // Skip separators, then find the end of the puzzle
+    while ((start < line_end) && is_server_separator(input[start]))
+      start++;
+    if (start == line_end) {
+      connection->mid_frame = 0;
+      start = line_end + 1;
+      continue;
+    }
+    end = start;
+    while ((end < line_end) && !is_server_separator(input[end]))
+      end++;
+
+    add_server_task(context, connection, input + start, end - start);
+    connection->mid_frame = 1;
+    start = end;
+  }
+
+  // A frame longer than the buffer gets one bad input response and is skipped
+  if ((start == 0) && (connection->input_used == SERVER_INPUT_SIZE) && !connection->skip_line &&
+      !memchr(input, '\n', SERVER_INPUT_SIZE) && can_take_task(context, connection)) {
+    add_server_task(context, connection, "", 0);
+    connection->skip_line = 1;
+    start = SERVER_INPUT_SIZE;
+  }
+  if (connection->skip_line && !memchr(input + start, '\n', connection->input_used - start))
+    start = connection->input_used;
+
+  memmove(input, input + start, connection->input_used - start);
+  connection->input_used -= start;
+  connection->input_start = 0;
+}
+
+
+// Moves the responses that are ready, in order, to the output and frees their tasks
+static
+void collect_connection_responses(struct server_context *context, struct server_connection *connection)
+{
+  struct server_task *task;
+
+  while ((task = connection->queue_head) && __atomic_load_n(&task->done, __ATOMIC_ACQUIRE)) {
+    if (!connection->broken) {
+      if (connection->output_used + task->response_length > SERVER_OUTPUT_SIZE) {
+        memmove(connection->output, connection->output + connection->output_start,
+                connection->output_used - connection->output_start);
+        connection->output_used -= connection->output_start;
+        connection->output_start = 0;
+        if (connection->output_used + task->response_length > SERVER_OUTPUT_SIZE)
+          break; // Wait for the client to read some
+      }
+      memcpy(connection->output + connection->output_used, task->response, task->response_length);
+      connection->output_used += task->response_length;
+    }
+
+    connection->queue_head = task->next;
+    if (!connection->queue_head)
+      connection->queue_tail = NULL;
+    connection->task_count--;
+    task->next = context->free_tasks;
+    context->free_tasks = task;
+  }
+}
+
+
+static
+void write_connection_output(struct server_connection *connection)
+{
+  ssize_t written;
+
+  while (!connection->broken && (connection->output_start < connection->output_used)) {
+    written = write(connection->fd, connection->output + connection->output_start,
+                    connection->output_used - connection->output_start);
+    if (written < 0) {
+      if (errno == EINTR)
+        continue;
+      if ((errno != EAGAIN) && (errno != EWOULDBLOCK))
+        connection->broken = 1;
+      break;
+    }
+    connection->output_start += written;
+  }
+
+  if (connection->broken || (connection->output_start == connection->output_used)) {
+    connection->output_start = 0;
+    connection->output_used = 0;
+  }
+}
+
+
+// Goes on while all the output could be written and there are more responses ready for it
+static
+void serve_connection(struct server_context *context, struct server_connection *connection)
+{
+  do {
+    collect_connection_responses(context, connection);
+    parse_connection_input(context, connection);
+    collect_connection_responses(context, connection); // Bad input needs no solver
+    write_connection_output(connection);
+  } while (!connection->broken && (connection->output_used == 0) && connection->queue_head &&
+           __atomic_load_n(&connection->queue_head->done, __ATOMIC_ACQUIRE));
+}
+
+
+static
+void read_connection_input(struct server_connection *connection)
+{
+  ssize_t bytes_read;
+
+  if (connection->input_used == SERVER_INPUT_SIZE)
+    return; // Read once there's room
+  for (;;) {
+    bytes_read = read(connection->fd, connection->input + connection->input_used, SERVER_INPUT_SIZE - connection->input_used);
+    if (bytes_read < 0) {
+      if (errno == EINTR)
+        continue;
+      if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+        connection->closing = 1;
+        connection->broken = 1;
+      }
+      return;
+    }
+    if (bytes_read == 0)
+      connection->closing = 1;
+    connection->input_used += bytes_read;
+    return;
+  }
+}
+
+
+static
+void accept_connections(struct server_context *context, int listen_fd)
+{
+  struct server_connection *connection;
+  int fd, one;
+
+  while (context->connection_count < SERVER_CONNECTION_MAX) {
+    fd = accept(listen_fd, NULL, NULL);
+    if (fd < 0)
+      return;
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)); // Fails harmlessly on Unix sockets
+
+    connection = (struct server_connection*) calloc(1, sizeof(struct server_connection));
+    if (!connection) {
+      close(fd);
+      return;
+    }
+    connection->fd = fd;
+    context->connections[context->connection_count++] = connection;
+  }
+}
+
+
+static
+void close_connection(struct server_context *context, int index)
+{
+  struct server_connection *connection = context->connections[index];
+
+  close(connection->fd);
+  free(connection);
+  context->connections[index] = context->connections[--context->connection_count];
+}
+
+
+// Hung up and all its frames answered, or can't be answered any more
+static inline
+int is_connection_finished(struct server_connection *connection)
+{
+  if (!connection->closing || (connection->task_count != 0))
+    return 0;
+  if (connection->broken)
+    return 1;
+  // Frames may still wait for tasks, a frame without a newline never ends
+  return ((connection->output_used == 0) && !memchr(connection->input, '\n', connection->input_used));
+}
+
+
+// The I/O thread: accepts, reads frames, hands out tasks and writes responses until stopped
+static
+void* server_io(void *arg)
+{
+  struct server_context *context = (struct server_context*) arg;
+  struct server_connection *connection;
+  struct pollfd fds[1 + 2 + SERVER_CONNECTION_MAX];
+  unsigned long events;
+  int i, fd_count, listen_start, connection_start;
+
+  for (;;) {
+    fds[0].fd = context->event_fd;
+    fds[0].events = POLLIN;
+    fd_count = 1;
+
+    listen_start = fd_count;
+    if (context->connection_count < SERVER_CONNECTION_MAX) {
+      for (i=0; i<context->listen_count; i++)
+        fds[fd_count++] = context->listen_fds[i];
+    }
+
+    connection_start = fd_count;
+    for (i=0; i<context->connection_count; i++) {
+      connection = context->connections[i];
+      fds[fd_count].fd = connection->fd;
+      fds[fd_count].events = 0;
+      if (!connection->closing && (connection->input_used < SERVER_INPUT_SIZE) && can_take_task(context, connection))
+        fds[fd_count].events |= POLLIN;
+      if (connection->output_start < connection->output_used)
+        fds[fd_count].events |= POLLOUT;
+      fd_count++;
+    }
+
+    if (poll(fds, fd_count, -1) < 0)
+      continue;
+
+    if (fds[0].revents & POLLIN) {
+      if (read(context->event_fd, &events, sizeof(events)) < 0)
+        events = 0;
+      __atomic_exchange_n(&context->wakeup_pending, 0, __ATOMIC_SEQ_CST);
+    }
+    if (__atomic_load_n(&context->stopping, __ATOMIC_RELAXED))
+      break;
+
+    for (i=0; i<connection_start - listen_start; i++) {
+      if (fds[listen_start + i].revents & POLLIN)
+        accept_connections(context, fds[listen_start + i].fd);
+    }
+
+    // Connections accepted above come after the ones polled
+    for (i=0; i<fd_count - connection_start; i++) {
+      if (fds[connection_start + i].revents & (POLLIN | POLLHUP | POLLERR))
+        read_connection_input(context->connections[i]);
+    }
+
+    for (i=0; i<context->connection_count; i++)
+      serve_connection(context, context->connections[i]);
+
+    // Going backwards, closing moves the last connection into the slot
+    for (i=context->connection_count-1; i>=0; i--) {
+      connection = context->connections[i];
+      if (is_connection_finished(connection))
+        close_connection(context, i);
+    }
+  }
+
+  // Tasks still with the solvers are done with, connections still open are just dropped
+  for (i=context->connection_count-1; i>=0; i--)
+    close_connection(context, i);
+
+  return NULL;
+}
+
+
+static
+int listen_unix(const char *path)
+{
+  struct sockaddr_un address;
+  int fd;
+
+  if (strlen(path) >= sizeof(address.sun_path)) {
+    fprintf(stderr, "Socket path too long: %s\n", path);
+    return -1;
+  }
+
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strcpy(address.sun_path, path);
+
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    return -1;
+
+  unlink(path); // Left over from an earlier run
+  if ((bind(fd, (struct sockaddr*) &address, sizeof(address)) != 0) ||
+      (listen(fd, SERVER_LISTEN_BACKLOG) != 0)) {
+    close(fd);
+    return -1;
+  }
+
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  return fd;
+}
+
+
+static
+int listen_tcp(int port)
+{
+  struct sockaddr_in address;
+  int fd, one;
+
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port);
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK); // Local clients only
+
+  fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0)
+    return -1;
+
+  one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  if ((bind(fd, (struct sockaddr*) &address, sizeof(address)) != 0) ||
+      (listen(fd, SERVER_LISTEN_BACKLOG) != 0)) {
+    close(fd);
+    return -1;
+  }
+
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  return fd;
+}
+
+
+static
+void close_server(struct server_context *context)
+{
+  int i;
+
+  for (i=0; i<context->listen_count; i++)
+    close(context->listen_fds[i].fd);
+  if (context->options->socket_path && context->listen_count)
+    unlink(context->options->socket_path); // Opened first, so it's ours
+  if (context->event_fd >= 0)
+    close(context->event_fd);
+  destroy_ring(&context->request_ring);
+  destroy_cache(&context->cache);
+  pthread_mutex_destroy(&context->cache_lock);
+  free(context->tasks);
+  free(context->latency);
+}
+
+
+// Sets up everything but the threads, returns -1 if anything can't be had
+static
+int open_server(struct server_context *context)
+{
+  const struct sudoku_server_options *options = context->options;
+  int i, fd;
+
+  context->tasks = (struct server_task*) calloc(SERVER_TASK_COUNT, sizeof(struct server_task));
+  context->request_ring = create_ring(SERVER_TASK_COUNT);
+  context->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (!context->tasks || !context->request_ring || (context->event_fd < 0)) {
+    fprintf(stderr, "Cound not allocate server tasks\n");
+    return -1;
+  }
+  for (i=SERVER_TASK_COUNT-1; i>=0; i--) {
+    context->tasks[i].next = context->free_tasks;
+    context->free_tasks = &context->tasks[i];
+  }
+
+  if (options->cache_size) {
+    context->cache = create_cache(options->cache_size * 1024);
+    if (!context->cache) {
+      fprintf(stderr, "Cound not create cache of %li kB\n", options->cache_size);
+      return -1;
+    }
+  }
+
+  if (options->latency) {
+    context->latency = (struct sudoku_histogram*) calloc(options->thread_count * OUTCOME_COUNT, sizeof(struct sudoku_histogram));
+    if (!context->latency) {
+      fprintf(stderr, "Cound not allocate latency histograms\n");
+      return -1;
+    }
+  }
+
+  if (options->socket_path) {
+    fd = listen_unix(options->socket_path);
+    if (fd < 0) {
+      fprintf(stderr, "Cound not listen on socket: %s\n", options->socket_path);
+      return -1;
+    }
+    context->listen_fds[context->listen_count].fd = fd;
+    context->listen_fds[context->listen_count].events = POLLIN;
+    context->listen_count++;
+  }
+
+  if (options->port) {
+    fd = listen_tcp(options->port);
+    if (fd < 0) {
+      fprintf(stderr, "Cound not listen on port: %i\n", options->port);
+      return -1;
+    }
+    context->listen_fds[context->listen_count].fd = fd;
+    context->listen_fds[context->listen_count].events = POLLIN;
+    context->listen_count++;
+  }
+
+  return 0;
+}
+
+
+static
+void print_server_results(struct server_context *context)
+{
+  const struct sudoku_server_options *options = context->options;
+  struct sudoku_histogram *latency;
+  int i;
+
+  if (context->latency) {
+    latency = (struct sudoku_histogram*) calloc(OUTCOME_COUNT, sizeof(struct sudoku_histogram));
+    if (latency) {
+      for (i=0; i<options->thread_count * OUTCOME_COUNT; i++)
+        add_histogram(&latency[i % OUTCOME_COUNT], &context->latency[i]);
+      print_latency(latency, (options->latency > 1));
+      free(latency);
+    }
+  }
+
+  if (context->cache && !options->quiet_mode)
+    printf("Cache hits: %lu  Cache misses: %lu  Cache evictions: %lu\n", context->cache->hits, context->cache->misses, context->cache->evictions);
+}
+
+
+// Serves until SIGINT or SIGTERM
+int run_server(const struct sudoku_server_options *options)
+{
+  struct server_context *context;
+  pthread_t *workers, io_thread;
+  sigset_t signals;
+  int i, worker_count, signal_number, status;
+
+  // Too big for the stack with all the connection slots
+  context = (struct server_context*) calloc(1, sizeof(struct server_context));
+  workers = (pthread_t*) calloc(options->thread_count, sizeof(pthread_t));
+  if (!context || !workers) {
+    fprintf(stderr, "Cound not allocate server\n");
+    free(context);
+    free(workers);
+    return -1;
+  }
+  context->options = options;
+  context->event_fd = -1;
+  pthread_mutex_init(&context->cache_lock, NULL);
+
+  if (open_server(context) != 0) {
+    close_server(context);
+    free(context);
+    free(workers);
+    return -1;
+  }
+
+  // Only this thread takes the signals, a client hanging up mustn't kill us
+  signal(SIGPIPE, SIG_IGN);
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+  for (worker_count=0; worker_count<options->thread_count; worker_count++) {
+    if (pthread_create(&workers[worker_count], NULL, server_worker, context) != 0) {
+      fprintf(stderr, "Cound not start server thread %i\n", worker_count);
+      break;
+    }
+  }
+
+  status = -1;
+  if ((worker_count > 0) && (pthread_create(&io_thread, NULL, server_io, context) == 0)) {
+    if (!options->quiet_mode)
+      fprintf(stderr, "Serving on %i threads\n", worker_count);
+    sigwait(&signals, &signal_number);
+
+    __atomic_store_n(&context->stopping, 1, __ATOMIC_RELAXED);
+    wake_server_io(context);
+    pthread_join(io_thread, NULL);
+    status = 0;
+  } else if (worker_count > 0) {
+    fprintf(stderr, "Cound not start server I/O thread\n");
+  }
+
+  // Every solver takes one stop task, after whatever is still in the ring
+  for (i=0; i<worker_count; i++)
+    ring_push_wait(context->request_ring, &server_stop_task);
+  for (i=0; i<worker_count; i++)
+    pthread_join(workers[i], NULL);
+
+  if (status == 0)
+    print_server_results(context);
+
+  close_server(context);
+  free(context);
+  free(workers);
+
+  return status;
+}
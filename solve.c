@@ -17,8 +17,16 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <stdbool.h>
+#include <pthread.h>
 #include <assert.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 #include "sudoku.h"
 
 
@@ -28,6 +36,8 @@
 
 #define NUMBER_SET_TO_NUMBER(number_set) (number_set_to_number[number_set])
 
+#define BIVALUE_PAIR_COUNT 36 // Number of pairs of numbers 1 to 9
+
 
 // Constants and alike
 
@@ -35,6 +45,10 @@ static unsigned int number_set_to_number[NUMBER_TO_SET(10)+1];
 
 static unsigned int bit_count[NUMBER_TO_SET(10)+1];
 
+static unsigned int number_set_to_pair[NUMBER_TO_SET(10)+1];
+
+static unsigned int bivalue_pair_to_number_set[BIVALUE_PAIR_COUNT];
+
 static struct {
   unsigned int remaining_set;
   unsigned int index;
@@ -75,10 +89,15 @@ static void print_index_set(unsigned int number_set, const char *postfix);
 
 static void print_number_set(unsigned int number_set, const char *postfix);
 
-static void print_reserved_set_for_cell(struct sudoku_cell *cell);
 
 static void print_possible(struct sudoku_board *board, const char *prefix);
 
+static void trace_board(struct sudoku_board *board);
+
+static void trace_possible(struct sudoku_board *board, int indented);
+
+static void init_chain_peers();
+
 int solve(struct sudoku_board *board);
 
 
@@ -116,9 +135,10 @@ unsigned int set_to_index_func(unsigned int *set)
 }
 
 
-void init()
+static
+void init_tables()
 {
-  int i;
+  int i, j, pair;
 
   for (i=0; i<=NUMBER_TO_SET(10); i++)
     number_set_to_number[i] = 0;
@@ -131,6 +151,29 @@ void init()
     set_to_index[i].remaining_set = i;
     set_to_index[i].index = set_to_index_func(&(set_to_index[i].remaining_set));    
   }
+
+  for (i=0; i<=NUMBER_TO_SET(10); i++)
+    number_set_to_pair[i] = 0;
+
+  pair = 0;
+  for (i=1; i<=9; i++) {
+    for (j=i+1; j<=9; j++) {
+      number_set_to_pair[NUMBER_TO_SET(i) | NUMBER_TO_SET(j)] = pair;
+      bivalue_pair_to_number_set[pair] = NUMBER_TO_SET(i) | NUMBER_TO_SET(j);
+      pair++;
+    }
+  }
+
+  init_chain_peers();
+}
+
+
+// Fills in the tables the first time it's called, safe to call from several threads
+void init()
+{
+  static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+
+  pthread_once(&init_once, init_tables);
 }
 
 
@@ -167,15 +210,14 @@ unsigned int get_next_index_from_set(unsigned int *set)
 static inline
 int is_board_solved(struct sudoku_board *board)
 {
-  return ((board->undetermined_count == 0) || (board->solutions_count > 0));
+  return ((board->undetermined_count == 0) || (board->solutions_max && (board->solutions_count >= board->solutions_max)));
 }
 
 
 static inline
 void set_board_dead(struct sudoku_board *board, const char *func_name)
 {
-  if (board->debug_level)
-    printf("Board is declared dead! (function: %s)\n", func_name);
+  TRACE(1, board, TRACE_BOARD_DEAD, func_name, 0, 0, 0, 0, 0);
 
   board->dead = 1;
 }
@@ -324,11 +366,7 @@ void set_cell_number_and_log(struct sudoku_cell *cell, unsigned int number)
 
   set_cell_number(cell, number);
 
-  if (cell->board_ref->debug_level) {
-    if (cell->board_ref->debug_level > 1)
-      printf(DINDENT);  
-    printf("[%i,%i]  =  %i\n", cell->row, cell->col, number);  
-  }
+  TRACE(1, cell->board_ref, TRACE_SET_NUMBER, NULL, cell->row*9 + cell->col, 0, number, 0, 0);
 }
 
 
@@ -417,11 +455,9 @@ int reserve_cell_and_log(struct sudoku_cell *cell, unsigned int number_set, cons
   int changed;
 
   board = cell->board_ref;
-  if ((board->debug_level >= 3) && (func_name)) {     
-    printf(DINDENT "%s: [%i,%i] = ", func_name, cell->row, cell->col);
-    print_number_set(number_set, "  ( removing: ");
-    print_number_set((get_cell_possible_number_set(cell) & ~number_set), ")\n");
-   }
+  if (func_name)
+    TRACE(3, board, TRACE_RESERVE, func_name, cell->row*9 + cell->col, 0,
+          number_set, (get_cell_possible_number_set(cell) & ~number_set), 0);
 
   // Check: Through logic we have reached the conclusion that no numbers are available for this cell - bad board! 
   if (number_set == 0) {
@@ -430,8 +466,8 @@ int reserve_cell_and_log(struct sudoku_cell *cell, unsigned int number_set, cons
   }
 
   changed = reserve_cell(cell, number_set);
-  if (changed && (board->debug_level >= 1))
-    print_reserved_set_for_cell(cell);  
+  if (changed)
+    TRACE(1, board, TRACE_RESERVED, NULL, cell->row*9 + cell->col, 0, cell->reserved_for_number_set, 0, 0);
 
   return changed;
 }
@@ -452,11 +488,7 @@ int reserve_row_in_tile(struct sudoku_cell *possible_cell, unsigned int number_s
   my_tile = possible_cell->tile;
   board = possible_cell->board_ref;
 
-  if (board->debug_level >= 4) {
-    printf(DINDENT "%s: Removing numbers from cells around [%i,%i] in tile. Numbers to remove: ",
-           __func__, possible_cell->row, possible_cell->col);
-    print_number_set(number_set, "\n");
-  }
+  TRACE(4, board, TRACE_REMOVE_AROUND, __func__, possible_cell->row*9 + possible_cell->col, TRACE_UNIT_TILE, number_set, 0, 0);
 
   // Loop over all index in my_tile with empty cells
   index_set = board->tile_cell_empty_set[my_tile];
@@ -497,11 +529,7 @@ int reserve_col_in_tile(struct sudoku_cell *possible_cell, unsigned int number_s
   my_tile = possible_cell->tile;
   board = possible_cell->board_ref;
 
-  if (board->debug_level >= 4) {
-    printf(DINDENT "%s: Removing numbers from cells around [%i,%i] in tile. Numbers to remove: ",
-           __func__, possible_cell->row, possible_cell->col);
-    print_number_set(number_set, "\n");
-  }
+  TRACE(4, board, TRACE_REMOVE_AROUND, __func__, possible_cell->row*9 + possible_cell->col, TRACE_UNIT_TILE, number_set, 0, 0);
 
   // Loop over all index in my_tile with empty cells
   index_set = board->tile_cell_empty_set[my_tile];
@@ -542,11 +570,7 @@ int reserve_tile_in_row(struct sudoku_cell *possible_cell, unsigned int number_s
   my_tile = possible_cell->tile;
   board = possible_cell->board_ref;
 
-  if (board->debug_level >= 4) {
-    printf(DINDENT "%s: Removing numbers from cells around [%i,%i] in row. Numbers to remove: ",
-           __func__, possible_cell->row, possible_cell->col);
-    print_number_set(number_set, "\n");
-  }
+  TRACE(4, board, TRACE_REMOVE_AROUND, __func__, possible_cell->row*9 + possible_cell->col, TRACE_UNIT_ROW, number_set, 0, 0);
 
   // Loop over all cols in my_row with empty cells
   col_set = board->row_cell_empty_set[my_row];
@@ -587,11 +611,7 @@ int reserve_tile_in_col(struct sudoku_cell *possible_cell, unsigned int number_s
   my_tile = possible_cell->tile;
   board = possible_cell->board_ref;
 
-  if (board->debug_level >= 4) {
-    printf(DINDENT "%s: Removing numbers from cells around [%i,%i] in col. Numbers to remove: ",
-           __func__, possible_cell->row, possible_cell->col);
-    print_number_set(number_set, "\n");
-  }
+  TRACE(4, board, TRACE_REMOVE_AROUND, __func__, possible_cell->row*9 + possible_cell->col, TRACE_UNIT_COL, number_set, 0, 0);
 
   // Loop over all rows in my_col with empty cells
   row_set = board->col_cell_empty_set[my_col];
@@ -635,11 +655,7 @@ int reserve_cells_with_index_in_tile(struct sudoku_cell *possible_cell, unsigned
   my_tile = possible_cell->tile;
   board = possible_cell->board_ref;
 
-  if (board->debug_level >= 4) {
-    printf(DINDENT "%s: Reserving numbers around [%i,%i] in tile. Numbers to reserve: ",
-           __func__, possible_cell->row, possible_cell->col);
-    print_number_set(number_set, "\n");
-  }
+  TRACE(4, board, TRACE_RESERVE_AROUND, __func__, possible_cell->row*9 + possible_cell->col, TRACE_UNIT_TILE, number_set, 0, 0);
 
   // Loop over all index in my_tile with empty cells
   index_set = board->tile_cell_empty_set[my_tile];
@@ -702,11 +718,7 @@ int reserve_cells_with_index_in_row(struct sudoku_cell *possible_cell, unsigned
   my_row = possible_cell->row;
   board = possible_cell->board_ref;
 
-  if (board->debug_level >= 4) {
-    printf(DINDENT "%s: Reserving numbers around [%i,%i] in row. Numbers to reserve: ",
-           __func__, possible_cell->row, possible_cell->col);
-    print_number_set(number_set, "\n");
-  }
+  TRACE(4, board, TRACE_RESERVE_AROUND, __func__, possible_cell->row*9 + possible_cell->col, TRACE_UNIT_ROW, number_set, 0, 0);
 
   // Loop over all cols in my_row with empty cells
   col_set = board->row_cell_empty_set[my_row];
@@ -764,11 +776,7 @@ int reserve_cells_with_index_in_col(struct sudoku_cell *possible_cell, unsigned
   my_tile = possible_cell->tile;
   board = possible_cell->board_ref;
 
-  if (board->debug_level >= 4) {
-    printf(DINDENT "%s: Reserving numbers around [%i,%i] in col. Numbers to reserve: ",
-           __func__, possible_cell->row, possible_cell->col);
-    print_number_set(number_set, "\n");
-  }
+  TRACE(4, board, TRACE_RESERVE_AROUND, __func__, possible_cell->row*9 + possible_cell->col, TRACE_UNIT_COL, number_set, 0, 0);
 
   // Loop over all rows in my_col with empty cells
   row_set = board->col_cell_empty_set[my_col];
@@ -806,6 +814,51 @@ int reserve_cells_with_index_in_col(struct sudoku_cell *possible_cell, unsigned
 }
 
 
+// === Pass counters ===
+//
+// With board->stats set, every pass run through run_pass() is counted. Without it run_pass()
+// is just the call, so the counters cost nothing unless asked for. The hardware counters are
+// a system call to read, too slow to read around each pass without skewing what they count,
+// so solve() only reads them between its steps, see count_perf().
+
+static inline
+unsigned long read_cycles()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+
+static inline
+int run_pass(struct sudoku_board *board, enum sudoku_pass pass, int (*pass_func)(struct sudoku_board*))
+{
+  struct sudoku_stats *stats = board->stats;
+  struct sudoku_pass_counters *counters;
+  unsigned long start_cycles;
+  unsigned int undetermined_count;
+  int changed;
+
+  if (!stats)
+    return pass_func(board);
+
+  undetermined_count = board->undetermined_count;
+  start_cycles = (stats->count_cycles ? read_cycles() : 0);
+  changed = pass_func(board);
+
+  counters = &stats->passes[pass];
+  counters->calls++;
+  counters->placements += undetermined_count - board->undetermined_count;
+  counters->changes += changed;
+  if (stats->count_cycles)
+    counters->cycles += read_cycles() - start_cycles;
+
+  return changed;
+}
+
+
 static
 int propagate_constraints(struct sudoku_board *board)
 {
@@ -814,8 +867,7 @@ int propagate_constraints(struct sudoku_board *board)
   struct sudoku_cell *cell;
   unsigned int number;
 
-  if (board->debug_level >= 2)
-    printf("  Propagate constraints\n");
+  TRACE(2, board, TRACE_TEXT, "  Propagate constraints", 0, 0, 0, 0, 0);
 
   if (board->row_dirty_set == 0)
     return 0;
@@ -831,8 +883,7 @@ int propagate_constraints(struct sudoku_board *board)
       while (col_set) {
         col = get_next_index_from_set(&col_set);
         cell = &board->cells[row][col];
-        if (board->debug_level >= 4)
-          printf(DINDENT "Empty cell in dirty row [%i,%i]\n", row, col);
+        TRACE(4, board, TRACE_TEXT_CELL, DINDENT "Empty cell in dirty row ", row*9 + col, 0, 0, 0, 0);
         assert(cell->number == 0);
         number = get_cell_possible_number(cell);
 
@@ -852,8 +903,7 @@ int propagate_constraints(struct sudoku_board *board)
       while (row_set) {
         row = get_next_index_from_set(&row_set);
         cell = &board->cells[row][col];
-        if (board->debug_level >= 4)
-          printf(DINDENT "Empty cell in dirty col [%i,%i]\n", row, col);
+        TRACE(4, board, TRACE_TEXT_CELL, DINDENT "Empty cell in dirty col ", row*9 + col, 0, 0, 0, 0);
         assert(cell->number == 0);
         number = get_cell_possible_number(cell);
 
@@ -873,8 +923,7 @@ int propagate_constraints(struct sudoku_board *board)
       while (index_set) {
         index = get_next_index_from_set(&index_set);
         cell = board->tile_ref[tile][index];
-        if (board->debug_level >= 4)
-          printf(DINDENT "Empty cell in dirty tile [%i,%i]\n", cell->row, cell->col);
+        TRACE(4, board, TRACE_TEXT_CELL, DINDENT "Empty cell in dirty tile ", cell->row*9 + cell->col, 0, 0, 0, 0);
         assert(cell->number == 0);
         number = get_cell_possible_number(cell);
 
@@ -898,14 +947,13 @@ int solve_possible(struct sudoku_board *board)
   struct sudoku_cell *cell;
   unsigned int number;
 
-  if (board->debug_level >= 2)
-    printf("Solve possible\n");
+  TRACE(2, board, TRACE_TEXT, "Solve possible", 0, 0, 0, 0, 0);
 
   changed_total = 0;
   round = 0;
   do {
-    if (board->debug_level >= 2)
-      printf("  Round %i\n", round++);
+    TRACE(2, board, TRACE_TEXT_NUMBER, "  Round ", 0, 0, round, 0, 0);
+    round++;
 
     // Loop over all empty cells by going row by row and col by col
     changed = 0;    
@@ -986,12 +1034,8 @@ int find_and_reserve_group_with_number(struct sudoku_cell *cell,
             if (prior_possible_index_set[j] && ((joint_index_set | prior_possible_index_set[j]) == joint_index_set)) {
               // Now we have the three numbers (i+1, j+1, number) that go into joint_index_set
               reserve_number_set = NUMBER_TO_SET(i+1) | NUMBER_TO_SET(j+1) | NUMBER_TO_SET(number);
-              if (cell->board_ref->debug_level >= 4) {
-                printf(DINDENT "%s: Reserving cells around [%i,%i] with possibilities: %i index_set: ",
-                        parent_func_name, cell->row, cell->col, possibilities);
-                print_index_set(joint_index_set, "number_set: ");
-                print_number_set(reserve_number_set, "\n");
-              }
+              TRACE(4, cell->board_ref, TRACE_RESERVE_GROUP, parent_func_name, cell->row*9 + cell->col, 0,
+                    possibilities, joint_index_set, reserve_number_set);
               changed += reserve_with_index_set_func(cell, joint_index_set, reserve_number_set);
               break;
             }
@@ -1014,23 +1058,20 @@ int solve_eliminate_tiles_by_number(struct sudoku_board *board)
   unsigned int prior_possible_index_set[9];
   int changed;
 
-  if (board->debug_level >= 2)
-    printf("Solve eliminate tiles\n");
+  TRACE(2, board, TRACE_TEXT, "Solve eliminate tiles", 0, 0, 0, 0, 0);
 
   changed = 0;
   tile_set = board->tile_empty_set;
   while (tile_set) {
     tile = get_next_index_from_set(&tile_set);
-    if (board->debug_level >= 2)
-      printf("  Tile %i\n", tile);
+    TRACE(2, board, TRACE_TEXT_NUMBER, "  Tile ", 0, 0, tile, 0, 0);
 
     zero_array_9(prior_possible_index_set);
     remaining_number_set = (~board->tile_number_taken_set[tile] & NUMBER_SET_MASK);
     while (remaining_number_set) {
       number = get_next_index_from_set(&remaining_number_set);
       number_set = NUMBER_TO_SET(number);
-      if (board->debug_level >= 2)
-        printf("    Number %i\n", number);
+      TRACE(2, board, TRACE_TEXT_NUMBER, "    Number ", 0, 0, number, 0, 0);
 
       // Check if number is already taken in this tile. If so, skip the number!
       assert(!(board->tile_number_taken_set[tile] & number_set));
@@ -1050,19 +1091,12 @@ int solve_eliminate_tiles_by_number(struct sudoku_board *board)
           possible_cell = cell;
           possible_index_set |= NUMBER_TO_SET(index);
 
-          if (board->debug_level >= 4) {
-            printf(DINDENT "Possible [%i,%i] avail_set: ", cell->row, cell->col);
-            print_number_set(get_cell_possible_number_set(cell), "<> ");
-            print_number_set(number_set, "");
-            printf("cell_number: %i\n", cell->number);
-          }
+          TRACE(4, board, TRACE_ELIMINATE_CELL, NULL, cell->row*9 + cell->col, 0,
+                get_cell_possible_number_set(cell), number_set, cell->number);
         }
       }
 
-      if (board->debug_level >= 4) {
-        printf(DINDENT "Tile: %i, Number: %i, possibilities: %i, possible_index_set: ", tile, number, possibilities);
-        print_index_set(possible_index_set, "\n");
-      }
+      TRACE(4, board, TRACE_ELIMINATE_TILE, NULL, tile, number, possibilities, possible_index_set, 0);
 
       // Do we have any possibilities
       if (possibilities == 0) {
@@ -1098,7 +1132,7 @@ int solve_eliminate_tiles_by_number(struct sudoku_board *board)
     }
 
     if (is_board_dirty(board))
-      changed += propagate_constraints(board);
+      changed += run_pass(board, PASS_PROPAGATE, propagate_constraints);
   }
 
   return changed;
@@ -1113,23 +1147,20 @@ int solve_eliminate_rows_by_number(struct sudoku_board *board)
   unsigned int prior_possible_index_set[9];
   int changed;
 
-  if (board->debug_level >= 2)
-    printf("Solve eliminate rows\n");
+  TRACE(2, board, TRACE_TEXT, "Solve eliminate rows", 0, 0, 0, 0, 0);
 
   changed = 0;
   row_set = board->row_empty_set;
   while (row_set) {
     row = get_next_index_from_set(&row_set);
-    if (board->debug_level >= 2)
-      printf("  Row %i\n", row);
+    TRACE(2, board, TRACE_TEXT_NUMBER, "  Row ", 0, 0, row, 0, 0);
 
     zero_array_9(prior_possible_index_set);
     remaining_number_set = (~board->row_number_taken_set[row] & NUMBER_SET_MASK);
     while (remaining_number_set) {
       number = get_next_index_from_set(&remaining_number_set);
       number_set = NUMBER_TO_SET(number);
-      if (board->debug_level >= 2)
-        printf("    Number %i\n", number);
+      TRACE(2, board, TRACE_TEXT_NUMBER, "    Number ", 0, 0, number, 0, 0);
 
       // Check if number is already taken in this row.
       assert(!(board->row_number_taken_set[row] & number_set));
@@ -1149,12 +1180,8 @@ int solve_eliminate_rows_by_number(struct sudoku_board *board)
           possible_cell = cell;
           possible_index_set |= NUMBER_TO_SET(col);
 
-          if (board->debug_level >= 4) {
-            printf(DINDENT "Possible [%i,%i] avail_set: ", cell->row, cell->col);
-            print_number_set(get_cell_possible_number_set(cell), "<> ");
-            print_number_set(number_set, "");
-            printf("cell_number: %i\n", cell->number);
-          }
+          TRACE(4, board, TRACE_ELIMINATE_CELL, NULL, cell->row*9 + cell->col, 0,
+                get_cell_possible_number_set(cell), number_set, cell->number);
         }
       }
 
@@ -1186,7 +1213,7 @@ int solve_eliminate_rows_by_number(struct sudoku_board *board)
     }
 
     if (is_board_dirty(board))
-      changed += propagate_constraints(board);
+      changed += run_pass(board, PASS_PROPAGATE, propagate_constraints);
   }
 
   return changed;
@@ -1202,23 +1229,20 @@ int solve_eliminate_cols_by_number(struct sudoku_board *board)
   unsigned int prior_possible_index_set[9];
   int changed;
 
-  if (board->debug_level >= 2)
-    printf("Solve eliminate cols\n");
+  TRACE(2, board, TRACE_TEXT, "Solve eliminate cols", 0, 0, 0, 0, 0);
 
   changed = 0;
   col_set = board->col_empty_set;
   while (col_set) {
     col = get_next_index_from_set(&col_set);
-    if (board->debug_level >= 2)
-      printf("  Col %i\n", col);
+    TRACE(2, board, TRACE_TEXT_NUMBER, "  Col ", 0, 0, col, 0, 0);
 
     zero_array_9(prior_possible_index_set);
     remaining_number_set = (~board->col_number_taken_set[col] & NUMBER_SET_MASK);
     while (remaining_number_set) {
       number = get_next_index_from_set(&remaining_number_set);
       number_set = NUMBER_TO_SET(number);
-      if (board->debug_level >= 2)
-        printf("    Number %i\n", number);
+      TRACE(2, board, TRACE_TEXT_NUMBER, "    Number ", 0, 0, number, 0, 0);
 
       // Check if number is already taken in this column. If so, skip the number!
       assert(!(board->col_number_taken_set[col] & number_set));
@@ -1238,12 +1262,8 @@ int solve_eliminate_cols_by_number(struct sudoku_board *board)
           possible_cell = cell;
           possible_index_set |= NUMBER_TO_SET(row);
 
-          if (board->debug_level >= 4) {
-            printf(DINDENT "Possible [%i,%i] avail_set: ", cell->row, cell->col);
-            print_number_set(get_cell_possible_number_set(cell), "<> ");
-            print_number_set(number_set, "");
-            printf("cell_number: %i\n", cell->number);
-          }
+          TRACE(4, board, TRACE_ELIMINATE_CELL, NULL, cell->row*9 + cell->col, 0,
+                get_cell_possible_number_set(cell), number_set, cell->number);
         }
       }
 
@@ -1275,7 +1295,7 @@ int solve_eliminate_cols_by_number(struct sudoku_board *board)
     }
 
     if (is_board_dirty(board))
-      changed += propagate_constraints(board);
+      changed += run_pass(board, PASS_PROPAGATE, propagate_constraints);
   }
 
   return changed;
@@ -1327,12 +1347,8 @@ int find_and_reserve_group_with_index(struct sudoku_cell *cell,
             if (prior_possible_number_set[j] && ((joint_number_set | prior_possible_number_set[j]) == joint_number_set)) {
               // Now we have the three indexes (i, j, row) that go into possible_index_set
               possible_index_set = INDEX_TO_SET(i) | INDEX_TO_SET(j) | INDEX_TO_SET(this_index);
-              if (cell->board_ref->debug_level >= 4) {
-                printf(DINDENT "%s: Reserving cells around [%i,%i] with possibilities: %i index_set: ",
-                        parent_func_name, cell->row, cell->col, possibilities);
-                print_index_set(possible_index_set, "number_set: ");
-                print_number_set(joint_number_set, "\n");
-              }
+              TRACE(4, cell->board_ref, TRACE_RESERVE_GROUP, parent_func_name, cell->row*9 + cell->col, 0,
+                    possibilities, possible_index_set, joint_number_set);
               changed += reserve_with_index_set_func(cell, possible_index_set, joint_number_set);
               break;
             }
@@ -1354,25 +1370,21 @@ int solve_eliminate_tiles_by_index(struct sudoku_board *board)
   unsigned int prior_possible_number_set[9];
   int changed;
 
-  if (board->debug_level >= 2)
-    printf("Solve eliminate tiles 2\n");
+  TRACE(2, board, TRACE_TEXT, "Solve eliminate tiles 2", 0, 0, 0, 0, 0);
 
   changed = 0;
   tile_set = board->tile_empty_set;
   while (tile_set) {
     tile = get_next_index_from_set(&tile_set);
-    if (board->debug_level >= 2) {
-      printf("  Tile %i\n", tile);
-      if (board->debug_level >= 4)
-        print_possible(board, DINDENT);
-    }
+    TRACE(2, board, TRACE_TEXT_NUMBER, "  Tile ", 0, 0, tile, 0, 0);
+    if (TRACE_ON(4, board))
+      trace_possible(board, 1);
 
     zero_array_9(prior_possible_number_set);
     index_set = board->tile_cell_empty_set[tile];
     while (index_set) {
       index = get_next_index_from_set(&index_set);
-      if (board->debug_level >= 2)
-        printf("    Index %i\n", index);
+      TRACE(2, board, TRACE_TEXT_NUMBER, "    Index ", 0, 0, index, 0, 0);
       cell = board->tile_ref[tile][index];
       assert(cell->number == 0);
       possible_number_set = get_cell_possible_number_set(cell);
@@ -1399,7 +1411,7 @@ int solve_eliminate_tiles_by_index(struct sudoku_board *board)
     }
 
     if (is_board_dirty(board))
-      changed += propagate_constraints(board);
+      changed += run_pass(board, PASS_PROPAGATE, propagate_constraints);
   }
 
   return changed;
@@ -1414,25 +1426,21 @@ int solve_eliminate_rows_by_index(struct sudoku_board *board)
   unsigned int prior_possible_number_set[9];
   int changed;
 
-  if (board->debug_level >= 2)
-    printf("Solve eliminate rows 2\n");
+  TRACE(2, board, TRACE_TEXT, "Solve eliminate rows 2", 0, 0, 0, 0, 0);
 
   changed = 0;
   row_set = board->row_empty_set;
   while (row_set) {
     row = get_next_index_from_set(&row_set);
-    if (board->debug_level >= 2) {
-      printf("  Row %i\n", row);
-      if (board->debug_level >= 4)
-        print_possible(board, DINDENT);
-    }
+    TRACE(2, board, TRACE_TEXT_NUMBER, "  Row ", 0, 0, row, 0, 0);
+    if (TRACE_ON(4, board))
+      trace_possible(board, 1);
 
     zero_array_9(prior_possible_number_set);
     col_set = board->row_cell_empty_set[row];
     while (col_set) {
       col = get_next_index_from_set(&col_set);
-      if (board->debug_level >= 2)
-        printf("    Col %i\n", col);
+      TRACE(2, board, TRACE_TEXT_NUMBER, "    Col ", 0, 0, col, 0, 0);
       prior_possible_number_set[col] = 0;
       cell = &board->cells[row][col];
       assert(cell->number == 0); 
@@ -1460,7 +1468,7 @@ int solve_eliminate_rows_by_index(struct sudoku_board *board)
     }
 
     if (is_board_dirty(board))
-      changed += propagate_constraints(board);
+      changed += run_pass(board, PASS_PROPAGATE, propagate_constraints);
   }
 
   return changed;
@@ -1475,25 +1483,21 @@ int solve_eliminate_cols_by_index(struct sudoku_board *board)
   unsigned int prior_possible_number_set[9];
   int changed;
 
-  if (board->debug_level >= 2)
-    printf("Solve eliminate cols 2\n");
+  TRACE(2, board, TRACE_TEXT, "Solve eliminate cols 2", 0, 0, 0, 0, 0);
 
   changed = 0;
   col_set = board->col_empty_set;
   while (col_set) {
     col = get_next_index_from_set(&col_set);
-    if (board->debug_level >= 2) {
-      printf("  Col %i\n", col);
-      if (board->debug_level >= 4)
-        print_possible(board, DINDENT);
-    }
+    TRACE(2, board, TRACE_TEXT_NUMBER, "  Col ", 0, 0, col, 0, 0);
+    if (TRACE_ON(4, board))
+      trace_possible(board, 1);
 
     zero_array_9(prior_possible_number_set);
     row_set = board->col_cell_empty_set[col];
     while (row_set) {
       row = get_next_index_from_set(&row_set);
-      if (board->debug_level >= 2)
-        printf("    Row %i\n", row);
+      TRACE(2, board, TRACE_TEXT_NUMBER, "    Row ", 0, 0, row, 0, 0);
       prior_possible_number_set[row] = 0;
       cell = &board->cells[row][col];
       assert(cell->number == 0);
@@ -1521,7 +1525,7 @@ int solve_eliminate_cols_by_index(struct sudoku_board *board)
     }
 
     if (is_board_dirty(board))
-      changed += propagate_constraints(board);
+      changed += run_pass(board, PASS_PROPAGATE, propagate_constraints);
   }
 
   return changed;
@@ -1540,19 +1544,18 @@ int solve_eliminate(struct sudoku_board *board)
     solve_eliminate_cols_by_index
   }; 
 
-  if (board->debug_level >= 2)
-    printf("Solve eliminate\n");
+  TRACE(2, board, TRACE_TEXT, "Solve eliminate", 0, 0, 0, 0, 0);
 
   total_changed = 0;
   round = 0;
 
   do {
-    if (board->debug_level >= 2)
-      printf("  Round %i\n", round++);
+    TRACE(2, board, TRACE_TEXT_NUMBER, "  Round ", 0, 0, round, 0, 0);
+    round++;
     changed = 0;
 
     for(i=0; i<(sizeof(solve_func_arr)/sizeof(solve_func_arr[0])); i++) {
-      this_changed = solve_func_arr[i](board);
+      this_changed = run_pass(board, PASS_ELIMINATE_TILES_BY_INDEX + i, solve_func_arr[i]);
       if (this_changed) {
         changed += this_changed;
         if (is_board_done(board))
@@ -1567,111 +1570,151 @@ int solve_eliminate(struct sudoku_board *board)
 }
 
 
-static inline
-void analyze_tile_interlock_rectangle_helper(struct sudoku_board *board, struct sudoku_cell *cell1,
-                                             unsigned int set1, unsigned int set2,
-                                             unsigned int set3, unsigned int set4, int *changed) 
+// === Bivalue cell index ===
+//
+// The tile interlock rectangle can only fire when three of its corners are bivalue cells, so
+// the rectangles are enumerated from the bivalue cells grouped by their number pair instead of
+// from all combinations of empty cells.
+struct bivalue_index {
+  unsigned int pair_start[BIVALUE_PAIR_COUNT+1]; // Cells for pair p are cells[pair_start[p]] to cells[pair_start[p+1]-1]
+  struct sudoku_cell *cells[9*9];
+};
+
+
+static
+void build_bivalue_index(struct sudoku_board *board, struct bivalue_index *bivalue)
 {
-  unsigned int common_set;
+  unsigned int row, col, row_set, col_set, pair, pair_count[BIVALUE_PAIR_COUNT];
+  unsigned int possible_set;
+  struct sudoku_cell *cell;
 
-  common_set = (set3 & set4);
-  
-  if ((bit_count[set3] == 2) && (bit_count[set4] == 2) && (bit_count[common_set] == 1)) {
-    if ((set1 & common_set) && (((set3|set4) & ~common_set) == set2)) {
-     // Remove common_set from cell1
-     (*changed) += reserve_cell_and_log(cell1, (set1 & ~common_set), "analyze_tile_interlock_rectangle");
+  for (pair=0; pair<BIVALUE_PAIR_COUNT; pair++)
+    pair_count[pair] = 0;
+
+  // Count the cells per pair, then place them in pair order
+  row_set = board->row_empty_set;
+  while (row_set) {
+    row = get_next_index_from_set(&row_set);
+    col_set = board->row_cell_empty_set[row];
+    while (col_set) {
+      col = get_next_index_from_set(&col_set);
+      possible_set = get_cell_possible_number_set(&board->cells[row][col]);
+      if (bit_count[possible_set] == 2)
+        pair_count[number_set_to_pair[possible_set]]++;
+    }
+  }
+
+  bivalue->pair_start[0] = 0;
+  for (pair=0; pair<BIVALUE_PAIR_COUNT; pair++) {
+    bivalue->pair_start[pair+1] = bivalue->pair_start[pair] + pair_count[pair];
+    pair_count[pair] = bivalue->pair_start[pair];
+  }
+
+  row_set = board->row_empty_set;
+  while (row_set) {
+    row = get_next_index_from_set(&row_set);
+    col_set = board->row_cell_empty_set[row];
+    while (col_set) {
+      col = get_next_index_from_set(&col_set);
+      cell = &board->cells[row][col];
+      possible_set = get_cell_possible_number_set(cell);
+      if (bit_count[possible_set] == 2)
+        bivalue->cells[pair_count[number_set_to_pair[possible_set]]++] = cell;
     }
   }
 }
 
 
+// Rectangle with rows in different bands and cols in different stacks:
+//
+//   pivot {xy}  ---  row_wing {xz}
+//     |                  |
+//   col_wing {yz} ---  target
+//
+// If target is z then both wings are x and y, leaving no number for pivot - so target is not z
 static inline
-int analyze_tile_interlock_rectangle(struct sudoku_cell *cell1, struct sudoku_cell *cell2, 
-                                     struct sudoku_cell *cell3, struct sudoku_cell *cell4)
+int analyze_tile_interlock_rectangle(struct sudoku_cell *pivot, struct sudoku_cell *row_wing,
+                                     struct sudoku_cell *col_wing, unsigned int pivot_set, 
+                                     unsigned int row_wing_set, unsigned int col_wing_set)
 {
-  int changed;
-  unsigned int set1, set2, set3, set4, common_set12, common_set34;
   struct sudoku_board *board;
+  struct sudoku_cell *target;
+  unsigned int z_set, target_set;
 
-  changed = 0;
-  board = cell1->board_ref;
-  set1 = get_cell_possible_number_set(cell1);
-  set2 = get_cell_possible_number_set(cell2);
-  set3 = get_cell_possible_number_set(cell3);
-  set4 = get_cell_possible_number_set(cell4);
-
-  if (board->debug_level >= 4) {
-    printf(DINDENT "set1: "); print_number_set(set1, "\n");
-    printf(DINDENT "set2: "); print_number_set(set2, "\n");
-    printf(DINDENT "set3: "); print_number_set(set3, "\n");
-    printf(DINDENT "set4: "); print_number_set(set4, "\n");
-    common_set12 = (set1 & set2);
-    common_set34 = (set3 & set4);
-    printf(DINDENT "common_set12: "); print_number_set(common_set12, "\n");
-    printf(DINDENT "common_set34: "); print_number_set(common_set34, "\n");
-  }
-
-  analyze_tile_interlock_rectangle_helper(board, cell1, set1, set2, set3, set4, &changed);
-  analyze_tile_interlock_rectangle_helper(board, cell2, set2, set1, set3, set4, &changed);
-  analyze_tile_interlock_rectangle_helper(board, cell3, set3, set4, set1, set2, &changed);
-  analyze_tile_interlock_rectangle_helper(board, cell4, set4, set3, set1, set2, &changed);
+  board = pivot->board_ref;
+  if ((pivot->tile / 3 == col_wing->tile / 3) || (pivot->tile % 3 == row_wing->tile % 3))
+    return 0;
 
-  return changed;
+  target = &board->cells[col_wing->row][row_wing->col];
+  if (target->number)
+    return 0;
+
+  // Earlier eliminations in this pass may have changed the cells
+  if ((get_cell_possible_number_set(pivot) != pivot_set) ||
+      (get_cell_possible_number_set(row_wing) != row_wing_set) ||
+      (get_cell_possible_number_set(col_wing) != col_wing_set))
+    return 0;
+
+  z_set = (row_wing_set & col_wing_set);
+  target_set = get_cell_possible_number_set(target);
+  if (!(target_set & z_set))
+    return 0;
+
+  TRACE(4, board, TRACE_RECTANGLE, NULL, pivot->row*9 + pivot->col, target->row*9 + target->col, 0, 0, 0);
+  TRACE(4, board, TRACE_TEXT_SET, DINDENT "pivot: ", 0, 0, pivot_set, 0, 0);
+  TRACE(4, board, TRACE_TEXT_SET, DINDENT "row_wing: ", 0, 0, row_wing_set, 0, 0);
+  TRACE(4, board, TRACE_TEXT_SET, DINDENT "col_wing: ", 0, 0, col_wing_set, 0, 0);
+  TRACE(4, board, TRACE_TEXT_SET, DINDENT "target: ", 0, 0, target_set, 0, 0);
+
+  // Remove z from target
+  return reserve_cell_and_log(target, (target_set & ~z_set), "analyze_tile_interlock_rectangle");
 }
 
 
 static
 int solve_tile_interlock_rectangle(struct sudoku_board *board)
 {
-  unsigned int row1, col1, row2, col2, row1_set, row2_set, col1_set, col2_set;
-  struct sudoku_cell *cell1, *cell2, *cell3, *cell4;
-  const unsigned int above_mask[9] = { 0b111111000, 0b111111000, 0b111111000,
-                                       0b111000000, 0b111000000, 0b111000000, 
-                                       0b000000000, 0b000000000, 0b000000000 }; 
+  struct bivalue_index bivalue;
+  struct sudoku_cell *pivot, *wing1, *wing2;
+  unsigned int pivot_pair, x_set, y_set, z, z_set, z_candidate_set, pair1, pair2, p, i, j;
   int changed;
 
-  if (board->debug_level >= 2)
-    printf("Solve tile interlock rectangle\n");
+  TRACE(2, board, TRACE_TEXT, "Solve tile interlock rectangle", 0, 0, 0, 0, 0);
 
   changed = 0;
-
-  // Loop over row 0 to 5 with empty cells
-  row1_set = board->row_empty_set & 0b000111111; 
-  while (row1_set) {
-    row1 = get_next_index_from_set(&row1_set);
-    if (board->debug_level >= 2)
-      printf("  Row %i\n", row1);
-
-    // Loop over col 0 to 5 with empty cells
-    col1_set = board->row_cell_empty_set[row1]  & 0b000111111;
-    while (col1_set) {
-      col1 = get_next_index_from_set(&col1_set);
-      if (board->debug_level >= 2)
-        printf("    Col %i\n", col1);
-
-      cell1 = &board->cells[row1][col1];
-      assert(cell1->number == 0);
-
-      // Loop over rows in higher tiles with empty cells
-      row2_set = board->row_empty_set & above_mask[row1]; 
-      while (row2_set) {
-        row2 = get_next_index_from_set(&row2_set);
-
-        // Loop over cols in higher tiles with empty cells
-        col2_set = board->row_cell_empty_set[row2]  & above_mask[col1];
-        while (col2_set) {
-          col2 = get_next_index_from_set(&col2_set);
-          cell2 = &board->cells[row2][col2]; 
-          assert(cell2->number == 0);
-
-          if ((board->cells[row1][col2].number == 0) &&
-              (board->cells[row2][col1].number == 0)) {
-            // We have found a rectangle of empty cells
-            if (board->debug_level >= 4)
-              printf(DINDENT "Found inter-tile rectangle: [%i,%i]-[%i,%i]\n", row1, col1, row2, col2);
-            cell3 = &board->cells[row2][col1];
-            cell4 = &board->cells[row1][col2];
-            changed += analyze_tile_interlock_rectangle(cell1, cell2, cell3, cell4);
+  build_bivalue_index(board, &bivalue);
+
+  for (pivot_pair=0; pivot_pair<BIVALUE_PAIR_COUNT; pivot_pair++) {
+    for (p=bivalue.pair_start[pivot_pair]; p<bivalue.pair_start[pivot_pair+1]; p++) {
+      pivot = bivalue.cells[p];
+      x_set = bivalue_pair_to_number_set[pivot_pair];
+      y_set = x_set & (x_set - 1);
+      x_set &= ~y_set;
+      TRACE(2, board, TRACE_TEXT_CELL, "  Pivot ", pivot->row*9 + pivot->col, 0, 0, 0, 0);
+
+      // Wings are {xz} and {yz} for any other number z
+      z_candidate_set = NUMBER_SET_MASK & ~(x_set | y_set);
+      while (z_candidate_set) {
+        z = get_next_index_from_set(&z_candidate_set);
+        z_set = NUMBER_TO_SET(z);
+        pair1 = number_set_to_pair[x_set | z_set];
+        pair2 = number_set_to_pair[y_set | z_set];
+
+        for (i=bivalue.pair_start[pair1]; i<bivalue.pair_start[pair1+1]; i++) {
+          wing1 = bivalue.cells[i];
+          if ((wing1->row != pivot->row) && (wing1->col != pivot->col))
+            continue;
+
+          for (j=bivalue.pair_start[pair2]; j<bivalue.pair_start[pair2+1]; j++) {
+            wing2 = bivalue.cells[j];
+            if ((wing1->row == pivot->row) && (wing2->col == pivot->col))
+              changed += analyze_tile_interlock_rectangle(pivot, wing1, wing2, (x_set | y_set),
+                                                          (x_set | z_set), (y_set | z_set));
+            else if ((wing1->col == pivot->col) && (wing2->row == pivot->row))
+              changed += analyze_tile_interlock_rectangle(pivot, wing2, wing1, (x_set | y_set),
+                                                          (y_set | z_set), (x_set | z_set));
+            if (is_board_done(board))
+              return changed;
           }
         }
       }
@@ -1687,15 +1730,13 @@ int solve_tile_interlock(struct sudoku_board *board)
 {
   int changed, total_changed, round;
 
-  if (board->debug_level >= 2)
-    printf("Solve tile interlock\n");
+  TRACE(2, board, TRACE_TEXT, "Solve tile interlock", 0, 0, 0, 0, 0);
 
   total_changed = 0;
   round = 0;
 
   do {
-    if (board->debug_level >= 2)
-      printf("  Round %i\n", round);
+    TRACE(2, board, TRACE_TEXT_NUMBER, "  Round ", 0, 0, round, 0, 0);
     round++;
 
     changed = solve_tile_interlock_rectangle(board);
@@ -1703,7 +1744,7 @@ int solve_tile_interlock(struct sudoku_board *board)
     if (is_board_done(board))
       break;
     if (changed) {
-      total_changed += propagate_constraints(board);
+      total_changed += run_pass(board, PASS_PROPAGATE, propagate_constraints);
       if (is_board_done(board))
         break;
       total_changed += solve_eliminate(board);
@@ -1716,191 +1757,906 @@ int solve_tile_interlock(struct sudoku_board *board)
 }
 
 
-static inline
-void solve_hidden_cell(struct sudoku_cell *cell)
-{
-  unsigned int number, number_set;
-  struct sudoku_board *board;
-  struct sudoku_board *future_board;
+// === Chains (XY-chains and alternating inference chains) ===
+//
+// Every candidate (cell and number) is a node. Nodes are linked:
+//   - Strong: one of the two must be true (bivalue cell, or a number with two places left in a unit)
+//   - Weak: at most one of them can be true (same cell, or same number in the same row, col or tile)
+// Assuming a start node is false, a strong link makes the other end true and a weak link makes the
+// other end false. Following links alternately (breadth first over bitsets) gives the nodes that must
+// be true if the start node is false - so either the start node or any of those nodes is true, and
+// nodes that see both can be eliminated. If the start node itself comes out true, or two nodes that
+// see each other both come out true, the start node must be true.
+//
+// XY-chains are the special case with strong links only in bivalue cells and weak links only
+// between cells, so they are searched first on the smaller graph.
 
-  board = cell->board_ref;
-  number_set = get_cell_possible_number_set(cell);
-  while (number_set) {
-    number = get_next_index_from_set(&number_set);
-    if (board->debug_level)
-      printf("Trying solution [%i,%i] = %i  (level: %i)\n", cell->row, cell->col, number, board->nest_level);
+#define CHAIN_NODE_COUNT (9*9*9)
+#define CHAIN_NODE_SET_WORDS ((CHAIN_NODE_COUNT + 63) / 64)
+#define CHAIN_NODE(row, col, number) ((((row)*9 + (col)) * 9) + ((number) - 1))
+#define CHAIN_MAX_STRONG_LINKS 4 // Cell, row, col and tile
 
-    future_board = dupilcate_board(board);
-    future_board->nest_level++;
-    if (board->debug_level < 3)
-      future_board->debug_level = 0;
-    set_cell_number(&future_board->cells[cell->row][cell->col], number);
-    solve(future_board);
+enum chain_mode {
+  CHAIN_MODE_XY,
+  CHAIN_MODE_AIC
+};
 
-    if (future_board->undetermined_count == 0) {
-      // Add to list of solutions
-      if (board->debug_level >= 1)
-        printf("Found hidden solution [%i,%i] = %i\n", cell->row, cell->col, number);
-      assert(future_board->solutions_list == NULL);
-      assert(future_board->solutions_count == 0);
-      add_to_board_solutions_list(board, future_board);
-      if (is_board_solved(board))
-        return;
-    } else if (future_board->solutions_list) {
-      // Add to list of solutions
-      if (board->debug_level >= 1)
-        printf("Found hidden solution [%i,%i] = %i\n", cell->row, cell->col, number);
-      add_list_to_board_solutions_list(board, future_board->solutions_list);
-      future_board->solutions_list = NULL;
-      future_board->solutions_count = 0;
-      destroy_board(&future_board);
-      if (is_board_solved(board))
-        return;
-    } else {
-      destroy_board(&future_board);
-    }
-  }
-}
+struct chain_node_set {
+  unsigned long long bits[CHAIN_NODE_SET_WORDS];
+};
 
+struct chain_graph {
+  enum chain_mode mode;
+  struct chain_node_set candidates;
+  struct chain_node_set has_strong_link;
+  unsigned short strong_link[CHAIN_NODE_COUNT][CHAIN_MAX_STRONG_LINKS];
+  unsigned char strong_link_count[CHAIN_NODE_COUNT];
+};
 
-static
-void solve_hidden(struct sudoku_board *board)
+
+// Same number in the same row, col or tile - filled in by init()
+static struct chain_node_set chain_number_peer_set[CHAIN_NODE_COUNT];
+
+
+static inline
+void chain_node_set_clear(struct chain_node_set *set)
 {
-  struct sudoku_cell *cell;
-  struct sudoku_board *tmp;
+  int i;
 
-  if (board->debug_level >= 2) {
-    printf("Solve hidden\n");
-    print_board(board);
-    print_possible(board, NULL);
-  }
+  for (i=0; i<CHAIN_NODE_SET_WORDS; i++)
+    set->bits[i] = 0;
+}
 
-  // Is the board good to go to another nest level?
-  cell = find_cell_with_lowest_availability_count(board);
-  if (cell) {
-    solve_hidden_cell(cell);
 
-    // Fix the special case with one-and-only-one solution found
-    if ((board->nest_level == 0) && (board->solutions_count == 1)) {
-      tmp = board->solutions_list;
-      assert(tmp->next == NULL);
-      tmp->next = NULL;
-      board->solutions_list = NULL;
-      board->solutions_count = 0;
-      tmp->nest_level = board->nest_level;
-      copy_board(tmp, board);
-      destroy_board(&tmp);
-    }
-  }
+static inline
+void chain_node_set_add(struct chain_node_set *set, unsigned int node)
+{
+  set->bits[node / 64] |= (1ULL << (node % 64));
 }
 
 
-int solve(struct sudoku_board *board)
+static inline
+int chain_node_set_contains(const struct chain_node_set *set, unsigned int node)
 {
-  int solutions_count;
+  return ((set->bits[node / 64] >> (node % 64)) & 1);
+}
 
-  solve_possible(board);
 
-  if (!is_board_done(board))
-    solve_eliminate(board);
+static inline
+int chain_node_set_is_empty(const struct chain_node_set *set)
+{
+  int i;
 
-  if (!is_board_done(board))
-    solve_tile_interlock(board);   
+  for (i=0; i<CHAIN_NODE_SET_WORDS; i++)
+    if (set->bits[i])
+      return 0;
+  return 1;
+}
 
-  if (board->guessing_allowed) {
-    if (!is_board_done(board)) 
-      solve_hidden(board);
-  }
 
-  solutions_count = board->solutions_count;
-  if (board->undetermined_count == 0)
-    solutions_count++;
+// Removes and returns the lowest node in the set, the set must not be empty
+static inline
+unsigned int chain_node_set_next(struct chain_node_set *set)
+{
+  int i;
+  unsigned int node;
 
-  return solutions_count;
+  for (i=0; i<CHAIN_NODE_SET_WORDS; i++) {
+    if (set->bits[i]) {
+      node = i*64 + __builtin_ctzll(set->bits[i]);
+      set->bits[i] &= (set->bits[i] - 1);
+      return node;
+    }
+  }
+  assert(0);
+  return 0;
 }
 
 
 static
-void print_index_set(unsigned int index_set, const char *postfix)
+void init_chain_peers()
 {
-  int index;
+  unsigned int row, col, number, row2, col2;
 
-  printf("{");
-  for (index=0; index<=8; index++) {
-    if (index_set & INDEX_TO_SET(index))
-      printf(" %i", index);
+  for (row=0; row<9; row++) {
+    for (col=0; col<9; col++) {
+      for (number=1; number<=9; number++) {
+        chain_node_set_clear(&chain_number_peer_set[CHAIN_NODE(row, col, number)]);
+        for (row2=0; row2<9; row2++) {
+          for (col2=0; col2<9; col2++) {
+            if (((row2 != row) || (col2 != col)) &&
+                ((row2 == row) || (col2 == col) || ((row2/3 == row/3) && (col2/3 == col/3))))
+              chain_node_set_add(&chain_number_peer_set[CHAIN_NODE(row, col, number)], CHAIN_NODE(row2, col2, number));
+          }
+        }
+      }
+    }
   }
-  if (postfix)
-    printf(" } %s", postfix);
-  else
-    printf(" }");
 }
 
 
-static
-void print_number_set(unsigned int number_set, const char *postfix)
+// Adds all nodes that see node (weak links) among the candidates
+static inline
+void chain_add_weak_links(const struct chain_graph *graph, unsigned int node, struct chain_node_set *set, enum chain_mode mode)
 {
-  int number;
+  unsigned int cell_node;
+  int i;
 
-  printf("{");
-  for (number=1; number<=9; number++) {
-    if (number_set & NUMBER_TO_SET(number))
-      printf(" %i", number);
+  for (i=0; i<CHAIN_NODE_SET_WORDS; i++)
+    set->bits[i] |= (chain_number_peer_set[node].bits[i] & graph->candidates.bits[i]);
+
+  if (mode == CHAIN_MODE_AIC) {
+    // Other numbers in the same cell
+    for (cell_node=(node - node%9); cell_node<(node - node%9 + 9); cell_node++) {
+      if ((cell_node != node) && chain_node_set_contains(&graph->candidates, cell_node))
+        chain_node_set_add(set, cell_node);
+    }
   }
-  if (postfix)
-    printf(" } %s", postfix);
-  else
-    printf(" }");
 }
 
 
-static
-void print_reserved_set_for_cell(struct sudoku_cell *cell)
+static inline
+int chain_sees(const struct chain_graph *graph, unsigned int node1, unsigned int node2)
+{
+  if ((node1 / 9) == (node2 / 9))
+    return (node1 != node2);
+  return chain_node_set_contains(&chain_number_peer_set[node1], node2);
+}
+
+
+static inline
+void chain_add_strong_link(struct chain_graph *graph, unsigned int node1, unsigned int node2)
 {
-  if (cell->board_ref->debug_level > 1)
-    printf("      ");  
-  printf("[%i,%i]  =  ", cell->row, cell->col);
-  print_number_set(cell->reserved_for_number_set, "\n");
+  int i;
+
+  for (i=0; i<graph->strong_link_count[node1]; i++)
+    if (graph->strong_link[node1][i] == node2)
+      return;
+
+  assert(graph->strong_link_count[node1] < CHAIN_MAX_STRONG_LINKS);
+  assert(graph->strong_link_count[node2] < CHAIN_MAX_STRONG_LINKS);
+  graph->strong_link[node1][graph->strong_link_count[node1]++] = node2;
+  graph->strong_link[node2][graph->strong_link_count[node2]++] = node1;
+  chain_node_set_add(&graph->has_strong_link, node1);
+  chain_node_set_add(&graph->has_strong_link, node2);
 }
 
 
 static
-void print_possible(struct sudoku_board *board, const char *prefix)
+void build_chain_graph(struct sudoku_board *board, struct chain_graph *graph, enum chain_mode mode)
 {
-  int row, col, i;
+  unsigned int row, col, tile, index, number, possible_set, number_set, count;
+  unsigned int node1, node2 = 0;
+  unsigned int possible[9][9];
   struct sudoku_cell *cell;
-  unsigned int possible_set, taken_set, available_set, reserved_set;
+
+  graph->mode = mode;
+  chain_node_set_clear(&graph->candidates);
+  chain_node_set_clear(&graph->has_strong_link);
+  for (node1=0; node1<CHAIN_NODE_COUNT; node1++)
+    graph->strong_link_count[node1] = 0;
 
   for (row=0; row<9; row++) {
     for (col=0; col<9; col++) {
       cell = &board->cells[row][col];
+      possible[row][col] = (cell->number ? 0 : get_cell_possible_number_set(cell));
+      possible_set = possible[row][col];
+      while (possible_set) {
+        number = get_next_index_from_set(&possible_set);
+        chain_node_set_add(&graph->candidates, CHAIN_NODE(row, col, number));
+      }
 
-      if (cell->number == 0) {
-
-        if (prefix)
-          printf("%s", prefix);
-        printf("[%i,%i] Possible: ", row, col);
-        possible_set = get_cell_possible_number_set(cell) >> 1;
-        for (i=0; i<9; i++) {
-          if (possible_set & 1)
-            printf("%i ", i+1);
-          possible_set >>= 1;
-        }
-
-        taken_set = *cell->row_number_taken_set_ref;
-        taken_set |= *cell->col_number_taken_set_ref;
-        taken_set |= *cell->tile_number_taken_set_ref;
+      // Bivalue cell
+      if (bit_count[possible[row][col]] == 2) {
+        possible_set = possible[row][col];
+        node1 = CHAIN_NODE(row, col, get_next_index_from_set(&possible_set));
+        node2 = CHAIN_NODE(row, col, get_next_index_from_set(&possible_set));
+        chain_add_strong_link(graph, node1, node2);
+      }
+    }
+  }
 
-        available_set = NUMBER_TAKEN_TO_AVAILABLE_SET(taken_set) >> 1;
+  if (mode == CHAIN_MODE_XY)
+    return;
 
-        printf("   (available:");
-        for (i=0; i<9; i++) {
-          if (available_set & 1)
-            printf(" %i", i+1);
-          available_set >>= 1;
+  // Numbers with two places left in a row, col or tile
+  for (number=1; number<=9; number++) {
+    number_set = NUMBER_TO_SET(number);
+
+    for (row=0; row<9; row++) {
+      count = 0;
+      node1 = 0;
+      for (col=0; col<9; col++) {
+        if (possible[row][col] & number_set) {
+          node2 = node1;
+          node1 = CHAIN_NODE(row, col, number);
+          count++;
         }
+      }
+      if (count == 2)
+        chain_add_strong_link(graph, node1, node2);
+    }
 
-        reserved_set = cell->reserved_for_number_set >> 1;
+    for (col=0; col<9; col++) {
+      count = 0;
+      node1 = 0;
+      for (row=0; row<9; row++) {
+        if (possible[row][col] & number_set) {
+          node2 = node1;
+          node1 = CHAIN_NODE(row, col, number);
+          count++;
+        }
+      }
+      if (count == 2)
+        chain_add_strong_link(graph, node1, node2);
+    }
+
+    for (tile=0; tile<9; tile++) {
+      count = 0;
+      node1 = 0;
+      for (index=0; index<9; index++) {
+        row = (tile / 3) * 3 + index / 3;
+        col = (tile % 3) * 3 + index % 3;
+        if (possible[row][col] & number_set) {
+          node2 = node1;
+          node1 = CHAIN_NODE(row, col, number);
+          count++;
+        }
+      }
+      if (count == 2)
+        chain_add_strong_link(graph, node1, node2);
+    }
+  }
+}
+
+
+// Follows the chains from start assumed false. Adds the nodes that can be eliminated to eliminate_set,
+// returns 1 if start must be true.
+static
+int search_chains_from(const struct chain_graph *graph, unsigned int start, unsigned int max_length,
+                       struct chain_node_set *eliminate_set)
+{
+  struct chain_node_set on_set, off_set, new_on_set, new_off_set, strong_set, start_peer_set, both_set;
+  unsigned int length, node, end, i;
+  int w;
+
+  chain_node_set_clear(&on_set);
+  chain_node_set_clear(&off_set);
+  chain_node_set_clear(&new_off_set);
+  chain_node_set_add(&off_set, start);
+  chain_node_set_add(&new_off_set, start);
+
+  chain_node_set_clear(&start_peer_set);
+  chain_add_weak_links(graph, start, &start_peer_set, CHAIN_MODE_AIC);
+
+  length = 0;
+  while (length < max_length) {
+    // Strong links: false -> true
+    chain_node_set_clear(&new_on_set);
+    for (w=0; w<CHAIN_NODE_SET_WORDS; w++)
+      strong_set.bits[w] = new_off_set.bits[w] & graph->has_strong_link.bits[w];
+    while (!chain_node_set_is_empty(&strong_set)) {
+      node = chain_node_set_next(&strong_set);
+      for (i=0; i<graph->strong_link_count[node]; i++) {
+        end = graph->strong_link[node][i];
+        if (!chain_node_set_contains(&on_set, end))
+          chain_node_set_add(&new_on_set, end);
+      }
+    }
+    length++;
+    if (chain_node_set_is_empty(&new_on_set))
+      break;
+
+    // Either start or end is true - eliminate the nodes that see both
+    while (!chain_node_set_is_empty(&new_on_set)) {
+      end = chain_node_set_next(&new_on_set);
+      if ((end == start) || chain_node_set_contains(&off_set, end))
+        return 1; // Contradiction - start can't be false
+
+      chain_node_set_clear(&both_set);
+      chain_add_weak_links(graph, end, &both_set, CHAIN_MODE_AIC);
+      for (w=0; w<CHAIN_NODE_SET_WORDS; w++)
+        if (both_set.bits[w] & on_set.bits[w])
+          return 1; // Contradiction - two nodes that see each other are both true
+      chain_node_set_add(&on_set, end);
+
+      for (w=0; w<CHAIN_NODE_SET_WORDS; w++)
+        eliminate_set->bits[w] |= (both_set.bits[w] & start_peer_set.bits[w]);
+
+      // Weak links: true -> false
+      chain_add_weak_links(graph, end, &new_off_set, graph->mode);
+    }
+    length++;
+
+    for (w=0; w<CHAIN_NODE_SET_WORDS; w++) {
+      new_off_set.bits[w] &= ~off_set.bits[w];
+      off_set.bits[w] |= new_off_set.bits[w];
+    }
+    if (chain_node_set_is_empty(&new_off_set))
+      break;
+  }
+
+  return 0;
+}
+
+
+static
+int solve_chains_with_mode(struct sudoku_board *board, enum chain_mode mode, const char *func_name)
+{
+  struct chain_graph *graph;
+  struct chain_node_set start_set, eliminate_set, true_set;
+  struct sudoku_cell *cell;
+  unsigned int node, number, possible_set, eliminate_number_set;
+  int changed, row, col;
+
+  graph = (struct chain_graph*) malloc(sizeof(struct chain_graph));
+  if (!graph)
+    return 0;
+  build_chain_graph(board, graph, mode);
+
+  // A chain has to start with a strong link
+  chain_node_set_clear(&eliminate_set);
+  chain_node_set_clear(&true_set);
+  start_set = graph->has_strong_link;
+  while (!chain_node_set_is_empty(&start_set)) {
+    node = chain_node_set_next(&start_set);
+    if (search_chains_from(graph, node, board->chain_max_length, &eliminate_set))
+      chain_node_set_add(&true_set, node);
+  }
+  free(graph);
+
+  changed = 0;
+  for (row=0; row<9; row++) {
+    for (col=0; col<9; col++) {
+      cell = &board->cells[row][col];
+      if (cell->number)
+        continue;
+
+      possible_set = get_cell_possible_number_set(cell);
+      for (number=1; number<=9; number++) {
+        if (chain_node_set_contains(&true_set, CHAIN_NODE(row, col, number)) && (possible_set & NUMBER_TO_SET(number))) {
+          TRACE(3, board, TRACE_MUST_BE, func_name, row*9 + col, 0, number, 0, 0);
+          set_cell_number_and_log(cell, number);
+          changed++;
+          break;
+        }
+      }
+      if (cell->number)
+        continue;
+
+      eliminate_number_set = 0;
+      for (number=1; number<=9; number++) {
+        if (chain_node_set_contains(&eliminate_set, CHAIN_NODE(row, col, number)))
+          eliminate_number_set |= NUMBER_TO_SET(number);
+      }
+      if (possible_set & eliminate_number_set)
+        changed += reserve_cell_and_log(cell, (possible_set & ~eliminate_number_set), func_name);
+
+      if (is_board_done(board))
+        return changed;
+    }
+  }
+
+  return changed;
+}
+
+
+static
+int solve_chains(struct sudoku_board *board)
+{
+  int changed, total_changed, round;
+
+  if ((board->chain_max_length == 0) || (board->nest_level > 0))
+    return 0;
+
+  TRACE(2, board, TRACE_TEXT, "Solve chains", 0, 0, 0, 0, 0);
+
+  total_changed = 0;
+  round = 0;
+
+  do {
+    TRACE(2, board, TRACE_TEXT_NUMBER, "  Round ", 0, 0, round, 0, 0);
+    round++;
+
+    // Cheaper XY-chains first, only go for the full graph if they find nothing
+    changed = solve_chains_with_mode(board, CHAIN_MODE_XY, "solve_chains_xy");
+    if (!changed && !is_board_done(board))
+      changed = solve_chains_with_mode(board, CHAIN_MODE_AIC, "solve_chains_aic");
+    total_changed += changed;
+    if (is_board_done(board))
+      break;
+    if (changed) {
+      total_changed += run_pass(board, PASS_PROPAGATE, propagate_constraints);
+      if (is_board_done(board))
+        break;
+      total_changed += solve_eliminate(board);
+      if (is_board_done(board))
+        break;
+      total_changed += solve_tile_interlock(board);
+      if (is_board_done(board))
+        break;
+    }
+  } while (changed && !is_board_done(board));
+
+  return total_changed;
+}
+
+
+// === Failed literal probing ===
+//
+// Before guessing, try both numbers of a few bivalue cells on a scratch board with nothing but
+// naked singles. A number that kills the scratch board can't be right, and cells that get the
+// same number whichever of the two is tried must have that number.
+
+// Naked singles only, returns 0 if the board ends up dead
+static
+int probe_singles(struct sudoku_board *board)
+{
+  unsigned int row, col, row_set, col_set;
+  struct sudoku_cell *cell;
+
+  solve_possible(board);
+
+  row_set = board->row_empty_set;
+  while (row_set) {
+    row = get_next_index_from_set(&row_set);
+    col_set = board->row_cell_empty_set[row];
+    while (col_set) {
+      col = get_next_index_from_set(&col_set);
+      cell = &board->cells[row][col];
+      if (get_cell_possible_number_set(cell) == 0)
+        return 0;
+    }
+  }
+
+  return 1;
+}
+
+
+static
+int solve_probe(struct sudoku_board *board)
+{
+  struct sudoku_board *scratch;
+  struct sudoku_cell *cell, *probe_cell;
+  unsigned int row, col, i, number[2], possible_set, budget;
+  unsigned char grid[2][81];
+  int alive[2], changed;
+
+  // Guesses below the top level don't probe again, it costs more than it saves there
+  if ((board->probe_budget == 0) || (board->nest_level > 0))
+    return 0;
+
+  TRACE(2, board, TRACE_TEXT, "Solve probe", 0, 0, 0, 0, 0);
+
+  scratch = dupilcate_board(board);
+  if (!scratch)
+    return 0;
+
+  changed = 0;
+  budget = board->probe_budget;
+  if (board->stats)
+    board->stats->probe_rounds++;
+  for (row=0; (row<9) && budget && !is_board_done(board); row++) {
+    for (col=0; (col<9) && budget; col++) {
+      probe_cell = &board->cells[row][col];
+      if (probe_cell->number)
+        continue;
+      possible_set = get_cell_possible_number_set(probe_cell);
+      if (bit_count[possible_set] != 2)
+        continue;
+      budget--;
+      if (board->stats)
+        board->stats->probes++;
+
+      number[0] = get_next_index_from_set(&possible_set);
+      number[1] = get_next_index_from_set(&possible_set);
+      for (i=0; i<2; i++) {
+        copy_board(board, scratch);
+        scratch->debug_level = 0;
+        set_cell_number(&scratch->cells[row][col], number[i]);
+        alive[i] = probe_singles(scratch);
+        board_to_grid(scratch, grid[i]);
+      }
+
+      if (!alive[0] && !alive[1]) {
+        set_board_dead(board, __func__);
+        break;
+      } else if (!alive[0] || !alive[1]) {
+        // Only one of the numbers survives
+        TRACE(3, board, TRACE_PROBE_DEAD, __func__, row*9 + col, 0, number[alive[0] ? 1 : 0], 0, 0);
+        set_cell_number_and_log(probe_cell, number[alive[0] ? 0 : 1]);
+        changed++;
+      } else {
+        // Both survive - keep what they agree on
+        for (i=0; i<81; i++) {
+          cell = &board->cells[i / 9][i % 9];
+          if ((cell->number == 0) && grid[0][i] && (grid[0][i] == grid[1][i]) &&
+              (get_cell_possible_number_set(cell) & NUMBER_TO_SET(grid[0][i]))) {
+            TRACE(3, board, TRACE_PROBE_EITHER_WAY, __func__, cell->row*9 + cell->col, 0, grid[0][i], 0, 0);
+            set_cell_number_and_log(cell, grid[0][i]);
+            changed++;
+          }
+        }
+      }
+
+      if (changed)
+        changed += run_pass(board, PASS_PROPAGATE, propagate_constraints);
+      if (is_board_done(board))
+        break;
+    }
+  }
+
+  destroy_board(&scratch);
+
+  return changed;
+}
+
+
+static
+int solve_probes(struct sudoku_board *board)
+{
+  int changed, total_changed;
+
+  total_changed = 0;
+
+  do {
+    changed = solve_probe(board);
+    total_changed += changed;
+    if (is_board_done(board))
+      break;
+    if (changed) {
+      total_changed += solve_eliminate(board);
+      if (is_board_done(board))
+        break;
+      total_changed += solve_tile_interlock(board);
+      if (is_board_done(board))
+        break;
+      total_changed += solve_chains(board);
+    }
+  } while (changed && !is_board_done(board));
+
+  return total_changed;
+}
+
+
+static inline
+void solve_hidden_cell(struct sudoku_cell *cell)
+{
+  unsigned int number, number_set, depth;
+  struct sudoku_board *board;
+  struct sudoku_board *future_board;
+
+  board = cell->board_ref;
+  depth = ((board->nest_level < SEARCH_DEPTH_COUNT) ? board->nest_level : SEARCH_DEPTH_COUNT - 1);
+  if (board->stats)
+    board->stats->branch_points[depth]++;
+
+  number_set = get_cell_possible_number_set(cell);
+  while (number_set) {
+    number = get_next_index_from_set(&number_set);
+    TRACE(1, board, TRACE_GUESS, NULL, cell->row*9 + cell->col, 0, number, 0, 0);
+
+    future_board = dupilcate_board(board);
+    future_board->nest_level++;
+    if (board->stats) {
+      board->stats->guesses++;
+      board->stats->branches[depth]++;
+      board->stats->placements[STRATEGY_GUESS]++;
+      if (future_board->nest_level > board->stats->max_nest_level)
+        board->stats->max_nest_level = future_board->nest_level;
+    }
+    if (board->debug_level < 3)
+      future_board->debug_level = 0;
+    set_cell_number(&future_board->cells[cell->row][cell->col], number);
+    solve(future_board);
+
+    if (future_board->undetermined_count == 0) {
+      // Add to list of solutions
+      TRACE(1, board, TRACE_GUESS_SOLVED, NULL, cell->row*9 + cell->col, 0, number, 0, 0);
+      assert(future_board->solutions_list == NULL);
+      assert(future_board->solutions_count == 0);
+      add_to_board_solutions_list(board, future_board);
+      if (is_board_solved(board))
+        return;
+    } else if (future_board->solutions_list) {
+      // Add to list of solutions
+      TRACE(1, board, TRACE_GUESS_SOLVED, NULL, cell->row*9 + cell->col, 0, number, 0, 0);
+      add_list_to_board_solutions_list(board, future_board->solutions_list);
+      future_board->solutions_list = NULL;
+      future_board->solutions_count = 0;
+      destroy_board(&future_board);
+      if (is_board_solved(board))
+        return;
+    } else {
+      if (board->stats)
+        board->stats->backtracks++;
+      destroy_board(&future_board);
+    }
+  }
+}
+
+
+// Returns the number of solutions found
+static
+int solve_hidden(struct sudoku_board *board)
+{
+  struct sudoku_cell *cell;
+  struct sudoku_board *tmp;
+
+  TRACE(2, board, TRACE_TEXT, "Solve hidden", 0, 0, 0, 0, 0);
+  if (TRACE_ON(2, board)) {
+    trace_board(board);
+    trace_possible(board, 0);
+  }
+
+  // Is the board good to go to another nest level?
+  cell = find_cell_with_lowest_availability_count(board);
+  if (cell) {
+    solve_hidden_cell(cell);
+
+    // The top board becomes the first solution found, the list keeps any others
+    if ((board->nest_level == 0) && (board->solutions_count > 0)) {
+      tmp = board->solutions_list;
+      board->solutions_list = tmp->next;
+      tmp->next = NULL;
+      board->solutions_count--;
+      tmp->nest_level = board->nest_level;
+      copy_board(tmp, board);
+      destroy_board(&tmp);
+    }
+  }
+
+  return board->solutions_count + (board->undetermined_count == 0);
+}
+
+
+const char* get_strategy_name(enum sudoku_strategy strategy)
+{
+  static const char *strategy_names[STRATEGY_COUNT] = { "singles", "eliminate", "interlock", "chains", "probes", "guess" };
+
+  assert(strategy < STRATEGY_COUNT);
+  return strategy_names[strategy];
+}
+
+
+const char* get_pass_name(enum sudoku_pass pass)
+{
+  static const char *pass_names[PASS_COUNT] = {
+    "propagate_constraints", "solve_possible",
+    "solve_eliminate_tiles_by_index", "solve_eliminate_tiles_by_number", "solve_eliminate_rows_by_number",
+    "solve_eliminate_cols_by_number", "solve_eliminate_rows_by_index", "solve_eliminate_cols_by_index",
+    "solve_tile_interlock", "solve_chains", "solve_probes", "solve_hidden"
+  };
+
+  assert(pass < PASS_COUNT);
+  return pass_names[pass];
+}
+
+
+// Adds up the statistics of several solves, the deepest nest level is kept
+void add_stats(struct sudoku_stats *total, const struct sudoku_stats *stats)
+{
+  int i, j;
+
+  total->guesses += stats->guesses;
+  total->probe_rounds += stats->probe_rounds;
+  total->probes += stats->probes;
+  if (stats->max_nest_level > total->max_nest_level)
+    total->max_nest_level = stats->max_nest_level;
+  for (i=0; i<STRATEGY_COUNT; i++)
+    total->placements[i] += stats->placements[i];
+  for (i=0; i<PASS_COUNT; i++) {
+    total->passes[i].calls += stats->passes[i].calls;
+    total->passes[i].placements += stats->passes[i].placements;
+    total->passes[i].changes += stats->passes[i].changes;
+    total->passes[i].cycles += stats->passes[i].cycles;
+  }
+  for (i=0; i<STRATEGY_COUNT; i++) {
+    for (j=0; j<PERF_EVENT_COUNT; j++)
+      total->perf[i][j] += stats->perf[i][j];
+  }
+  total->perf_steps += stats->perf_steps;
+  total->perf_multiplexed += stats->perf_multiplexed;
+  total->nodes += stats->nodes;
+  total->backtracks += stats->backtracks;
+  for (i=0; i<STRATEGY_COUNT; i++)
+    total->dead_ends[i] += stats->dead_ends[i];
+  for (i=0; i<SEARCH_DEPTH_COUNT; i++) {
+    total->branch_points[i] += stats->branch_points[i];
+    total->branches[i] += stats->branches[i];
+  }
+}
+
+
+// Counts one puzzle's search in the histogram
+void add_to_search_histogram(struct sudoku_search_histogram *histogram, const struct sudoku_stats *stats)
+{
+  unsigned long nodes;
+  unsigned int depth;
+  int bucket;
+
+  // Puzzles that weren't searched, like cache hits, aren't counted
+  if (stats->nodes == 0)
+    return;
+
+  nodes = stats->nodes;
+  for (bucket=0; (nodes > 1) && (bucket < SEARCH_NODES_BUCKET_COUNT-1); bucket++)
+    nodes >>= 1;
+
+  depth = ((stats->max_nest_level < SEARCH_DEPTH_COUNT) ? stats->max_nest_level : SEARCH_DEPTH_COUNT - 1);
+
+  histogram->puzzles++;
+  histogram->max_nest_levels[depth]++;
+  histogram->nodes[bucket]++;
+}
+
+
+// Adds the numbers placed since the last call to the strategy's count. A dead board is only
+// seen once, since solve() runs no more steps on it.
+static inline
+void count_placements(struct sudoku_board *board, enum sudoku_strategy strategy, unsigned int *undetermined_count)
+{
+  if (board->stats) {
+    board->stats->placements[strategy] += *undetermined_count - board->undetermined_count;
+    if (board->dead)
+      board->stats->dead_ends[strategy]++;
+  }
+  *undetermined_count = board->undetermined_count;
+}
+
+
+// Adds the hardware counts since the last read to the step that just ran. They're read
+// between the steps of solve() on the puzzle itself only, a handful of reads a puzzle, so the
+// nested boards of the guesses are counted in with the guesses. Returns 0 if the read failed.
+static inline
+int count_perf(struct sudoku_board *board, enum sudoku_strategy strategy, struct sudoku_perf_sample *sample)
+{
+  struct sudoku_perf_sample end_sample;
+
+  if (read_perf_counters(&end_sample) != 0)
+    return 0;
+
+  board->stats->perf_steps++;
+  board->stats->perf_multiplexed += add_perf_counts(board->stats->perf[strategy], sample, &end_sample);
+  *sample = end_sample;
+
+  return 1;
+}
+
+
+int solve(struct sudoku_board *board)
+{
+  struct sudoku_perf_sample perf_sample;
+  int solutions_count, perf_read;
+  unsigned int undetermined_count;
+
+  undetermined_count = board->undetermined_count;
+  if (board->stats)
+    board->stats->nodes++;
+  perf_read = (board->stats && board->stats->count_perf && (board->nest_level == 0) &&
+               (read_perf_counters(&perf_sample) == 0));
+
+  run_pass(board, PASS_POSSIBLE, solve_possible);
+  count_placements(board, STRATEGY_SINGLES, &undetermined_count);
+  if (perf_read)
+    perf_read = count_perf(board, STRATEGY_SINGLES, &perf_sample);
+
+  if (!is_board_done(board)) {
+    solve_eliminate(board);
+    count_placements(board, STRATEGY_ELIMINATE, &undetermined_count);
+    if (perf_read)
+      perf_read = count_perf(board, STRATEGY_ELIMINATE, &perf_sample);
+  }
+
+  if (!is_board_done(board)) {
+    run_pass(board, PASS_TILE_INTERLOCK, solve_tile_interlock);
+    count_placements(board, STRATEGY_INTERLOCK, &undetermined_count);
+    if (perf_read)
+      perf_read = count_perf(board, STRATEGY_INTERLOCK, &perf_sample);
+  }
+
+  if (!is_board_done(board)) {
+    run_pass(board, PASS_CHAINS, solve_chains);
+    count_placements(board, STRATEGY_CHAINS, &undetermined_count);
+    if (perf_read)
+      perf_read = count_perf(board, STRATEGY_CHAINS, &perf_sample);
+  }
+
+  if (board->guessing_allowed) {
+    if (!is_board_done(board)) {
+      run_pass(board, PASS_PROBES, solve_probes);
+      count_placements(board, STRATEGY_PROBES, &undetermined_count);
+      if (perf_read)
+        perf_read = count_perf(board, STRATEGY_PROBES, &perf_sample);
+    }
+
+    // Placements in guesses are counted by the nested boards
+    if (!is_board_done(board)) {
+      run_pass(board, PASS_HIDDEN, solve_hidden);
+      if (perf_read)
+        perf_read = count_perf(board, STRATEGY_GUESS, &perf_sample);
+    }
+  }
+
+  solutions_count = board->solutions_count;
+  if (board->undetermined_count == 0)
+    solutions_count++;
+
+  return solutions_count;
+}
+
+
+static
+void print_index_set(unsigned int index_set, const char *postfix)
+{
+  int index;
+
+  printf("{");
+  for (index=0; index<=8; index++) {
+    if (index_set & INDEX_TO_SET(index))
+      printf(" %i", index);
+  }
+  if (postfix)
+    printf(" } %s", postfix);
+  else
+    printf(" }");
+}
+
+
+static
+void print_number_set(unsigned int number_set, const char *postfix)
+{
+  int number;
+
+  printf("{");
+  for (number=1; number<=9; number++) {
+    if (number_set & NUMBER_TO_SET(number))
+      printf(" %i", number);
+  }
+  if (postfix)
+    printf(" } %s", postfix);
+  else
+    printf(" }");
+}
+
+
+static
+void print_possible(struct sudoku_board *board, const char *prefix)
+{
+  int row, col, i;
+  struct sudoku_cell *cell;
+  unsigned int possible_set, taken_set, available_set, reserved_set;
+
+  for (row=0; row<9; row++) {
+    for (col=0; col<9; col++) {
+      cell = &board->cells[row][col];
+
+      if (cell->number == 0) {
+
+        if (prefix)
+          printf("%s", prefix);
+        printf("[%i,%i] Possible: ", row, col);
+        possible_set = get_cell_possible_number_set(cell) >> 1;
+        for (i=0; i<9; i++) {
+          if (possible_set & 1)
+            printf("%i ", i+1);
+          possible_set >>= 1;
+        }
+
+        taken_set = *cell->row_number_taken_set_ref;
+        taken_set |= *cell->col_number_taken_set_ref;
+        taken_set |= *cell->tile_number_taken_set_ref;
+
+        available_set = NUMBER_TAKEN_TO_AVAILABLE_SET(taken_set) >> 1;
+
+        printf("   (available:");
+        for (i=0; i<9; i++) {
+          if (available_set & 1)
+            printf(" %i", i+1);
+          available_set >>= 1;
+        }
+
+        reserved_set = cell->reserved_for_number_set >> 1;
         if (reserved_set) {
           printf("  reserved:");
           for (i=0; i<9; i++) {
@@ -1916,6 +2672,47 @@ void print_possible(struct sudoku_board *board, const char *prefix)
 }
 
 
+// Traces the board as nine rows of numbers packed 4 bits each
+static
+void trace_board(struct sudoku_board *board)
+{
+  int row, col;
+  unsigned long numbers;
+
+  for (row=0; row<9; row++) {
+    numbers = 0;
+    for (col=8; col>=0; col--)
+      numbers = (numbers << 4) | board->cells[row][col].number;
+    trace_event(board, TRACE_BOARD_ROW, NULL, row, 0, numbers & 0xFFFF, (numbers >> 16) & 0xFFFF, numbers >> 32);
+  }
+}
+
+
+// Traces what print_possible() prints
+static
+void trace_possible(struct sudoku_board *board, int indented)
+{
+  int row, col;
+  struct sudoku_cell *cell;
+  unsigned int taken_set;
+
+  for (row=0; row<9; row++) {
+    for (col=0; col<9; col++) {
+      cell = &board->cells[row][col];
+      if (cell->number)
+        continue;
+
+      taken_set = *cell->row_number_taken_set_ref;
+      taken_set |= *cell->col_number_taken_set_ref;
+      taken_set |= *cell->tile_number_taken_set_ref;
+
+      trace_event(board, TRACE_POSSIBLE, NULL, row*9 + col, indented, get_cell_possible_number_set(cell),
+                  NUMBER_TAKEN_TO_AVAILABLE_SET(taken_set), cell->reserved_for_number_set);
+    }
+  }
+}
+
+
 void print_solutions(struct sudoku_board *board)
 {
   struct sudoku_board *current;
@@ -1925,7 +2722,12 @@ void print_solutions(struct sudoku_board *board)
     if (board->undetermined_count)
       print_possible(board, NULL);
   } else {
-    printf("Number of solutions: %i\n", board->solutions_count);
+    // A solved board is the first solution, the list has the others
+    printf("Number of solutions: %i\n", board->solutions_count + (board->undetermined_count == 0));
+    if (board->undetermined_count == 0) {
+      print_board(board);
+      printf("\n\n");
+    }
     current = board->solutions_list;
     while (current) {
       print_board(current);
@@ -1937,19 +2739,157 @@ void print_solutions(struct sudoku_board *board)
 }
 
 
+// Converts exactly 81 chars of [0-9.] to numbers, returns 0 if any other char is found
+static inline
+int convert_board_line(const char *str, unsigned char grid[81])
+{
+#ifdef __SSE2__
+  __m128i chars, numbers, dots, valid;
+  unsigned int i, valid_mask;
+
+  // A char is valid if it's a '.' or a digit - '0' with an unsigned value of at most 9
+  valid_mask = 0xFFFF;
+  for (i=0; i<80; i+=16) {
+    chars = _mm_loadu_si128((const __m128i*) (str + i));
+    numbers = _mm_sub_epi8(chars, _mm_set1_epi8('0'));
+    dots = _mm_cmpeq_epi8(chars, _mm_set1_epi8('.'));
+    valid = _mm_or_si128(dots, _mm_cmpeq_epi8(_mm_min_epu8(numbers, _mm_set1_epi8(9)), numbers));
+    valid_mask &= _mm_movemask_epi8(valid);
+    _mm_storeu_si128((__m128i*) (grid + i), _mm_andnot_si128(dots, numbers));
+  }
+  if (valid_mask != 0xFFFF)
+    return 0;
+#else
+  unsigned int i;
+
+  for (i=0; i<80; i++) {
+    if (str[i] == '.')
+      grid[i] = 0;
+    else if ((str[i] >= '0') && (str[i] <= '9'))
+      grid[i] = str[i] - '0';
+    else
+      return 0;
+  }
+#endif
+
+  if (str[80] == '.')
+    grid[80] = 0;
+  else if ((str[80] >= '0') && (str[80] <= '9'))
+    grid[80] = str[80] - '0';
+  else
+    return 0;
+
+  return 1;
+}
+
+
+// Fast path for a fresh board, returns 0 if the board isn't fresh or the grid has clashing
+// numbers and the board is left untouched
+static
+int fill_board_grid(struct sudoku_board *board, const unsigned char grid[81])
+{
+  unsigned int row_taken_set[9], col_taken_set[9], tile_taken_set[9];
+  unsigned int i, number_set, undetermined_count;
+  struct sudoku_cell *cell;
+
+  if (board->undetermined_count != (9*9))
+    return 0;
+
+  // Build the taken sets in bulk, a number already in a row, col or tile means a clash
+  for (i=0; i<9; i++) {
+    row_taken_set[i] = 0;
+    col_taken_set[i] = 0;
+    tile_taken_set[i] = 0;
+  }
+  for (i=0; i<81; i++) {
+    if (grid[i] == 0)
+      continue;
+    cell = &board->cells[i / 9][i % 9];
+    number_set = NUMBER_TO_SET(grid[i]);
+    if ((row_taken_set[cell->row] | col_taken_set[cell->col] | tile_taken_set[cell->tile]) & number_set)
+      return 0;
+    row_taken_set[cell->row] |= number_set;
+    col_taken_set[cell->col] |= number_set;
+    tile_taken_set[cell->tile] |= number_set;
+  }
+
+  // All good - fill in the board
+  undetermined_count = (9*9);
+  for (i=0; i<81; i++) {
+    if (grid[i] == 0)
+      continue;
+    cell = &board->cells[i / 9][i % 9];
+    cell->number = grid[i];
+    cell->reserved_for_number_set = NUMBER_TO_SET(grid[i]);
+    *cell->row_cell_empty_set_ref &= ~(INDEX_TO_SET(cell->col));
+    *cell->col_cell_empty_set_ref &= ~(INDEX_TO_SET(cell->row));
+    *cell->tile_cell_empty_set_ref &= ~(INDEX_TO_SET(cell->index_in_tile));
+    undetermined_count--;
+  }
+  board->undetermined_count = undetermined_count;
+
+  for (i=0; i<9; i++) {
+    board->row_number_taken_set[i] = row_taken_set[i];
+    board->col_number_taken_set[i] = col_taken_set[i];
+    board->tile_number_taken_set[i] = tile_taken_set[i];
+    if (board->row_cell_empty_set[i] == 0)
+      board->row_empty_set &= ~(INDEX_TO_SET(i));
+    if (board->col_cell_empty_set[i] == 0)
+      board->col_empty_set &= ~(INDEX_TO_SET(i));
+    if (board->tile_cell_empty_set[i] == 0)
+      board->tile_empty_set &= ~(INDEX_TO_SET(i));
+  }
+
+  board->row_dirty_set = INDEX_SET_MASK;
+  board->col_dirty_set = INDEX_SET_MASK;
+  board->tile_dirty_set = INDEX_SET_MASK;
+
+  return 1;
+}
+
+
+// Fast path for a fresh board and a line of exactly 81 chars of [0-9.], returns 0 if the
+// line is anything else (or has clashing numbers) and the board is left untouched
+static
+int read_board_line(struct sudoku_board *board, const char *str, size_t length)
+{
+  unsigned char grid[81];
+
+  if ((length < 81) || (board->undetermined_count != (9*9)))
+    return 0;
+  if ((length > 81) && (str[81] != '\n') && (str[81] != '\r') && (str[81] != 0))
+    return 0;
+  if (!convert_board_line(str, grid))
+    return 0;
+
+  return fill_board_grid(board, grid);
+}
+
+
 int read_board(struct sudoku_board *board, const char *str)
+{
+  return read_board_length(board, str, strlen(str));
+}
+
+
+// Reads at most length chars, so it can parse straight out of a mapped file
+int read_board_length(struct sudoku_board *board, const char *str, size_t length)
 {
   int row, col, result;
   char ch;
   unsigned int number;
 
-  assert(str);
+  assert(str || (length == 0));
+
+  // Most puzzles come as one line of 81 chars
+  if (read_board_line(board, str, length))
+    return 0;
 
   row = 0;
   col = 0;
   result = 0;
 
-  while ((ch = *str++)) {
+  while (length-- && (ch = *str++)) {
     if ((ch == '.') || (ch == '?'))
       ch = '0';
 
@@ -1977,3 +2917,93 @@ int read_board(struct sudoku_board *board, const char *str)
 
   return result;
 }
+
+
+// Reads the numbers as they are, without checking them against each other, returns how many
+// cells were read (81 for a whole puzzle), the cells after those are left empty
+int read_grid_length(const char *str, size_t length, unsigned char grid[81])
+{
+  int cell_count;
+  char ch;
+
+  assert(str || (length == 0));
+
+  if ((length >= 81) && ((length == 81) || (str[81] == '\n') || (str[81] == '\r') || (str[81] == 0)) &&
+      convert_board_line(str, grid))
+    return 81;
+
+  cell_count = 0;
+  while ((cell_count < 81) && length-- && (ch = *str++)) {
+    if ((ch == '.') || (ch == '?'))
+      grid[cell_count++] = 0;
+    else if ((ch >= '0') && (ch <= '9'))
+      grid[cell_count++] = ch - '0';
+  }
+  memset(grid + cell_count, 0, 81 - cell_count);
+
+  return cell_count;
+}
+
+
+// Returns 1 if a number is given more than once in a row, col or tile
+int grid_has_clashes(const unsigned char grid[81])
+{
+  unsigned int row_taken_set[9], col_taken_set[9], tile_taken_set[9];
+  unsigned int i, row, col, tile, number_set;
+
+  for (i=0; i<9; i++) {
+    row_taken_set[i] = 0;
+    col_taken_set[i] = 0;
+    tile_taken_set[i] = 0;
+  }
+  for (i=0; i<81; i++) {
+    if (grid[i] == 0)
+      continue;
+    row = i / 9;
+    col = i % 9;
+    tile = (row / 3) * 3 + col / 3;
+    number_set = NUMBER_TO_SET(grid[i]);
+    if ((row_taken_set[row] | col_taken_set[col] | tile_taken_set[tile]) & number_set)
+      return 1;
+    row_taken_set[row] |= number_set;
+    col_taken_set[col] |= number_set;
+    tile_taken_set[tile] |= number_set;
+  }
+
+  return 0;
+}
+
+
+int read_board_grid(struct sudoku_board *board, const unsigned char grid[81])
+{
+  int row, col, result;
+  unsigned int number;
+  struct sudoku_cell *cell;
+
+  // Most grids go on a fresh board without clashes
+  if (fill_board_grid(board, grid))
+    return 0;
+
+  result = 0;
+
+  for (row=0; row<9; row++) {
+    for (col=0; col<9; col++) {
+      cell = &board->cells[row][col];
+      number = grid[row*9 + col];
+
+      if ((number == 0) || (cell->number == number))
+        continue;
+
+      if ((cell->number == 0) && (get_cell_possible_number_set(cell) & NUMBER_TO_SET(number))) {
+        set_cell_number(cell, number);
+      } else {
+        result = 1; // Invalid input
+
+        if (board->debug_level)
+          printf("[%i,%i] = %i - Invalid assignment, ingoring it\n", row, col, number);
+      }
+    }
+  }
+
+  return result;
+}
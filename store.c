@@ -0,0 +1,385 @@
+//
+// sudoku - A SuDoKu solver
+//
+// Copyright (c) 2018  Linde Labs, LLC
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include "sudoku.h"
+
+
+// === Persistent memory-mapped solution store ===
+//
+// The store file is a header followed by a fixed number of fixed-size slots, used as an open
+// addressing hash table (linear probing) keyed by the packed puzzle. Records are never changed
+// or removed once written, so readers need no locks:
+//   - Only one writer at a time, guarded by an exclusive flock() on the file.
+//   - The writer fills in a record and then publishes it by setting its state with release
+//     semantics. Readers load the state with acquire semantics and ignore unpublished records.
+// The file is created at full size (sparse) under a temporary name and renamed into place,
+// so readers never see a partially initialized store.
+// When the store gets too full the writer rehashes it into a file with twice the slots, locked
+// before it is renamed over the old one. Readers that have the old file open keep reading it, they
+// just don't see what is added after the switch.
+
+
+// Defines
+
+#define STORE_MAGIC         "SDKSTOR1"
+#define STORE_VERSION       1
+#define STORE_RECORD_EMPTY  0
+#define STORE_RECORD_FULL   1
+#define STORE_MAX_LOAD(slot_count) (((slot_count) / 4) * 3)
+
+
+// Struct & types
+
+struct sudoku_store_header {
+  char magic[8];
+  unsigned int version;
+  unsigned int record_size;
+  unsigned long slot_count;
+  unsigned long record_count;
+  unsigned char reserved[32];
+};
+
+struct sudoku_store_record {
+  unsigned int state;
+  unsigned char flags;
+  unsigned char solutions_count;
+  unsigned char puzzle[PACKED_GRID_SIZE];
+  unsigned char solution[PACKED_GRID_SIZE];
+};
+
+
+// Functions
+
+static
+char* get_tmp_file_name(const char *file_name)
+{
+  char *tmp_file_name;
+
+  tmp_file_name = (char*) malloc(strlen(file_name) + 16);
+  if (tmp_file_name)
+    sprintf(tmp_file_name, "%s.%i.tmp", file_name, (int)getpid());
+  return tmp_file_name;
+}
+
+
+// Empty slots are all zero, so a sparse file is a valid empty store
+static
+int init_store_file(int fd, unsigned long slot_count)
+{
+  struct sudoku_store_header header;
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, STORE_MAGIC, sizeof(header.magic));
+  header.version = STORE_VERSION;
+  header.record_size = sizeof(struct sudoku_store_record);
+  header.slot_count = slot_count;
+  header.record_count = 0;
+
+  if ((ftruncate(fd, sizeof(header) + slot_count * sizeof(struct sudoku_store_record)) != 0) ||
+      (write(fd, &header, sizeof(header)) != sizeof(header)))
+    return -1;
+  return 0;
+}
+
+
+static
+int create_store_file(const char *file_name, unsigned long slot_count)
+{
+  char *tmp_file_name;
+  int fd, status;
+
+  tmp_file_name = get_tmp_file_name(file_name);
+  if (!tmp_file_name)
+    return -1;
+
+  fd = open(tmp_file_name, O_RDWR | O_CREAT | O_EXCL, 0644);
+  if (fd < 0) {
+    free(tmp_file_name);
+    return -1;
+  }
+
+  status = 0;
+  if ((init_store_file(fd, slot_count) != 0) || (fsync(fd) != 0))
+    status = -1;
+  close(fd);
+
+  // Don't replace a store someone else created in the meantime
+  if ((status == 0) && (link(tmp_file_name, file_name) != 0) && (errno != EEXIST))
+    status = -1;
+  unlink(tmp_file_name);
+  free(tmp_file_name);
+
+  return status;
+}
+
+
+// slot_count is only used when a writable store has to be created
+struct sudoku_store* open_store(const char *file_name, int writable, unsigned long slot_count)
+{
+  struct sudoku_store *store;
+  struct sudoku_store_header *header;
+  struct stat st;
+  int fd;
+
+  if (writable && (access(file_name, F_OK) != 0)) {
+    if (create_store_file(file_name, slot_count) != 0)
+      return NULL;
+  }
+
+  fd = open(file_name, (writable ? O_RDWR : O_RDONLY));
+  if (fd < 0)
+    return NULL;
+
+  // Only one writer - fall back to read only if someone else is writing
+  if (writable && (flock(fd, LOCK_EX | LOCK_NB) != 0)) {
+    close(fd);
+    fd = open(file_name, O_RDONLY);
+    if (fd < 0)
+      return NULL;
+    writable = 0;
+  }
+
+  if ((fstat(fd, &st) != 0) || (st.st_size < sizeof(struct sudoku_store_header))) {
+    close(fd);
+    return NULL;
+  }
+
+  store = (struct sudoku_store*) malloc(sizeof(struct sudoku_store));
+  if (!store) {
+    close(fd);
+    return NULL;
+  }
+
+  store->file_name = strdup(file_name);
+  if (!store->file_name) {
+    free(store);
+    close(fd);
+    return NULL;
+  }
+
+  store->map_size = st.st_size;
+  store->map = mmap(NULL, store->map_size, (writable ? (PROT_READ | PROT_WRITE) : PROT_READ), MAP_SHARED, fd, 0);
+  if (store->map == MAP_FAILED) {
+    free(store->file_name);
+    free(store);
+    close(fd);
+    return NULL;
+  }
+
+  header = (struct sudoku_store_header*) store->map;
+  if ((memcmp(header->magic, STORE_MAGIC, sizeof(header->magic)) != 0) ||
+      (header->version != STORE_VERSION) ||
+      (header->record_size != sizeof(struct sudoku_store_record)) ||
+      (header->slot_count == 0) ||
+      ((header->slot_count & (header->slot_count - 1)) != 0) ||
+      (store->map_size < sizeof(*header) + header->slot_count * sizeof(struct sudoku_store_record))) {
+    fprintf(stderr, "Not a valid solution store: %s\n", file_name);
+    munmap(store->map, store->map_size);
+    free(store->file_name);
+    free(store);
+    close(fd);
+    return NULL;
+  }
+
+  store->fd = fd;
+  store->writable = writable;
+  store->header = header;
+  store->records = (struct sudoku_store_record*) (header + 1);
+  store->slot_mask = header->slot_count - 1;
+  store->hits = 0;
+  store->misses = 0;
+  store->inserts = 0;
+  store->skipped = 0;
+  store->grows = 0;
+
+  return store;
+}
+
+
+void close_store(struct sudoku_store **store)
+{
+  if (*store) {
+    if ((*store)->writable)
+      msync((*store)->map, (*store)->map_size, MS_ASYNC);
+    munmap((*store)->map, (*store)->map_size);
+    close((*store)->fd); // Also releases the writer lock
+    free((*store)->file_name);
+    free(*store);
+    *store = NULL;
+  }
+}
+
+
+// Returns the slot holding the puzzle or the empty slot where it would go, NULL if the store is full
+static
+struct sudoku_store_record* store_find_slot(struct sudoku_store *store, const unsigned char puzzle[PACKED_GRID_SIZE], unsigned int flags)
+{
+  struct sudoku_store_record *record;
+  unsigned long slot, probes;
+
+  slot = packed_grid_hash(puzzle, flags) & store->slot_mask;
+  for (probes=0; probes<=store->slot_mask; probes++) {
+    record = &store->records[slot];
+    if (__atomic_load_n(&record->state, __ATOMIC_ACQUIRE) != STORE_RECORD_FULL)
+      return record;
+    if ((record->flags == flags) && (memcmp(record->puzzle, puzzle, PACKED_GRID_SIZE) == 0))
+      return record;
+    slot = (slot + 1) & store->slot_mask;
+  }
+  return NULL;
+}
+
+
+int store_lookup(struct sudoku_store *store, const unsigned char grid[81], unsigned int flags,
+                 unsigned char solution[81], unsigned int *solutions_count)
+{
+  struct sudoku_store_record *record;
+  unsigned char puzzle[PACKED_GRID_SIZE];
+
+  pack_grid(grid, puzzle);
+  record = store_find_slot(store, puzzle, flags);
+  if (!record || (__atomic_load_n(&record->state, __ATOMIC_ACQUIRE) != STORE_RECORD_FULL)) {
+    store->misses++;
+    return 0;
+  }
+
+  store->hits++;
+  unpack_grid(record->solution, solution);
+  if (solutions_count)
+    *solutions_count = record->solutions_count;
+
+  return 1;
+}
+
+
+// Rehashes the records into a new file with twice the slots and switches to it
+static
+int grow_store(struct sudoku_store *store)
+{
+  struct sudoku_store new_store;
+  struct sudoku_store_record *record, *new_record;
+  unsigned long slot_count, slot;
+  char *tmp_file_name;
+  int fd;
+
+  slot_count = 2 * store->header->slot_count;
+  tmp_file_name = get_tmp_file_name(store->file_name);
+  if (!tmp_file_name)
+    return -1;
+
+  // Locked before anyone can open it under the store's name
+  fd = open(tmp_file_name, O_RDWR | O_CREAT | O_EXCL, 0644);
+  if (fd < 0) {
+    free(tmp_file_name);
+    return -1;
+  }
+  if ((flock(fd, LOCK_EX | LOCK_NB) != 0) || (init_store_file(fd, slot_count) != 0)) {
+    close(fd);
+    unlink(tmp_file_name);
+    free(tmp_file_name);
+    return -1;
+  }
+
+  new_store = *store;
+  new_store.fd = fd;
+  new_store.map_size = sizeof(struct sudoku_store_header) + slot_count * sizeof(struct sudoku_store_record);
+  new_store.map = mmap(NULL, new_store.map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (new_store.map == MAP_FAILED) {
+    close(fd);
+    unlink(tmp_file_name);
+    free(tmp_file_name);
+    return -1;
+  }
+  new_store.header = (struct sudoku_store_header*) new_store.map;
+  new_store.records = (struct sudoku_store_record*) (new_store.header + 1);
+  new_store.slot_mask = slot_count - 1;
+
+  // Nobody else sees the new file yet, so no atomics needed
+  for (slot=0; slot<=store->slot_mask; slot++) {
+    record = &store->records[slot];
+    if (record->state != STORE_RECORD_FULL)
+      continue;
+    new_record = store_find_slot(&new_store, record->puzzle, record->flags);
+    *new_record = *record;
+    new_store.header->record_count++;
+  }
+
+  if ((msync(new_store.map, new_store.map_size, MS_SYNC) != 0) || (rename(tmp_file_name, store->file_name) != 0)) {
+    munmap(new_store.map, new_store.map_size);
+    close(fd);
+    unlink(tmp_file_name);
+    free(tmp_file_name);
+    return -1;
+  }
+  free(tmp_file_name);
+
+  munmap(store->map, store->map_size);
+  close(store->fd); // Releases the lock on the old file
+  *store = new_store;
+  store->grows++;
+
+  return 0;
+}
+
+
+// Returns -1 if the solution could not be kept
+int store_insert(struct sudoku_store *store, const unsigned char grid[81], unsigned int flags,
+                 const unsigned char solution[81], unsigned int solutions_count)
+{
+  struct sudoku_store_record *record;
+  unsigned char puzzle[PACKED_GRID_SIZE];
+
+  if (!store->writable)
+    return -1;
+
+  // Full enough that probing gets slow
+  if ((__atomic_load_n(&store->header->record_count, __ATOMIC_RELAXED) >= STORE_MAX_LOAD(store->header->slot_count)) &&
+      (grow_store(store) != 0)) {
+    store->skipped++;
+    return -1;
+  }
+
+  pack_grid(grid, puzzle);
+  record = store_find_slot(store, puzzle, flags);
+  if (!record) {
+    store->skipped++;
+    return -1;
+  }
+  if (__atomic_load_n(&record->state, __ATOMIC_ACQUIRE) == STORE_RECORD_FULL)
+    return 0; // Already there
+
+  // Fill in the record, then publish it
+  record->flags = flags;
+  record->solutions_count = solutions_count;
+  memcpy(record->puzzle, puzzle, PACKED_GRID_SIZE);
+  pack_grid(solution, record->solution);
+  __atomic_store_n(&record->state, STORE_RECORD_FULL, __ATOMIC_RELEASE);
+  __atomic_add_fetch(&store->header->record_count, 1, __ATOMIC_RELEASE);
+  store->inserts++;
+
+  return 0;
+}
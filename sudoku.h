@@ -18,11 +18,44 @@
 #ifndef __SUDOKU_H__
 #define __SUDOKU_H__
 
+#include "libsudoku.h"
+
 // Configuration parameters
 
 #define MAX_CLUE_LIMIT     77 
-#define MAX_SOLUTIONS       1 // 0 = Inifinte
+#define MAX_SOLUTIONS       1 // Solutions searched for by default, 0 = Inifinte
 #define GUESSING_ALLOWED_DEFAULT  1
+#define CHAIN_MAX_LENGTH_DEFAULT  0 // Links in a chain, 0 = no chains - they save too few guesses to pay for themselves
+#define PROBE_BUDGET_DEFAULT      2 // Bivalue cells to probe before guessing, 0 = no probing
+
+#define SERVER_THREAD_COUNT_DEFAULT 8 // Solver threads of a server
+#define BENCH_RUN_COUNT_DEFAULT     5 // Timed runs over each benchmark corpus
+#define SEARCH_DEPTH_COUNT         16 // Nest levels with their own search statistics, deeper ones count as the last
+#define SEARCH_NODES_BUCKET_COUNT  24 // Search histogram buckets, bucket i has 2^i to 2^(i+1)-1 nodes
+#define HISTOGRAM_SUB_BUCKET_BITS   7 // Latency histogram precision, values are off by less than 1/64
+#define HISTOGRAM_MAX_BITS         40 // Longest latency recorded, 2^40 ns is about 18 minutes
+#define HISTOGRAM_BUCKET_COUNT     ((HISTOGRAM_MAX_BITS - HISTOGRAM_SUB_BUCKET_BITS + 2) << (HISTOGRAM_SUB_BUCKET_BITS - 1))
+
+#define PACKED_GRID_SIZE   41 // 81 cells packed 4 bits each
+#define BINARY_HAS_SOLUTIONS  1 // Binary file records have a solution
+#define BINARY_HAS_STATS      2 // Binary file records have a struct sudoku_binary_stats
+#define BINARY_RECORD_SOLVED  1 // Binary file record flags
+#define BINARY_RECORD_CACHED  2 // Solution came from the cache or store
+#define BOARD_LINE_SIZE    82 // 81 numbers and a newline
+#define BOARD_FORMAT_SIZE 512 // Big enough for any of the board formats
+#define STORE_SLOT_COUNT_DEFAULT  (1 << 20) // Slots in a new solution store (power of two)
+#define OUTPUT_BUFFER_COUNT   4 // Batch output buffers, all but one can be in flight
+#define OUTPUT_BUFFER_SIZE   (1 << 20)
+#define TRACE_BUFFER_EVENTS  4096 // Trace events kept per thread before they are written out
+#define TRACE_NAME_COUNT      256 // Name ids are one byte, 0 = no name
+#define TRACE_MAGIC    "SDKTRACE"
+#define TRACE_VERSION           1
+#define TRACE_CHUNK_NAME        1 // Trace file chunk kinds, id = name id, followed by size chars of name
+#define TRACE_CHUNK_EVENTS      2 // Followed by size bytes of struct sudoku_trace_event
+
+#ifndef TRACE_LEVEL
+#define TRACE_LEVEL 0 // Highest debug level that is traced, 0 = no tracing compiled in (make TRACE_LEVEL=4)
+#endif
 
 
 // Macros
@@ -49,6 +82,16 @@
 #define SET_IDENTICAL(s1, s2)        ((s1) == (s2))  // Is s1 identical to s2
 #define SET_NOT_IDENTICAL(s1, s2)    ((s1) != (s2))  // Is s1 not identical to s2
 
+// Tracing at a level is on if it's compiled in and the board's debug level is at least that
+// high. Levels above TRACE_LEVEL compile to nothing, the arguments are never evaluated.
+#define TRACE_ON(level, board) (((level) <= TRACE_LEVEL) && ((board)->debug_level >= (level)))
+
+#define TRACE(level, board, type, name, cell, other, a, b, c) \
+  do { \
+    if (TRACE_ON(level, board)) \
+      trace_event((board), (type), (name), (cell), (other), (a), (b), (c)); \
+  } while (0)
+
 // Datastructures
 
 struct sudoku_board;
@@ -69,6 +112,149 @@ struct sudoku_cell {
   unsigned int *tile_cell_empty_set_ref;
 };
 
+enum sudoku_strategy {
+  STRATEGY_SINGLES,   // solve_possible()
+  STRATEGY_ELIMINATE, // solve_eliminate()
+  STRATEGY_INTERLOCK, // solve_tile_interlock()
+  STRATEGY_CHAINS,    // solve_chains()
+  STRATEGY_PROBES,    // solve_probes()
+  STRATEGY_GUESS,     // The guessed cells themselves
+  STRATEGY_COUNT
+};
+
+enum sudoku_pass {
+  PASS_PROPAGATE,                // propagate_constraints()
+  PASS_POSSIBLE,                 // solve_possible()
+  PASS_ELIMINATE_TILES_BY_INDEX, // The solve_eliminate_*() passes, in the order solve_eliminate() runs them
+  PASS_ELIMINATE_TILES_BY_NUMBER,
+  PASS_ELIMINATE_ROWS_BY_NUMBER,
+  PASS_ELIMINATE_COLS_BY_NUMBER,
+  PASS_ELIMINATE_ROWS_BY_INDEX,
+  PASS_ELIMINATE_COLS_BY_INDEX,
+  PASS_TILE_INTERLOCK,           // solve_tile_interlock()
+  PASS_CHAINS,                   // solve_chains()
+  PASS_PROBES,                   // solve_probes()
+  PASS_HIDDEN,                   // solve_hidden(), the nested boards included
+  PASS_COUNT
+};
+
+enum sudoku_perf_event {
+  PERF_CYCLES,
+  PERF_INSTRUCTIONS,
+  PERF_BRANCH_MISSES,
+  PERF_L1D_MISSES,  // L1 data cache read misses
+  PERF_LLC_MISSES,  // Last level cache read misses
+  PERF_EVENT_COUNT
+};
+
+struct sudoku_pass_counters {
+  unsigned long calls;
+  unsigned long placements; // Numbers placed
+  unsigned long changes;    // What the pass returns - cells narrowed down, or numbers placed
+  unsigned long cycles;     // Time stamp counter cycles, passes run by the pass included
+};
+
+struct sudoku_perf_sample {
+  unsigned long time_enabled; // ns the group was enabled
+  unsigned long time_running; // ns it was counting, less if the PMU was multiplexed with other events
+  unsigned long values[PERF_EVENT_COUNT];
+};
+
+struct sudoku_stats {
+  unsigned long guesses;
+  unsigned int max_nest_level;
+  unsigned long probe_rounds; // Runs of the probing pass, each probes up to the budget of cells
+  unsigned long probes;       // Bivalue cells probed
+  unsigned long placements[STRATEGY_COUNT]; // Numbers placed by each step of solve(), nested boards included
+  struct sudoku_pass_counters passes[PASS_COUNT];
+  unsigned long nodes;      // Boards searched - the puzzle itself and one per guess
+  unsigned long backtracks; // Guesses that led to no solution
+  unsigned long dead_ends[STRATEGY_COUNT];         // Boards found dead, by the step of solve() that found it
+  unsigned long branch_points[SEARCH_DEPTH_COUNT]; // Cells guessed on, by nest level
+  unsigned long branches[SEARCH_DEPTH_COUNT];      // Guesses tried on those cells, by nest level
+  unsigned long perf[STRATEGY_COUNT][PERF_EVENT_COUNT]; // Hardware counters by step of solve() on the puzzle, nested boards in the guesses
+  unsigned long perf_steps;       // Steps the hardware counters were read around
+  unsigned long perf_multiplexed; // Steps whose counts were scaled up, as the counters were shared
+  int count_cycles;         // Read the time stamp counter around passes
+  int count_perf;           // Read the hardware counters between the steps of solve()
+};
+
+enum sudoku_outcome {
+  OUTCOME_SOLVED,
+  OUTCOME_UNSOLVED,
+  OUTCOME_MULTIPLE, // More than one solution
+  OUTCOME_COUNT
+};
+
+struct sudoku_histogram {
+  unsigned long buckets[HISTOGRAM_BUCKET_COUNT];
+  unsigned long count;
+  unsigned long max;
+};
+
+struct sudoku_search_histogram {
+  unsigned long puzzles;
+  unsigned long max_nest_levels[SEARCH_DEPTH_COUNT]; // Puzzles by deepest nest level
+  unsigned long nodes[SEARCH_NODES_BUCKET_COUNT];     // Puzzles by boards searched
+};
+
+// What the fields of a trace event hold, see trace_decode.c for how each one is printed
+enum sudoku_trace_type {
+  TRACE_TEXT,              // name
+  TRACE_TEXT_NUMBER,       // name, a = number
+  TRACE_TEXT_CELL,         // name, cell
+  TRACE_TEXT_SET,          // name, a = number set
+  TRACE_BOARD_DEAD,        // name = function
+  TRACE_SET_NUMBER,        // cell, a = number
+  TRACE_RESERVE,           // name = function, cell, a = number set, b = removed number set
+  TRACE_RESERVED,          // cell, a = reserved number set
+  TRACE_REMOVE_AROUND,     // name = function, cell, other = TRACE_UNIT_*, a = number set
+  TRACE_RESERVE_AROUND,    // name = function, cell, other = TRACE_UNIT_*, a = number set
+  TRACE_RESERVE_GROUP,     // name = function, cell, a = possibilities, b = index set, c = number set
+  TRACE_ELIMINATE_CELL,    // cell, a = possible number set, b = number set, c = cell number
+  TRACE_ELIMINATE_TILE,    // cell = tile, other = number, a = possibilities, b = index set
+  TRACE_RECTANGLE,         // cell = pivot, other = target
+  TRACE_MUST_BE,           // name = function, cell, a = number
+  TRACE_PROBE_DEAD,        // name = function, cell, a = number
+  TRACE_PROBE_EITHER_WAY,  // name = function, cell, a = number
+  TRACE_GUESS,             // cell, a = number
+  TRACE_GUESS_SOLVED,      // cell, a = number
+  TRACE_POSSIBLE,          // cell, other = indented, a = possible number set, b = available number set, c = reserved number set
+  TRACE_BOARD_ROW,         // cell = row, a b c = the 9 numbers, 4 bits each
+  TRACE_TYPE_COUNT
+};
+
+enum sudoku_trace_unit {
+  TRACE_UNIT_TILE,
+  TRACE_UNIT_ROW,
+  TRACE_UNIT_COL
+};
+
+struct sudoku_trace_event {
+  unsigned char type;
+  unsigned char name;        // Name id, names are written to the trace file once per thread
+  unsigned char debug_level; // Of the board, messages are indented above level 1
+  unsigned char nest_level;
+  unsigned char cell;        // row*9 + col
+  unsigned char other;
+  unsigned short a;
+  unsigned short b;
+  unsigned short c;
+};
+
+struct sudoku_trace_header {
+  char magic[8];
+  unsigned int version;
+  unsigned int event_size;
+};
+
+struct sudoku_trace_chunk {
+  unsigned char kind;
+  unsigned char id;
+  unsigned short thread;
+  unsigned int size;
+};
+
 struct sudoku_board {
   struct sudoku_cell cells[9][9];
   struct sudoku_cell *tile_ref[9][9];
@@ -87,11 +273,145 @@ struct sudoku_board {
   unsigned int undetermined_count;
   int dead;
   int guessing_allowed;
+  unsigned int chain_max_length;
+  unsigned int probe_budget;
+  unsigned int solutions_max; // Search stops once this many solutions are found, 0 = all of them
   unsigned int solutions_count;
   struct sudoku_board *solutions_list;
   struct sudoku_board *next;
   unsigned int nest_level;
   unsigned int debug_level;
+  struct sudoku_stats *stats; // Shared with nested boards, NULL = no stats
+};
+
+struct sudoku_transform {
+  unsigned int transposed;        // Transpose the grid before mapping rows and cols
+  unsigned char row_map[9];       // row_map[r] = source row placed at row r
+  unsigned char col_map[9];       // col_map[c] = source col placed at col c
+  unsigned char number_map[10];   // number_map[n] = new number for source number n (number_map[0] = 0)
+};
+
+struct sudoku_cache_entry;
+
+struct sudoku_cache {
+  struct sudoku_cache_entry *entries;
+  unsigned int *buckets;
+  unsigned int capacity;
+  unsigned int bucket_mask;
+  unsigned int count;
+  unsigned int lru_head; // Most recently used
+  unsigned int lru_tail; // Least recently used
+  unsigned long hits;
+  unsigned long misses;
+  unsigned long evictions;
+};
+
+struct sudoku_input {
+  char *data;    // Mapped file, or streaming buffer if it couldn't be mapped
+  size_t size;   // Of the file, or of what is in the streaming buffer
+  size_t offset; // Start of the next line
+  size_t end;    // End of the lines handed out - size unless sharded
+  int mapped;
+  int streamed;  // Read a buffer at a time, so data only holds part of the input
+  int fd;        // Still streaming from it, -1 otherwise
+  int error;     // Streaming ended on a read error
+  int cut;       // The last streamed line was cut short, the rest of it is still to be skipped
+};
+
+struct sudoku_binary_stats {
+  unsigned char flags; // BINARY_RECORD_*
+  unsigned char solutions_count;
+  unsigned char clue_count;
+  unsigned char reserved;
+};
+
+struct sudoku_binary_index_entry;
+
+struct sudoku_binary {
+  struct sudoku_input *input; // When reading
+  FILE *f;                    // When writing
+  unsigned int flags;         // BINARY_HAS_*
+  unsigned int record_size;
+  unsigned long record_count;
+  struct sudoku_binary_index_entry *index; // Built while writing
+  unsigned long index_capacity;
+};
+
+struct sudoku_ring_slot;
+
+struct sudoku_ring {
+  struct sudoku_ring_slot *slots;
+  unsigned long mask;
+  unsigned long push_position __attribute__((aligned(64))); // Own cache lines, pushers and poppers
+  unsigned int push_event;   // Bumped by every push, poppers sleep on it
+  unsigned int push_waiters; // Pushers sleeping on pop_event
+  unsigned long pop_position __attribute__((aligned(64)));  // shouldn't slow each other down
+  unsigned int pop_event;    // Bumped by every pop, pushers sleep on it
+  unsigned int pop_waiters;  // Poppers sleeping on push_event
+  unsigned long push_count __attribute__((aligned(64)));
+  unsigned long depth_sum;   // Depth after each push, for the average
+  unsigned long depth_max;
+  unsigned long full_waits;  // Pushes that had to wait for room
+  unsigned long empty_waits; // Pops that had to wait for data
+};
+
+struct sudoku_uring;
+
+struct sudoku_output {
+  int fd;
+  struct sudoku_uring *ring; // NULL = plain write()
+  char *buffers;             // OUTPUT_BUFFER_COUNT buffers of OUTPUT_BUFFER_SIZE
+  int current;               // Buffer being filled
+  size_t used;
+  unsigned long offset;      // File offset of the current buffer
+  int in_flight[OUTPUT_BUFFER_COUNT];
+  int in_flight_count;
+  size_t lengths[OUTPUT_BUFFER_COUNT];
+  unsigned long offsets[OUTPUT_BUFFER_COUNT];
+  int status;                // -1 once a write failed
+};
+
+struct sudoku_checkpoint {
+  unsigned long input_size;     // Tells a different input apart
+  unsigned long input_position; // Start of the next line, or next record of binary input
+  unsigned long output_offset;  // Output up to here is written and synced
+  unsigned long shard;
+  unsigned long shard_count;    // 0 = not sharded
+  unsigned long total_solved;
+  unsigned long total_unsolved;
+  unsigned long total_canonicalized;
+  unsigned long total_copied;
+};
+
+struct sudoku_server_options {
+  const char *socket_path; // Unix domain socket, NULL = none
+  int port;                // Localhost TCP port, 0 = none
+  int thread_count;
+  int guessing_allowed;
+  unsigned int chain_max_length;
+  unsigned int probe_budget;
+  int quiet_mode;
+  int latency;             // Print latency histograms when stopped, 2 = with the buckets
+  long cache_size;         // kB shared by the solver threads, 0 = no cache
+};
+
+struct sudoku_store_header;
+struct sudoku_store_record;
+
+struct sudoku_store {
+  char *file_name;
+  int fd;
+  int writable;
+  void *map;
+  size_t map_size;
+  struct sudoku_store_header *header;
+  struct sudoku_store_record *records;
+  unsigned long slot_mask;
+  unsigned long hits;
+  unsigned long misses;
+  unsigned long inserts;
+  unsigned long skipped;    // Solutions that could not be kept
+  unsigned long grows;      // Times the store was rehashed into a larger file
 };
 
 // Functions
@@ -102,6 +422,8 @@ void copy_board(struct sudoku_board *src, struct sudoku_board *dest);
 
 void destroy_board(struct sudoku_board **board);
 
+void release_board_pool();
+
 struct sudoku_board* dupilcate_board(struct sudoku_board *board);
 
 void add_to_board_solutions_list(struct sudoku_board *board, struct sudoku_board *solution_board);
@@ -110,6 +432,18 @@ void add_list_to_board_solutions_list(struct sudoku_board *board, struct sudoku_
 
 int read_board(struct sudoku_board *board, const char *str);
 
+int read_board_length(struct sudoku_board *board, const char *str, size_t length);
+
+size_t format_board(struct sudoku_board *board, char *buffer);
+
+size_t format_board_simple(struct sudoku_board *board, char *buffer);
+
+size_t format_board_line(struct sudoku_board *board, char *buffer);
+
+size_t format_board_latex(struct sudoku_board *board, char *buffer);
+
+size_t format_grid_line(const unsigned char grid[81], char *buffer);
+
 void print_board(struct sudoku_board *board);
 
 void print_board_simple(struct sudoku_board *board);
@@ -118,7 +452,141 @@ void print_board_line(FILE *f, struct sudoku_board *board);
 
 void print_board_latex(struct sudoku_board *board);
 
+void board_to_grid(struct sudoku_board *board, unsigned char grid[81]);
+
+unsigned int get_possible_number_set(struct sudoku_board *board, unsigned int row, unsigned int col);
+
+void print_grid_line(FILE *f, const unsigned char grid[81]);
+
+void pack_grid(const unsigned char grid[81], unsigned char packed[PACKED_GRID_SIZE]);
+
+void unpack_grid(const unsigned char packed[PACKED_GRID_SIZE], unsigned char grid[81]);
+
+unsigned int packed_grid_hash(const unsigned char packed[PACKED_GRID_SIZE], unsigned int flags);
+
+int read_board_grid(struct sudoku_board *board, const unsigned char grid[81]);
+
+int read_grid_length(const char *str, size_t length, unsigned char grid[81]);
+
+int grid_has_clashes(const unsigned char grid[81]);
+
+void canonicalize_grid(const unsigned char grid[81], unsigned char canon_grid[81], struct sudoku_transform *transform);
+
+void canonicalize_board(struct sudoku_board *board, unsigned char canon_grid[81], struct sudoku_transform *transform);
+
+void transform_grid(const struct sudoku_transform *transform, const unsigned char grid[81], unsigned char result_grid[81]);
+
+void untransform_grid(const struct sudoku_transform *transform, const unsigned char canon_grid[81], unsigned char grid[81]);
+
+struct sudoku_cache* create_cache(size_t memory_budget);
+
+void destroy_cache(struct sudoku_cache **cache);
+
+int cache_lookup(struct sudoku_cache *cache, const unsigned char canon_grid[81], unsigned int flags,
+                 unsigned char canon_solution[81], unsigned int *solutions_count);
+
+void cache_insert(struct sudoku_cache *cache, const unsigned char canon_grid[81], unsigned int flags,
+                  const unsigned char canon_solution[81], unsigned int solutions_count);
+
+struct sudoku_store* open_store(const char *file_name, int writable, unsigned long slot_count);
+
+void close_store(struct sudoku_store **store);
+
+int store_lookup(struct sudoku_store *store, const unsigned char grid[81], unsigned int flags,
+                 unsigned char solution[81], unsigned int *solutions_count);
+
+int store_insert(struct sudoku_store *store, const unsigned char grid[81], unsigned int flags,
+                 const unsigned char solution[81], unsigned int solutions_count);
+
+struct sudoku_input* open_input(const char *file_name);
+
+void close_input(struct sudoku_input **input);
+
+void shard_input(struct sudoku_input *input, unsigned long shard, unsigned long shard_count);
+
+size_t next_input_line(struct sudoku_input *input, const char **line);
+
+void unread_input_line(struct sudoku_input *input, size_t length);
+
+size_t next_input_chunk(struct sudoku_input *input, const char **chunk);
+
+int is_binary_input(struct sudoku_input *input);
+
+struct sudoku_binary* open_binary(const char *file_name);
+
+struct sudoku_binary* create_binary(const char *file_name, unsigned int flags);
+
+int close_binary(struct sudoku_binary **binary);
+
+int read_binary_record(struct sudoku_binary *binary, unsigned long record, unsigned char puzzle[81],
+                       unsigned char solution[81], struct sudoku_binary_stats *stats);
+
+int write_binary_record(struct sudoku_binary *binary, const unsigned char puzzle[81],
+                        const unsigned char solution[81], const struct sudoku_binary_stats *stats);
+
+long find_binary_record(struct sudoku_binary *binary, const unsigned char puzzle[81]);
+
+struct sudoku_ring* create_ring(unsigned long capacity);
+
+void destroy_ring(struct sudoku_ring **ring);
+
+int ring_push(struct sudoku_ring *ring, void *data);
+
+void* ring_pop(struct sudoku_ring *ring);
+
+void ring_push_wait(struct sudoku_ring *ring, void *data);
+
+void* ring_pop_wait(struct sudoku_ring *ring);
+
+struct sudoku_output* create_output(const char *file_name, unsigned long offset);
+
+void use_plain_writes(struct sudoku_output *output);
+
+char* get_output_space(struct sudoku_output *output, size_t size);
+
+void commit_output(struct sudoku_output *output, size_t length);
+
+int sync_output(struct sudoku_output *output);
+
+int close_output(struct sudoku_output **output);
+
+int read_checkpoint(const char *file_name, struct sudoku_checkpoint *checkpoint);
+
+int open_trace(const char *file_name);
+
+void close_trace();
+
+void trace_event(const struct sudoku_board *board, unsigned int type, const char *name,
+                 unsigned int cell, unsigned int other, unsigned int a, unsigned int b, unsigned int c);
+
+int write_checkpoint(const char *file_name, const struct sudoku_checkpoint *checkpoint);
+
+void record_histogram(struct sudoku_histogram *histogram, unsigned long value);
+
+void add_histogram(struct sudoku_histogram *total, const struct sudoku_histogram *histogram);
+
+unsigned long get_histogram_percentile(const struct sudoku_histogram *histogram, double percentile);
+
+void print_latency(const struct sudoku_histogram histograms[OUTCOME_COUNT], int print_buckets);
+
+enum sudoku_outcome get_outcome(int solutions_count);
+
+int read_perf_counters(struct sudoku_perf_sample *sample);
+
+int add_perf_counts(unsigned long totals[PERF_EVENT_COUNT], const struct sudoku_perf_sample *start, const struct sudoku_perf_sample *end);
+
+unsigned int get_perf_event_mask();
+
+int run_server(const struct sudoku_server_options *options);
+
 int solve(struct sudoku_board *board);
+const char* get_strategy_name(enum sudoku_strategy strategy);
+
+const char* get_pass_name(enum sudoku_pass pass);
+
+void add_stats(struct sudoku_stats *total, const struct sudoku_stats *stats);
+
+void add_to_search_histogram(struct sudoku_search_histogram *histogram, const struct sudoku_stats *stats);
 
 int solve_recursive(struct sudoku_board *board);
 
@@ -130,4 +598,6 @@ void init();
 
 int run_built_in_tests();
 
+int run_benchmark(int file_count, char **file_names, const struct sudoku_solver_config *config, int run_count);
+
 #endif
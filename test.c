@@ -17,19 +17,768 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
+#include <unistd.h>
+#include <sys/wait.h>
 #include "sudoku.h"
 
 
 static char *test_boards[] = {
-  // TODO: Add your built-in test boards here. One string per board.
+  // One string per board. The larger sets used for timing are in bench/
+  "003020600900305001001806400008102900700000008006708200002609500800203009005010300", // Easy
+  "000000010400000000020000000000050407008000300001090000300400200050100000000806000", // 17 clues
+  "100007090030020008009600500005300900010080002600004000300000010040000007007000300", // AI Escargot
+  "100000002090400050006000700050903000000070000000850040700000600030009080002000001", // Easter Monster
+  "800000000003600000070090200050007000000045700000100030001000068008500010090000400", // Inkala 2010
 };
 
+// The only solution of each test board, in the same order
+static char *test_solutions[] = {
+  "483921657967345821251876493548132976729564138136798245372689514814253769695417382",
+  "693784512487512936125963874932651487568247391741398625319475268856129743274836159",
+  "162857493534129678789643521475312986913586742628794135356478219241935867897261354",
+  "174385962293467158586192734451923876928674315367851249719548623635219487842736591",
+  "812753649943682175675491283154237896369845721287169534521974368438526917796318452",
+};
+
+
+// A grid whose first rows have their numbers spread over the stacks, so the row with the
+// fewest numbers is not the one that can start with the most empty cells
+static const char *canon_test_grid = "100200300456700000789123456234567891567891234891234567312645978645978312978312645";
+
+#define CANON_TEST_TRANSFORMS 1000
+#define CHAIN_TEST_LENGTH       12
+#define CACHE_TEST_SIZE       4096 // Bytes, room for a few dozen entries
+#define OUTPUT_TEST_LINES    30000 // Over two output buffers of lines
+#define OUTPUT_TEST_LOST      1000 // Lines written after the checkpoint, before the run is stopped
+#define STORE_TEST_SLOTS        64 // Slots in a new test store (power of two)
+#define STORE_TEST_ENTRIES     500 // Enough to grow it several times
+#define SHARD_TEST_LINES        23 // Not a multiple of any shard count tested
+#define STREAM_TEST_LINES    30000 // Enough to refill the streaming buffer a few times
+#define STREAM_TEST_LONG   (3 << 20) // Line longer than the streaming buffer
+
+
+static
+void string_to_grid(const char *str, unsigned char grid[81])
+{
+  int i;
+
+  for (i=0; i<81; i++)
+    grid[i] = (((str[i] >= '1') && (str[i] <= '9')) ? (str[i] - '0') : 0);
+}
+
+
+static
+void random_permutation(unsigned char map[9])
+{
+  unsigned char group[3];
+  int i, j, k;
+
+  // Shuffle the three groups of three, then within each group
+  for (i=0; i<3; i++)
+    group[i] = i;
+  for (i=2; i>0; i--) {
+    j = rand() % (i + 1);
+    k = group[i]; group[i] = group[j]; group[j] = k;
+  }
+  for (i=0; i<9; i++)
+    map[i] = group[i/3]*3 + i%3;
+  for (i=0; i<3; i++) {
+    for (j=2; j>0; j--) {
+      k = rand() % (j + 1);
+      group[0] = map[i*3 + j]; map[i*3 + j] = map[i*3 + k]; map[i*3 + k] = group[0];
+    }
+  }
+}
+
+
+static
+void random_transform(struct sudoku_transform *transform)
+{
+  unsigned char numbers[9];
+  int i;
+
+  transform->transposed = rand() % 2;
+  random_permutation(transform->row_map);
+  random_permutation(transform->col_map);
+  for (i=0; i<9; i++)
+    numbers[i] = i;
+  random_permutation(numbers);
+  transform->number_map[0] = 0;
+  for (i=0; i<9; i++)
+    transform->number_map[i+1] = numbers[i] + 1;
+}
+
+
+// Band (or stack) order outer and the orders within the three bands inner (0 - 6^3-1)
+static
+void make_line_map(unsigned int outer, unsigned int inner, unsigned char map[9])
+{
+  static const unsigned char perms[6][3] = { {0,1,2}, {0,2,1}, {1,0,2}, {1,2,0}, {2,0,1}, {2,1,0} };
+  int i;
+
+  for (i=0; i<9; i++) {
+    if (i && ((i % 3) == 0))
+      inner /= 6;
+    map[i] = perms[outer][i/3]*3 + perms[inner % 6][i%3];
+  }
+}
+
+
+// Smallest grid over all 2*6^8 transformations, numbers relabeled in order of first appearance
+static
+void brute_force_canonical_grid(const unsigned char grid[81], unsigned char best[81])
+{
+  unsigned char row_map[9], col_map[9], number_map[10], result[81];
+  unsigned int transposed, bands, rows, stacks, cols, next_number, number, i;
+  int smaller;
+
+  memset(best, 10, 81);
+  for (transposed=0; transposed<2; transposed++) {
+    for (bands=0; bands<6; bands++) {
+      for (rows=0; rows<6*6*6; rows++) {
+        make_line_map(bands, rows, row_map);
+        for (stacks=0; stacks<6; stacks++) {
+          for (cols=0; cols<6*6*6; cols++) {
+            make_line_map(stacks, cols, col_map);
+            memset(number_map, 0, sizeof(number_map));
+            next_number = 1;
+            smaller = 0;
+            for (i=0; i<81; i++) {
+              if (transposed)
+                number = grid[col_map[i%9]*9 + row_map[i/9]];
+              else
+                number = grid[row_map[i/9]*9 + col_map[i%9]];
+              if (number && (number_map[number] == 0))
+                number_map[number] = next_number++;
+              result[i] = number_map[number];
+              // Stop as soon as it's larger than the best grid
+              if (!smaller && (result[i] != best[i])) {
+                if (result[i] > best[i])
+                  break;
+                smaller = 1;
+              }
+            }
+            if (smaller)
+              memcpy(best, result, 81);
+          }
+        }
+      }
+    }
+  }
+}
+
+
+// The canonical form must be the same for every transformation of a grid, and the smallest one
+static
+int test_canonical_form()
+{
+  struct sudoku_transform transform;
+  unsigned char grid[81], transformed[81], canon_grid[81], canon_transformed[81], best[81];
+  int i, j;
+
+  srand(1);
+  for (i=0; i<(sizeof(test_boards)/sizeof(*test_boards)); i++) {
+    string_to_grid(test_boards[i], grid);
+    canonicalize_grid(grid, canon_grid, NULL);
+    for (j=0; j<CANON_TEST_TRANSFORMS; j++) {
+      random_transform(&transform);
+      transform_grid(&transform, grid, transformed);
+      canonicalize_grid(transformed, canon_transformed, NULL);
+      if (memcmp(canon_grid, canon_transformed, 81) != 0) {
+        printf("Canonical form of test board %i changes under transformation %i\n", i, j);
+        return -1;
+      }
+    }
+  }
+
+  string_to_grid(canon_test_grid, grid);
+  canonicalize_grid(grid, canon_grid, NULL);
+  brute_force_canonical_grid(grid, best);
+  if (memcmp(canon_grid, best, 81) != 0) {
+    printf("Canonical form is not the smallest transformation of the canonical test grid\n");
+    return -1;
+  }
+
+  printf("Canonical form is invariant over %i transformations and minimal\n", CANON_TEST_TRANSFORMS);
+  return 0;
+}
+
+
+// Pure logic gets stuck on this one with 9 still possible in row 0 col 1, an XY-chain takes it out
+static const char *chain_test_board    = "003000207250703100804012059037561002000300071010007600000800006741000003300000900";
+static const char *chain_test_solution = "163958247259743168874612359437561892625389471918427635592834716741296583386175924";
+
+
+// Logic gets stuck on this one with row 1 col 4, the first bivalue cell, still 1 or 5. Probing 5
+// runs into a contradiction, so it must be 1.
+static const char *probe_test_board    = "001704908879200006063000200047806000000007000900300070700032000050670802210400000";
+static const char *probe_test_solution = "521764938879213546463958217147896325635127489982345671798532164354671892216489753";
+
+
+// Solves a puzzle with the given settings, the caller destroys the board
+static
+struct sudoku_board* solve_test_board(const char *puzzle, int guessing_allowed, unsigned int chain_max_length,
+                                      unsigned int probe_budget, struct sudoku_stats *stats)
+{
+  struct sudoku_board *board;
+
+  board = create_board();
+  read_board(board, puzzle);
+  board->guessing_allowed = guessing_allowed;
+  board->chain_max_length = chain_max_length;
+  board->probe_budget = probe_budget;
+  memset(stats, 0, sizeof(*stats));
+  board->stats = stats;
+  solve(board);
+  board->stats = NULL;
+
+  return board;
+}
+
+
+// Returns -1 unless the board is solved and is the solution
+static
+int check_test_solution(struct sudoku_board *board, const char *solution)
+{
+  char line[BOARD_LINE_SIZE];
+
+  if (board->undetermined_count)
+    return -1;
+  format_board_line(board, line);
+  return ((memcmp(line, solution, 81) == 0) ? 0 : -1);
+}
+
+
+// A board logic alone can't finish must be solved by chains, without guessing
+static
+int test_chains()
+{
+  struct sudoku_board *board;
+  struct sudoku_stats stats;
+  int stuck, solved;
+
+  board = solve_test_board(chain_test_board, 0, 0, 0, &stats);
+  stuck = (board->undetermined_count && (get_possible_number_set(board, 0, 1) & NUMBER_TO_SET(9)));
+  destroy_board(&board);
+
+  board = solve_test_board(chain_test_board, 0, CHAIN_TEST_LENGTH, 0, &stats);
+  solved = ((check_test_solution(board, chain_test_solution) == 0) && stats.placements[STRATEGY_CHAINS] && (stats.guesses == 0));
+  destroy_board(&board);
+
+  if (!stuck || !solved) {
+    printf("Chains don't take 9 out of row 0 col 1 of the chain test board%s\n", (stuck ? "" : ", logic alone got it"));
+    return -1;
+  }
+
+  printf("Chains solve the chain test board without guessing\n");
+  return 0;
+}
+
+
+// A board logic alone can't finish must be solved by probing one cell at a time, without guessing
+static
+int test_probes()
+{
+  struct sudoku_board *board;
+  struct sudoku_stats stats;
+  int stuck, needs_guess, solved;
+
+  board = solve_test_board(probe_test_board, 0, 0, 0, &stats);
+  stuck = (board->undetermined_count && (get_possible_number_set(board, 1, 4) == (NUMBER_TO_SET(1) | NUMBER_TO_SET(5))));
+  destroy_board(&board);
+
+  board = solve_test_board(probe_test_board, 1, 0, 0, &stats);
+  needs_guess = (stats.guesses > 0);
+  destroy_board(&board);
+
+  // A budget of one probes just the first bivalue cell each round
+  board = solve_test_board(probe_test_board, 1, 0, 1, &stats);
+  solved = ((check_test_solution(board, probe_test_solution) == 0) && stats.placements[STRATEGY_PROBES] &&
+            (stats.guesses == 0));
+  destroy_board(&board);
+
+  if (!stuck || !needs_guess || !solved || (stats.probes == 0) || (stats.probes > stats.probe_rounds)) {
+    printf("Probing doesn't solve the probe test board one cell a round (%lu probes in %lu rounds)\n",
+           stats.probes, stats.probe_rounds);
+    return -1;
+  }
+
+  printf("Probing solves the probe test board without guessing, cells probed: %lu in %lu rounds\n", stats.probes, stats.probe_rounds);
+  return 0;
+}
+
+
+// A different grid for each number, as a cache or store key
+static
+void make_test_key(unsigned int number, unsigned char grid[81])
+{
+  int i;
+
+  memset(grid, 0, 81);
+  for (i=0; number; i++, number /= 9)
+    grid[i] = number % 9 + 1;
+}
+
+
+// A variant of a puzzle must hit the entry of its canonical form and untransform to its own
+// solution, entries are kept apart by flags, and a full cache drops the least recently used
+static
+int test_cache()
+{
+  struct sudoku_cache *cache;
+  struct sudoku_transform transform, variant_transform;
+  unsigned char puzzle[81], solution[81], canon_grid[81], canon_solution[81];
+  unsigned char variant[81], variant_solution[81], found_solution[81], key[81];
+  unsigned int i, solutions_count, capacity;
+  int status;
+
+  cache = create_cache(CACHE_TEST_SIZE);
+  if (!cache)
+    return -1;
+  status = 0;
+
+  string_to_grid(test_boards[2], puzzle);
+  string_to_grid(test_solutions[2], solution);
+  canonicalize_grid(puzzle, canon_grid, &transform);
+  transform_grid(&transform, solution, canon_solution);
+  cache_insert(cache, canon_grid, 1, canon_solution, 1);
+
+  srand(2);
+  random_transform(&variant_transform);
+  transform_grid(&variant_transform, puzzle, variant);
+  transform_grid(&variant_transform, solution, variant_solution);
+  canonicalize_grid(variant, canon_grid, &transform);
+  if (!cache_lookup(cache, canon_grid, 1, found_solution, &solutions_count) || (solutions_count != 1)) {
+    printf("Cache misses a variant of a puzzle in it\n");
+    status = -1;
+  } else {
+    untransform_grid(&transform, found_solution, canon_solution);
+    if (memcmp(canon_solution, variant_solution, 81) != 0) {
+      printf("Cache hit doesn't untransform to the solution of the variant\n");
+      status = -1;
+    }
+  }
+  if (cache_lookup(cache, canon_grid, 0, found_solution, NULL)) {
+    printf("Cache entry with guessing allowed is found without\n");
+    status = -1;
+  }
+
+  // Fill it up, use the first key again, then one more must push out the second
+  capacity = cache->capacity;
+  for (i=0; i<capacity; i++) {
+    make_test_key(i + 1, key);
+    cache_insert(cache, key, 1, key, 1);
+  }
+  make_test_key(1, key);
+  cache_lookup(cache, key, 1, found_solution, NULL);
+  make_test_key(capacity + 1, key);
+  cache_insert(cache, key, 1, key, 1);
+  for (i=0; i<=capacity; i++) {
+    make_test_key(i + 1, key);
+    if (cache_lookup(cache, key, 1, found_solution, NULL) != (i != 1)) {
+      printf("Full cache of %u entries doesn't drop just the least recently used one (key %u)\n", capacity, i + 1);
+      status = -1;
+      break;
+    }
+  }
+
+  destroy_cache(&cache);
+  if (status == 0)
+    printf("Cache finds variants, keeps flags apart and drops the least recently used of %u entries\n", capacity);
+  return status;
+}
+
+
+// Each test file gets its own name in /tmp
+static
+void get_test_file_name(char *file_name, const char *name)
+{
+  sprintf(file_name, "/tmp/sudoku-test-%i-%s", (int) getpid(), name);
+}
+
+
+static
+void write_numbered_lines(struct sudoku_output *output, unsigned long start, unsigned long end)
+{
+  unsigned long i;
+
+  for (i=start; i<end; i++)
+    commit_output(output, sprintf(get_output_space(output, BOARD_LINE_SIZE + 1), "%081lu\n", i));
+}
+
+
+// Returns -1 unless the file has exactly lines 0 to count-1, in order
+static
+int check_numbered_lines(const char *file_name, unsigned long count)
+{
+  FILE *file;
+  char line[BOARD_LINE_SIZE + 2];
+  unsigned long i;
+
+  file = fopen(file_name, "r");
+  if (!file)
+    return -1;
+  for (i=0; fgets(line, sizeof(line), file); i++) {
+    if ((i >= count) || (strtoul(line, NULL, 10) != i) || (strlen(line) != BOARD_LINE_SIZE))
+      break;
+  }
+  fclose(file);
+
+  return ((i == count) ? 0 : -1);
+}
+
+
+// A run stopped after a checkpoint and resumed from it must end up with all the output once,
+// written through io_uring or with plain write()
+static
+int test_output_resume()
+{
+  struct sudoku_output *output;
+  struct sudoku_checkpoint checkpoint;
+  char file_name[64], checkpoint_file_name[64];
+  int plain_writes, status;
+
+  get_test_file_name(file_name, "output");
+  get_test_file_name(checkpoint_file_name, "output.ckpt");
+  memset(&checkpoint, 0, sizeof(checkpoint));
+
+  for (plain_writes=0; plain_writes<2; plain_writes++) {
+    output = create_output(file_name, 0);
+    if (!output)
+      return -1;
+    if (plain_writes)
+      use_plain_writes(output);
+    write_numbered_lines(output, 0, OUTPUT_TEST_LINES/2);
+    status = sync_output(output);
+    checkpoint.output_offset = output->offset;
+    status |= write_checkpoint(checkpoint_file_name, &checkpoint);
+    write_numbered_lines(output, OUTPUT_TEST_LINES/2, OUTPUT_TEST_LINES/2 + OUTPUT_TEST_LOST);
+    status |= close_output(&output);
+
+    status |= read_checkpoint(checkpoint_file_name, &checkpoint);
+    output = create_output(file_name, checkpoint.output_offset);
+    if (!output)
+      return -1;
+    if (plain_writes)
+      use_plain_writes(output);
+    write_numbered_lines(output, OUTPUT_TEST_LINES/2, OUTPUT_TEST_LINES);
+    status |= close_output(&output);
+
+    if ((status != 0) || (check_numbered_lines(file_name, OUTPUT_TEST_LINES) != 0)) {
+      printf("Output resumed from a checkpoint is not whole%s\n", (plain_writes ? " with plain writes" : ""));
+      unlink(file_name);
+      unlink(checkpoint_file_name);
+      return -1;
+    }
+  }
+
+  unlink(file_name);
+  unlink(checkpoint_file_name);
+  printf("Output resumed from a checkpoint is whole, with io_uring and with plain writes\n");
+  return 0;
+}
+
+
+// A store filled past its first size must keep every entry through the rehashes, and still
+// have them all when the file is opened again
+static
+int test_store()
+{
+  struct sudoku_store *store;
+  unsigned char key[81], solution[81], found_solution[81];
+  char file_name[64];
+  unsigned int i, solutions_count;
+  unsigned long grows;
+  int status;
+
+  get_test_file_name(file_name, "store");
+  store = open_store(file_name, 1, STORE_TEST_SLOTS);
+  if (!store)
+    return -1;
+  status = 0;
+  for (i=0; i<STORE_TEST_ENTRIES; i++) {
+    make_test_key(i + 1, key);
+    make_test_key(i + 2, solution);
+    status |= store_insert(store, key, 1, solution, i % 2 + 1);
+  }
+  grows = store->grows;
+  close_store(&store);
+
+  store = open_store(file_name, 0, 0);
+  if (!store) {
+    unlink(file_name);
+    return -1;
+  }
+  for (i=0; i<=STORE_TEST_ENTRIES; i++) {
+    make_test_key(i + 1, key);
+    make_test_key(i + 2, solution);
+    if (store_lookup(store, key, 1, found_solution, &solutions_count) != (i < STORE_TEST_ENTRIES)) {
+      status = -1;
+      break;
+    }
+    if ((i < STORE_TEST_ENTRIES) &&
+        ((memcmp(found_solution, solution, 81) != 0) || (solutions_count != i % 2 + 1))) {
+      status = -1;
+      break;
+    }
+  }
+  close_store(&store);
+  unlink(file_name);
+
+  if ((status != 0) || (grows == 0)) {
+    printf("Store grown %lu times doesn't find entry %u of %u after reopening\n", grows, i + 1, STORE_TEST_ENTRIES);
+    return -1;
+  }
+  printf("Store grown %lu times from %u slots finds all %u entries after reopening\n", grows, STORE_TEST_SLOTS, STORE_TEST_ENTRIES);
+  return 0;
+}
+
+
+// Records written to a binary file must read back the same after it is reopened, and the index
+// must find each puzzle by its grid and not find one that was never written
+static
+int test_binary()
+{
+  struct sudoku_binary *binary;
+  struct sudoku_binary_stats stats, found_stats;
+  unsigned char puzzle[81], solution[81], found_puzzle[81], found_solution[81];
+  char file_name[64];
+  unsigned int i, count;
+  int status;
+
+  get_test_file_name(file_name, "binary");
+  count = sizeof(test_boards)/sizeof(*test_boards);
+  binary = create_binary(file_name, BINARY_HAS_SOLUTIONS | BINARY_HAS_STATS);
+  if (!binary)
+    return -1;
+  status = 0;
+  memset(&stats, 0, sizeof(stats));
+  for (i=0; i<count; i++) {
+    string_to_grid(test_boards[i], puzzle);
+    string_to_grid(test_solutions[i], solution);
+    stats.flags = BINARY_RECORD_SOLVED;
+    stats.solutions_count = 1;
+    stats.clue_count = i;
+    status |= write_binary_record(binary, puzzle, solution, &stats);
+  }
+  status |= close_binary(&binary);
+
+  binary = open_binary(file_name);
+  if (!binary) {
+    unlink(file_name);
+    return -1;
+  }
+  if (binary->record_count != count)
+    status = -1;
+  for (i=0; (status == 0) && (i<count); i++) {
+    string_to_grid(test_boards[i], puzzle);
+    string_to_grid(test_solutions[i], solution);
+    if ((find_binary_record(binary, puzzle) != i) ||
+        !read_binary_record(binary, i, found_puzzle, found_solution, &found_stats) ||
+        (memcmp(found_puzzle, puzzle, 81) != 0) || (memcmp(found_solution, solution, 81) != 0) ||
+        (found_stats.flags != BINARY_RECORD_SOLVED) || (found_stats.clue_count != i))
+      status = -1;
+  }
+  make_test_key(1, puzzle);
+  if (find_binary_record(binary, puzzle) != -1)
+    status = -1;
+  close_binary(&binary);
+  unlink(file_name);
+
+  if (status != 0) {
+    printf("Binary file doesn't read back or find the %u records written to it\n", count);
+    return -1;
+  }
+  printf("Binary file reads back and finds the %u records written to it, and no other\n", count);
+  return 0;
+}
+
+
+// Solves the lines of the input file, or of one shard of it if shard_count isn't 0, into the
+// output file
+static
+int solve_test_shard(const char *input_file_name, unsigned long shard, unsigned long shard_count,
+                     const char *output_file_name)
+{
+  struct sudoku_input *input;
+  struct sudoku_output *output;
+  struct sudoku_board *board;
+  const char *line;
+  size_t length;
+
+  input = open_input(input_file_name);
+  if (!input)
+    return -1;
+  if (shard_count)
+    shard_input(input, shard, shard_count);
+  output = create_output(output_file_name, 0);
+  if (!output) {
+    close_input(&input);
+    return -1;
+  }
+
+  while ((length = next_input_line(input, &line)) > 0) {
+    board = create_board();
+    read_board_length(board, line, length);
+    solve(board);
+    commit_output(output, format_board_line(board, get_output_space(output, BOARD_LINE_SIZE)));
+    destroy_board(&board);
+  }
+
+  close_input(&input);
+  return close_output(&output);
+}
+
+
+// Shard outputs put back together in order must be the output of solving the whole input, also
+// when shards split the input in the middle of a line or get no lines at all
+static
+int test_shards()
+{
+  static const unsigned long shard_counts[] = { 2, 3, 7, SHARD_TEST_LINES + 5 };
+  struct sudoku_input *serial, *part;
+  FILE *f;
+  char input_file_name[64], serial_file_name[64], shard_file_name[64];
+  unsigned long i, shard, shard_count, mid_line_count;
+  size_t offset;
+  int status;
+
+  get_test_file_name(input_file_name, "shards.txt");
+  get_test_file_name(serial_file_name, "shards.out");
+  get_test_file_name(shard_file_name, "shards.part");
+
+  // The last line has no newline
+  f = fopen(input_file_name, "w");
+  if (!f)
+    return -1;
+  for (i=0; i<SHARD_TEST_LINES; i++)
+    fprintf(f, "%s%s", test_boards[i % (sizeof(test_boards)/sizeof(*test_boards))], ((i + 1 < SHARD_TEST_LINES) ? "\n" : ""));
+  fclose(f);
+
+  status = solve_test_shard(input_file_name, 0, 0, serial_file_name);
+  serial = open_input(serial_file_name);
+  if (!serial)
+    status = -1;
+
+  shard_count = 0;
+  mid_line_count = 0;
+  for (i=0; (status == 0) && (i<sizeof(shard_counts)/sizeof(*shard_counts)); i++) {
+    shard_count = shard_counts[i];
+    offset = 0;
+    for (shard=0; (status == 0) && (shard<shard_count); shard++) {
+      if ((shard > 0) && (((SHARD_TEST_LINES * BOARD_LINE_SIZE - 1) / shard_count * shard) % BOARD_LINE_SIZE != 0))
+        mid_line_count++;
+      status = solve_test_shard(input_file_name, shard, shard_count, shard_file_name);
+      part = open_input(shard_file_name);
+      if (!part || (offset + part->size > serial->size) ||
+          (memcmp(serial->data + offset, part->data, part->size) != 0))
+        status = -1;
+      else
+        offset += part->size;
+      close_input(&part);
+    }
+    if (offset != serial->size)
+      status = -1;
+  }
+
+  close_input(&serial);
+  unlink(input_file_name);
+  unlink(serial_file_name);
+  unlink(shard_file_name);
+
+  if ((status != 0) || (mid_line_count == 0)) {
+    printf("Shard outputs merged don't make up the output of the whole input in %lu shards\n", shard_count);
+    return -1;
+  }
+  printf("Shard outputs merged make up the output of the whole input, %lu shards split a line\n", mid_line_count);
+  return 0;
+}
+
+
+// Writes numbered lines to the fd, with one overlong line of x's in the middle
+static
+void write_stream_test_lines(int fd)
+{
+  FILE *f;
+  unsigned long i, j;
+
+  f = fdopen(fd, "w");
+  for (i=0; f && (i<STREAM_TEST_LINES); i++) {
+    if (i == STREAM_TEST_LINES/2) {
+      for (j=0; j<STREAM_TEST_LONG; j++)
+        fputc('x', f);
+      fputc('\n', f);
+    }
+    fprintf(f, "%081lu\n", i);
+  }
+  if (f)
+    fclose(f);
+}
+
+
+// Lines streamed from a pipe must come out whole and in order across buffer refills, and a line
+// longer than the buffer is cut short with the rest of it skipped
+static
+int test_streamed_input()
+{
+  struct sudoku_input *input;
+  const char *line;
+  char file_name[64];
+  size_t length;
+  unsigned long i, cut_count;
+  int fds[2], status;
+  pid_t pid;
+
+  if (pipe(fds) != 0)
+    return -1;
+  pid = fork();
+  if (pid < 0)
+    return -1;
+  if (pid == 0) {
+    close(fds[0]);
+    write_stream_test_lines(fds[1]);
+    _exit(0);
+  }
+  close(fds[1]);
+
+  sprintf(file_name, "/dev/fd/%i", fds[0]);
+  input = open_input(file_name);
+  close(fds[0]);
+  status = ((input && input->streamed) ? 0 : -1);
+  i = 0;
+  cut_count = 0;
+  while ((status == 0) && (length = next_input_line(input, &line))) {
+    if (line[0] == 'x') {
+      if ((i != STREAM_TEST_LINES/2) || (length >= STREAM_TEST_LONG) || (line[length-1] == '\n'))
+        status = -1;
+      cut_count++;
+    } else if ((length != BOARD_LINE_SIZE) || (line[length-1] != '\n') || (strtoul(line, NULL, 10) != i++)) {
+      status = -1;
+    }
+  }
+  if ((i != STREAM_TEST_LINES) || (cut_count != 1) || !input || input->error)
+    status = -1;
+
+  // Don't leave the writer blocked on a pipe no one reads
+  close_input(&input);
+  waitpid(pid, NULL, 0);
+
+  if (status != 0) {
+    printf("Streamed input doesn't give back the %i lines written to a pipe\n", STREAM_TEST_LINES);
+    return -1;
+  }
+  printf("Streamed input gives back the %i lines written to a pipe, and cuts the one too long\n", STREAM_TEST_LINES);
+  return 0;
+}
+
 
 int run_built_in_tests()
 {
   struct sudoku_board *board;
-  int i, solutions_count;
+  char line[BOARD_LINE_SIZE];
+  int i, solutions_count, solution_correct;
 
   for(i = 0; i < (sizeof(test_boards)/sizeof(*test_boards)); i++) {
     printf("\n===== Test board %i =====\n\n", i);
@@ -47,12 +796,36 @@ int run_built_in_tests()
     printf("-------- Output -------\n");
     print_solutions(board);
     assert(solutions_count);    
+    format_board_line(board, line);
+    solution_correct = (memcmp(line, test_solutions[i], 81) == 0);
+    if (!solution_correct)
+      printf("Wrong solution, expected %s\n", test_solutions[i]);
+    assert(solution_correct);
     destroy_board(&board);
 
-    if (solutions_count == 0)
+    if ((solutions_count == 0) || !solution_correct)
       return -1;
   }
 
+  if (test_canonical_form() != 0)
+    return -1;
+  if (test_output_resume() != 0)
+    return -1;
+  if (test_chains() != 0)
+    return -1;
+  if (test_probes() != 0)
+    return -1;
+  if (test_cache() != 0)
+    return -1;
+  if (test_store() != 0)
+    return -1;
+  if (test_binary() != 0)
+    return -1;
+  if (test_shards() != 0)
+    return -1;
+  if (test_streamed_input() != 0)
+    return -1;
+
   printf("\nAll %i built-in tests PASS\n\n", i);
 
   return 0;
@@ -0,0 +1,250 @@
+//
+// sudoku - A SuDoKu solver
+//
+// Copyright (c) 2018  Linde Labs, LLC
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include "sudoku.h"
+
+
+// === Binary solver trace ===
+//
+// The solver traces what it does with the TRACE() macro instead of printing it. Each thread
+// collects its events in its own buffer, without any locking, and writes the buffer to the trace
+// file as one chunk when it fills up, when the thread ends and when the trace is closed.
+// Function names and messages are passed as string constants and turned into small per-thread
+// ids, each name is written to the file once, before the first chunk that uses it.
+// The sudoku-trace tool (trace_decode.c) prints a trace file as the old debug output.
+//
+// A build with TRACE_LEVEL 0 (the default) has no TRACE() calls left and this file only has
+// the stubs.
+
+
+// Struct & types
+
+struct sudoku_trace_buffer {
+  unsigned int thread;
+  unsigned int count;
+  unsigned int name_count;
+  const char *names[TRACE_NAME_COUNT];
+  struct sudoku_trace_event events[TRACE_BUFFER_EVENTS];
+};
+
+
+// Functions
+
+#if TRACE_LEVEL > 0
+
+static int trace_fd = -1;
+static pthread_mutex_t trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t trace_key;
+static unsigned int trace_thread_count;
+static _Thread_local struct sudoku_trace_buffer *trace_buffer;
+
+
+// Called with trace_mutex held
+static
+int write_trace_chunk(unsigned int kind, unsigned int id, unsigned int thread, const void *data, size_t size)
+{
+  struct sudoku_trace_chunk chunk;
+
+  if (trace_fd < 0)
+    return -1;
+
+  chunk.kind = kind;
+  chunk.id = id;
+  chunk.thread = thread;
+  chunk.size = size;
+  if ((write(trace_fd, &chunk, sizeof(chunk)) != sizeof(chunk)) || (write(trace_fd, data, size) != size)) {
+    fprintf(stderr, "Cound not write trace file\n");
+    close(trace_fd);
+    trace_fd = -1;
+    return -1;
+  }
+
+  return 0;
+}
+
+
+static
+void flush_trace_buffer(struct sudoku_trace_buffer *buffer)
+{
+  if (buffer->count == 0)
+    return;
+
+  pthread_mutex_lock(&trace_mutex);
+  write_trace_chunk(TRACE_CHUNK_EVENTS, 0, buffer->thread, buffer->events, buffer->count * sizeof(struct sudoku_trace_event));
+  pthread_mutex_unlock(&trace_mutex);
+  buffer->count = 0;
+}
+
+
+// Runs when a thread that traced something ends
+static
+void destroy_trace_buffer(void *data)
+{
+  struct sudoku_trace_buffer *buffer = (struct sudoku_trace_buffer*) data;
+
+  flush_trace_buffer(buffer);
+  if (trace_buffer == buffer)
+    trace_buffer = NULL;
+  free(buffer);
+}
+
+
+static
+struct sudoku_trace_buffer* get_trace_buffer()
+{
+  struct sudoku_trace_buffer *buffer;
+
+  if (trace_buffer)
+    return trace_buffer;
+
+  buffer = (struct sudoku_trace_buffer*) malloc(sizeof(struct sudoku_trace_buffer));
+  if (!buffer)
+    return NULL;
+
+  buffer->thread = __atomic_fetch_add(&trace_thread_count, 1, __ATOMIC_RELAXED);
+  buffer->count = 0;
+  buffer->name_count = 1;
+  buffer->names[0] = NULL;
+  pthread_setspecific(trace_key, buffer);
+  trace_buffer = buffer;
+
+  return buffer;
+}
+
+
+// Names are compared by pointer, they are all string constants
+static
+unsigned int get_trace_name_id(struct sudoku_trace_buffer *buffer, const char *name)
+{
+  unsigned int id;
+
+  if (!name)
+    return 0;
+
+  for (id=1; id<buffer->name_count; id++) {
+    if (buffer->names[id] == name)
+      return id;
+  }
+
+  if (buffer->name_count == TRACE_NAME_COUNT)
+    return 0;
+
+  buffer->names[id] = name;
+  buffer->name_count++;
+
+  // Events using the name are still in the buffer, so it comes first in the file
+  pthread_mutex_lock(&trace_mutex);
+  write_trace_chunk(TRACE_CHUNK_NAME, id, buffer->thread, name, strlen(name));
+  pthread_mutex_unlock(&trace_mutex);
+
+  return id;
+}
+
+
+int open_trace(const char *file_name)
+{
+  struct sudoku_trace_header header;
+
+  trace_fd = open(file_name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (trace_fd < 0)
+    return -1;
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+  header.version = TRACE_VERSION;
+  header.event_size = sizeof(struct sudoku_trace_event);
+  if (write(trace_fd, &header, sizeof(header)) != sizeof(header)) {
+    close(trace_fd);
+    trace_fd = -1;
+    return -1;
+  }
+
+  pthread_key_create(&trace_key, destroy_trace_buffer);
+
+  return 0;
+}
+
+
+// Call when the other threads that traced have ended
+void close_trace()
+{
+  if (trace_fd < 0)
+    return;
+
+  if (trace_buffer) {
+    pthread_setspecific(trace_key, NULL);
+    destroy_trace_buffer(trace_buffer);
+  }
+
+  close(trace_fd);
+  trace_fd = -1;
+}
+
+
+void trace_event(const struct sudoku_board *board, unsigned int type, const char *name,
+                 unsigned int cell, unsigned int other, unsigned int a, unsigned int b, unsigned int c)
+{
+  struct sudoku_trace_buffer *buffer;
+  struct sudoku_trace_event *event;
+
+  if (trace_fd < 0)
+    return;
+
+  buffer = get_trace_buffer();
+  if (!buffer)
+    return;
+
+  if (buffer->count == TRACE_BUFFER_EVENTS)
+    flush_trace_buffer(buffer);
+
+  event = &buffer->events[buffer->count++];
+  event->type = type;
+  event->name = get_trace_name_id(buffer, name);
+  event->debug_level = board->debug_level;
+  event->nest_level = board->nest_level;
+  event->cell = cell;
+  event->other = other;
+  event->a = a;
+  event->b = b;
+  event->c = c;
+}
+
+#else
+
+int open_trace(const char *file_name)
+{
+  return -1;
+}
+
+
+void close_trace()
+{
+}
+
+
+void trace_event(const struct sudoku_board *board, unsigned int type, const char *name,
+                 unsigned int cell, unsigned int other, unsigned int a, unsigned int b, unsigned int c)
+{
+}
+
+#endif
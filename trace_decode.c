@@ -0,0 +1,372 @@
+//
+// sudoku - A SuDoKu solver
+//
+// Copyright (c) 2018  Linde Labs, LLC
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sudoku.h"
+
+
+// === sudoku-trace: prints a solver trace file as debug output ===
+//
+// Reads the chunks written by trace.c and prints each event the way the solver used to print
+// it with -d <level>. The events of a thread are in order, chunks of different threads are
+// printed as they come, with a header whenever the thread changes.
+
+
+// Defines
+
+#define DINDENT "      "
+
+
+// Struct & types
+
+struct trace_thread {
+  char *names[TRACE_NAME_COUNT];
+  unsigned char board_rows[9][9]; // Rows of a board traced with trace_board()
+};
+
+
+// Functions
+
+static const char *unit_names[] = { "tile", "row", "col" };
+
+
+static
+void print_index_set(unsigned int index_set, const char *postfix)
+{
+  int index;
+
+  printf("{");
+  for (index=0; index<=8; index++) {
+    if (index_set & INDEX_TO_SET(index))
+      printf(" %i", index);
+  }
+  if (postfix)
+    printf(" } %s", postfix);
+  else
+    printf(" }");
+}
+
+
+static
+void print_number_set(unsigned int number_set, const char *postfix)
+{
+  int number;
+
+  printf("{");
+  for (number=1; number<=9; number++) {
+    if (number_set & NUMBER_TO_SET(number))
+      printf(" %i", number);
+  }
+  if (postfix)
+    printf(" } %s", postfix);
+  else
+    printf(" }");
+}
+
+
+static
+void print_numbers(const char *text, unsigned int number_set)
+{
+  int number;
+
+  printf("%s", text);
+  for (number=1; number<=9; number++) {
+    if (number_set & NUMBER_TO_SET(number))
+      printf(" %i", number);
+  }
+}
+
+
+static
+void print_board_rows(struct trace_thread *thread)
+{
+  struct sudoku_board *board;
+  char buffer[BOARD_FORMAT_SIZE];
+  int row, col;
+
+  board = (struct sudoku_board*) calloc(1, sizeof(struct sudoku_board));
+  if (!board)
+    return;
+
+  for (row=0; row<9; row++) {
+    for (col=0; col<9; col++)
+      board->cells[row][col].number = thread->board_rows[row][col];
+  }
+  fwrite(buffer, 1, format_board(board, buffer), stdout);
+  free(board);
+}
+
+
+static
+void print_event(struct trace_thread *thread, const struct sudoku_trace_event *event)
+{
+  const char *name;
+  unsigned long numbers;
+  int row, col;
+
+  name = (event->name && thread->names[event->name]) ? thread->names[event->name] : "?";
+  row = event->cell / 9;
+  col = event->cell % 9;
+
+  switch (event->type) {
+    case TRACE_TEXT:
+      printf("%s\n", name);
+      break;
+
+    case TRACE_TEXT_NUMBER:
+      printf("%s%i\n", name, event->a);
+      break;
+
+    case TRACE_TEXT_CELL:
+      printf("%s[%i,%i]\n", name, row, col);
+      break;
+
+    case TRACE_TEXT_SET:
+      printf("%s", name);
+      print_number_set(event->a, "\n");
+      break;
+
+    case TRACE_BOARD_DEAD:
+      printf("Board is declared dead! (function: %s)\n", name);
+      break;
+
+    case TRACE_SET_NUMBER:
+      if (event->debug_level > 1)
+        printf(DINDENT);
+      printf("[%i,%i]  =  %i\n", row, col, event->a);
+      break;
+
+    case TRACE_RESERVE:
+      printf(DINDENT "%s: [%i,%i] = ", name, row, col);
+      print_number_set(event->a, "  ( removing: ");
+      print_number_set(event->b, ")\n");
+      break;
+
+    case TRACE_RESERVED:
+      if (event->debug_level > 1)
+        printf(DINDENT);
+      printf("[%i,%i]  =  ", row, col);
+      print_number_set(event->a, "\n");
+      break;
+
+    case TRACE_REMOVE_AROUND:
+      printf(DINDENT "%s: Removing numbers from cells around [%i,%i] in %s. Numbers to remove: ",
+             name, row, col, unit_names[event->other % 3]);
+      print_number_set(event->a, "\n");
+      break;
+
+    case TRACE_RESERVE_AROUND:
+      printf(DINDENT "%s: Reserving numbers around [%i,%i] in %s. Numbers to reserve: ",
+             name, row, col, unit_names[event->other % 3]);
+      print_number_set(event->a, "\n");
+      break;
+
+    case TRACE_RESERVE_GROUP:
+      printf(DINDENT "%s: Reserving cells around [%i,%i] with possibilities: %i index_set: ",
+             name, row, col, event->a);
+      print_index_set(event->b, "number_set: ");
+      print_number_set(event->c, "\n");
+      break;
+
+    case TRACE_ELIMINATE_CELL:
+      printf(DINDENT "Possible [%i,%i] avail_set: ", row, col);
+      print_number_set(event->a, "<> ");
+      print_number_set(event->b, "");
+      printf("cell_number: %i\n", event->c);
+      break;
+
+    case TRACE_ELIMINATE_TILE:
+      printf(DINDENT "Tile: %i, Number: %i, possibilities: %i, possible_index_set: ", event->cell, event->other, event->a);
+      print_index_set(event->b, "\n");
+      break;
+
+    case TRACE_RECTANGLE:
+      printf(DINDENT "Found inter-tile rectangle: [%i,%i]-[%i,%i]\n", row, col, event->other / 9, event->other % 9);
+      break;
+
+    case TRACE_MUST_BE:
+      printf(DINDENT "%s: [%i,%i] must be %i\n", name, row, col, event->a);
+      break;
+
+    case TRACE_PROBE_DEAD:
+      printf(DINDENT "%s: [%i,%i] = %i is dead\n", name, row, col, event->a);
+      break;
+
+    case TRACE_PROBE_EITHER_WAY:
+      printf(DINDENT "%s: [%i,%i] = %i either way\n", name, row, col, event->a);
+      break;
+
+    case TRACE_GUESS:
+      printf("Trying solution [%i,%i] = %i  (level: %i)\n", row, col, event->a, event->nest_level);
+      break;
+
+    case TRACE_GUESS_SOLVED:
+      printf("Found hidden solution [%i,%i] = %i\n", row, col, event->a);
+      break;
+
+    case TRACE_POSSIBLE:
+      if (event->other)
+        printf(DINDENT);
+      printf("[%i,%i] Possible:", row, col);
+      print_numbers("", event->a);
+      printf("    (available:");
+      print_numbers("", event->b);
+      if (event->c)
+        print_numbers("  reserved:", event->c);
+      printf(")\n");
+      break;
+
+    case TRACE_BOARD_ROW:
+      if (event->cell > 8)
+        break;
+      numbers = event->a | ((unsigned long)event->b << 16) | ((unsigned long)event->c << 32);
+      for (col=0; col<9; col++) {
+        thread->board_rows[event->cell][col] = numbers & 0xF;
+        numbers >>= 4;
+      }
+      if (event->cell == 8)
+        print_board_rows(thread);
+      break;
+
+    default:
+      printf("Unknown trace event %i\n", event->type);
+      break;
+  }
+}
+
+
+static
+struct trace_thread* get_thread(struct trace_thread ***threads, unsigned int *thread_count, unsigned int thread)
+{
+  struct trace_thread **new_threads;
+
+  if (thread >= *thread_count) {
+    new_threads = (struct trace_thread**) realloc(*threads, (thread + 1) * sizeof(struct trace_thread*));
+    if (!new_threads)
+      return NULL;
+    memset(new_threads + *thread_count, 0, (thread + 1 - *thread_count) * sizeof(struct trace_thread*));
+    *threads = new_threads;
+    *thread_count = thread + 1;
+  }
+
+  if (!(*threads)[thread])
+    (*threads)[thread] = (struct trace_thread*) calloc(1, sizeof(struct trace_thread));
+
+  return (*threads)[thread];
+}
+
+
+static
+int decode_trace(FILE *f)
+{
+  struct sudoku_trace_header header;
+  struct sudoku_trace_chunk chunk;
+  struct sudoku_trace_event event;
+  struct trace_thread **threads, *thread;
+  unsigned int thread_count, last_thread, i, j;
+  char *name;
+  int status;
+
+  if ((fread(&header, sizeof(header), 1, f) != 1) ||
+      (memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0) ||
+      (header.version != TRACE_VERSION) ||
+      (header.event_size != sizeof(struct sudoku_trace_event))) {
+    fprintf(stderr, "Not a valid trace file\n");
+    return 1;
+  }
+
+  threads = NULL;
+  thread_count = 0;
+  last_thread = 0;
+  status = 0;
+  while (fread(&chunk, sizeof(chunk), 1, f) == 1) {
+    thread = get_thread(&threads, &thread_count, chunk.thread);
+    if (!thread) {
+      fprintf(stderr, "Cound not allocate memory\n");
+      status = 1;
+      break;
+    }
+
+    if (chunk.kind == TRACE_CHUNK_NAME) {
+      name = (char*) malloc(chunk.size + 1);
+      if (!name || (fread(name, 1, chunk.size, f) != chunk.size)) {
+        free(name);
+        status = 1;
+        break;
+      }
+      name[chunk.size] = '\0';
+      free(thread->names[chunk.id]);
+      thread->names[chunk.id] = name;
+    } else if ((chunk.kind == TRACE_CHUNK_EVENTS) && ((chunk.size % sizeof(event)) == 0)) {
+      if ((thread_count > 1) && (chunk.thread != last_thread))
+        printf("=== Thread %i ===\n", chunk.thread);
+      last_thread = chunk.thread;
+      for (i=0; i<chunk.size/sizeof(event); i++) {
+        if (fread(&event, sizeof(event), 1, f) != 1) {
+          status = 1;
+          break;
+        }
+        print_event(thread, &event);
+      }
+    } else {
+      status = 1;
+    }
+
+    if (status)
+      break;
+  }
+
+  if (status)
+    fprintf(stderr, "Trace file is cut short or damaged\n");
+
+  for (i=0; i<thread_count; i++) {
+    if (threads[i]) {
+      for (j=0; j<TRACE_NAME_COUNT; j++)
+        free(threads[i]->names[j]);
+      free(threads[i]);
+    }
+  }
+  free(threads);
+
+  return status;
+}
+
+
+int main(int argc, char **argv)
+{
+  FILE *f;
+  int status;
+
+  if (argc != 2) {
+    printf("Usage: sudoku-trace <trace file>\n");
+    printf("  Print a trace file written by sudoku --trace <trace file> as debug output.\n");
+    return 1;
+  }
+
+  f = fopen(argv[1], "rb");
+  if (!f) {
+    fprintf(stderr, "Cound not open file: %s\n", argv[1]);
+    return 1;
+  }
+
+  status = decode_trace(f);
+  fclose(f);
+
+  return status;
+}